@@ -3,7 +3,9 @@
 #include "StFwdTrackMaker/StFwdTrackMaker.h"
 #include "StFwdTrackMaker/include/Tracker/FwdHit.h"
 #include "StFwdTrackMaker/include/Tracker/FwdTracker.h"
+#include "StFwdTrackMaker/include/Tracker/FwdTrackProjector.h"
 #include "StFwdTrackMaker/include/Tracker/TrackFitter.h"
+#include "StFwdTrackMaker/include/Tracker/TrackerComparison.h"
 
 #include "KiTrack/IHit.h"
 #include "GenFit/Track.h"
@@ -233,7 +235,7 @@ class ForwardHitLoader : public IHitLoader {
 };
 
 //________________________________________________________________________
-StFwdTrackMaker::StFwdTrackMaker() : StMaker("fwdTrack"), mForwardTracker(0), mForwardHitLoader(0), mFieldAdaptor(new StarFieldAdaptor()){
+StFwdTrackMaker::StFwdTrackMaker() : StMaker("fwdTrack"), mForwardTracker(0), mForwardHitLoader(0), mCompareTracker(0), mTrackerComparison(0), mFieldAdaptor(new StarFieldAdaptor()), mTrackProjector(0), mlt_degraded(0){
     SetAttr("useFtt",1);                 // Default Ftt on 
     SetAttr("useFst",1);                 // Default Fst on
     SetAttr("config", "config.xml");     // Default configuration file (user may override before Init())
@@ -246,6 +248,10 @@ int StFwdTrackMaker::Finish() {
 
     mForwardTracker->finish();
 
+    // write the stage timings and check them against the baseline, if requested
+    Benchmark *benchmark = mForwardTracker->getBenchmark();
+    bool benchmarkOk = benchmark->finish();
+
     gDirectory->mkdir("StFwdTrackMaker");
     gDirectory->cd("StFwdTrackMaker");
     for (auto nh : histograms) {
@@ -253,6 +259,13 @@ int StFwdTrackMaker::Finish() {
         nh.second->Write();
     }
 
+    if (mCompareTracker) {
+        gDirectory->mkdir("Compare");
+        gDirectory->cd("Compare");
+        mCompareTracker->finish();
+        mTrackerComparison->writeHistograms();
+    }
+
     if (mGenTree) {
         mlTree->Print();
         mlFile->cd();
@@ -260,6 +273,11 @@ int StFwdTrackMaker::Finish() {
         mlFile->Write();
     }
 
+    if (!benchmarkOk && benchmark->failOnRegression()) {
+        LOG_ERROR << "StFwdTrackMaker::Finish() : tracking is significantly slower than the benchmark baseline" << endm;
+        return kStErr;
+    }
+
     return kStOk;
 }
 
@@ -298,6 +316,9 @@ int StFwdTrackMaker::Init() {
         mlTree->Branch("phi", &mlt_phi, "phi[nt]/F");
         mlTree->Branch("tid", &mlt_tid, "tid/I");
 
+        // TimeBudget::Action bits applied to the event, 0 = tracked in full
+        mlTree->Branch("degraded", &mlt_degraded, "degraded/I");
+
         std::string path = "TrackFinder.Iteration[0].SegmentBuilder";
         std::vector<string> paths = xfg.childrenOf(path);
 
@@ -324,6 +345,14 @@ int StFwdTrackMaker::Init() {
 
     mSiRasterizer = new SiRasterizer(xfg);
 
+    // inner and outer geometry at the first and last sTGC planes (from the fitted states
+    // on the first and last sTGC points), dca at the beamline (from the second point);
+    // the targets are in the order of kInnerGeometry, kOuterGeometry, kDcaGeometry
+    mTrackProjector = new FwdTrackProjector(1);
+    mTrackProjector->addPlane(280.9, 0);
+    mTrackProjector->addPlane(349.4, 3);
+    mTrackProjector->addLine(TVector3(0, 0, 0), TVector3(0, 0, 1));
+
     mForwardTracker = new ForwardTracker();
     mForwardTracker->setConfig(xfg);
     // only save criteria values if we are generating a tree.
@@ -333,6 +362,27 @@ int StFwdTrackMaker::Init() {
     mForwardTracker->setLoader(mForwardHitLoader);
     mForwardTracker->initialize();
 
+    // Differential validation: run a second configuration on the same hits and compare
+    if (xfg.exists("Compare:config")) {
+        std::string compareFile = xfg.get<std::string>("Compare:config");
+        LOG_F(INFO, "Comparing against tracker configuration : %s", compareFile.c_str());
+        mCompareCfg.loadFile(compareFile, cmdLineConfig);
+
+        if (mCompareCfg.get<std::string>("Output:url", "") == xfg.get<std::string>("Output:url", ""))
+            LOG_F(WARNING, "Both tracker configurations write to Output:url=%s, the QA output of one will be overwritten", xfg.get<std::string>("Output:url", "").c_str());
+
+        mCompareTracker = new ForwardTracker();
+        mCompareTracker->setConfig(mCompareCfg);
+        mCompareTracker->setSaveCriteriaValues(false);
+        mCompareTracker->setLoader(mForwardHitLoader);
+        mCompareTracker->initialize();
+        // each tracker installs its own geometry, field and material in GenFit before its events
+        mForwardTracker->getTrackFitter()->activate();
+
+        mTrackerComparison = new TrackerComparison(xfg);
+        mTrackerComparison->setup();
+    }
+
     histograms["McEventEta"] = new TH1D("McEventEta", ";MC Track Eta", 1000, -5, 5);
     histograms["McEventPt"] = new TH1D("McEventPt", ";MC Track Pt (GeV/c)", 1000, 0, 10);
     histograms["McEventPhi"] = new TH1D("McEventPhi", ";MC Track Phi", 1000, 0, 6.2831852);
@@ -838,8 +888,29 @@ int StFwdTrackMaker::Make() {
 
     LOG_INFO << "mForwardTracker -> doEvent()" << endm;
 
-    // Process single event
-    mForwardTracker->doEvent();
+    // both fitters draw the same random numbers so that only the configuration differs,
+    // the main one on each repeat since the last repeat is compared
+    UInt_t compareSeed = GetEventNumber() + 1;
+
+    // Process single event (several times when benchmarking, the last time fills the output)
+    Benchmark *benchmark = mForwardTracker->getBenchmark();
+    for (size_t iRepeat = 0; iRepeat < benchmark->nRepeats(); iRepeat++) {
+        benchmark->startRepeat(iRepeat);
+        if (mCompareTracker)
+            mForwardTracker->getTrackFitter()->setRandomSeed(compareSeed);
+        mForwardTracker->setFillOutputs(benchmark->lastRepeat());
+        mForwardTracker->doEvent();
+    }
+
+    if (mCompareTracker) {
+        LOG_INFO << "mCompareTracker -> doEvent()" << endm;
+        mCompareTracker->getTrackFitter()->setRandomSeed(compareSeed);
+        mCompareTracker->doEvent();
+
+        mTrackerComparison->compare(TrackerSnapshot::of(*mForwardTracker), TrackerSnapshot::of(*mCompareTracker), GetEventNumber());
+        // the StEvent tracks are projected with the field and material of the main tracker
+        mForwardTracker->getTrackFitter()->activate();
+    }
 
 
 
@@ -874,6 +945,7 @@ int StFwdTrackMaker::Make() {
             }
         }
 
+        mlt_degraded = mForwardTracker->getTimeBudget()->degradation();
         mlTree->Fill();
     } // if mGenTree
 
@@ -942,8 +1014,17 @@ void StFwdTrackMaker::FillEvent()
 
   LOG_INFO << "Filling StEvent w/ results from genfit tracker" << endm;
 
-  // Track seeds
-  const auto &seed_tracks = mForwardTracker -> getRecoTracks();
+  // The dca is taken to the beamline through the primary vertex (clears the projections
+  // of the previous event)
+  const StPrimaryVertex* primaryVertex = stEvent->primaryVertex(0);
+  TVector3 vertex(0, 0, 0);
+  if ( primaryVertex ) {
+    vertex.SetXYZ( primaryVertex->position()[0], primaryVertex->position()[1], primaryVertex->position()[2] );
+  }
+  mTrackProjector->setLine( kDcaGeometry, vertex, TVector3(0., 0., 1.) ); // TODO get actual beamline slope
+
+  // Track seeds, one per global
+  const auto &seed_tracks = mForwardTracker -> globalTrackSeeds();
   // Reconstructed globals
   const auto &genfitTracks = mForwardTracker -> globalTracks();
 
@@ -1014,8 +1095,6 @@ void StFwdTrackMaker::FillEvent()
 
 void StFwdTrackMaker::FillTrack( StTrack *otrack, genfit::Track *itrack, const Seed_t &iseed, StTrackDetectorInfo *info )
 {
-  const double z_stgc[] = { 280.9, 303.7, 326.6, 349.4 };
-
   // otrack == output track
   // itrack == input track (genfit)
 
@@ -1049,13 +1128,12 @@ void StFwdTrackMaker::FillTrack( StTrack *otrack, genfit::Track *itrack, const S
   otrack->setIdTruth( idtruth, qatruth ); // StTrack is dominant contributor model
 
 
-  // Fill the inner and outer geometries of the track.  For now,
-  // always propagate the track to the first layer of the silicon
-  // to fill the inner geometry.
+  // Fill the inner and outer geometries of the track, at the first and
+  // last sTGC planes.
   //
   // TODO: We may need to extend our "geometry" classes for RK parameters
-  FillTrackGeometry( otrack, itrack, z_stgc[0], kInnerGeometry );
-  FillTrackGeometry( otrack, itrack, z_stgc[3], kOuterGeometry );
+  FillTrackGeometry( otrack, itrack, kInnerGeometry );
+  FillTrackGeometry( otrack, itrack, kOuterGeometry );
 
   // Next fill the fit traits
   FillTrackFitTraits( otrack, itrack );
@@ -1236,37 +1314,15 @@ void StFwdTrackMaker::FillTrackFitTraits( StTrack *otrack, genfit::Track *itrack
 }
 
 
-void StFwdTrackMaker::FillTrackGeometry( StTrack *otrack, genfit::Track *itrack, double zplane, int io )
+void StFwdTrackMaker::FillTrackGeometry( StTrack *otrack, genfit::Track *itrack, int io )
 {
-  int ipoint = 0;
-
-  if ( io == kInnerGeometry ) ipoint = 0; // hardcoded to sTGC only for now
-  else                        ipoint = 3;
-
-  // Obtain fitted state
-  genfit::MeasuredStateOnPlane measuredState = itrack->getFittedState(ipoint);
-
-  // Obtain the cardinal representation
-  genfit::AbsTrackRep *cardinal = itrack->getCardinalRep();
-
-  // We really don't want the overhead in the TVector3 ctor/dtor here
-  static TVector3 xhat(1, 0, 0), yhat(0, 1, 0), Z(0, 0, 0);
-
-  // Assign the z position
-  Z[2] = zplane;
-
-  // This is the plane for which we are evaluating the fit
-  const auto detectorPlane = genfit::SharedPlanePtr( new genfit::DetPlane(Z, xhat, yhat) );
-
-  // Update the state to the given plane
-  try {
-    cardinal->extrapolateToPlane( measuredState, detectorPlane, false, true );
-  }
-  catch ( genfit::Exception &e ) {
-    LOG_WARN << e.what() << endm;
+  // The state on the inner / outer plane, from the single projection of the track
+  const auto &projection = mTrackProjector->project( itrack );
+  if ( !projection.valid( io ) ) {
     LOG_WARN << "Extraploation to inner/outer geometry point failed" << endm;
     return;
   }
+  const genfit::MeasuredStateOnPlane &measuredState = projection.state( io );
 
 
   static StThreeVector<double> momentum;
@@ -1321,42 +1377,14 @@ void StFwdTrackMaker::FillTrackGeometry( StTrack *otrack, genfit::Track *itrack,
 
 void StFwdTrackMaker::FillTrackDcaGeometry( StGlobalTrack *otrack, genfit::Track *itrack )
 {
-  // We will need the event
-  StEvent *stEvent = static_cast<StEvent *>(GetInputDS("StEvent"));
-  assert(stEvent); // we warned ya
-
-  // And the primary vertex
-  const StPrimaryVertex* primaryVertex = stEvent->primaryVertex(0);
- 
-  // Obtain fitted state from genfit track
-  genfit::MeasuredStateOnPlane measuredState = itrack->getFittedState(1);
-
-  // Obtain the cardinal representation
-  genfit::AbsTrackRep *cardinal =  itrack->getCardinalRep();
-
-  static TVector3 vertex;
-  double x = 0;
-  double y = 0;
-  double z = 0;
-  if ( primaryVertex ) {
-    x = primaryVertex->position()[0];
-    y = primaryVertex->position()[1];
-    z = primaryVertex->position()[2];
-  }
-  vertex.SetX(x); vertex.SetY(y); vertex.SetZ(z);
-
-  const static TVector3 direct(0., 0., 1.); // TODO get actual beamline slope
-
-  // Extrapolate the measured state to the DCA of the beamline
-  try {
-    cardinal->extrapolateToLine(  measuredState, vertex, direct, false, true );
-  }
-  catch ( genfit::Exception &e ) {
-    LOG_WARN << e.what() << "\n"
-             << "Extrapolation to beamline (DCA) failed." << "\n"
-             << "... vertex " << x << " " << y << "  " << z << endm;
+  // The state at the DCA to the beamline (set in FillEvent), from the single
+  // projection of the track
+  const auto &projection = mTrackProjector->project( itrack );
+  if ( !projection.valid( kDcaGeometry ) ) {
+    LOG_WARN << "Extrapolation to beamline (DCA) failed." << endm;
     return;
   }
+  const genfit::MeasuredStateOnPlane &measuredState = projection.state( kDcaGeometry );
 
   static StThreeVector<double> momentum;
   static StThreeVector<double> origin;
@@ -18,7 +18,9 @@ namespace genfit {
 
 class ForwardTracker;
 class ForwardHitLoader;
+class TrackerComparison;
 class StarFieldAdaptor;
+class FwdTrackProjector;
 
 class StGlobalTrack;
 class StRnDHitCollection;
@@ -50,7 +52,8 @@ class StFwdTrackMaker : public StMaker {
     void Clear(const Option_t *opts = "");
 
     enum { kInnerGeometry,
-           kOuterGeometry };
+           kOuterGeometry,
+           kDcaGeometry };
 
     void SetConfigFile(std::string n) {
         mConfigFile = n;
@@ -61,9 +64,14 @@ class StFwdTrackMaker : public StMaker {
   protected:
     ForwardTracker *mForwardTracker;
     ForwardHitLoader *mForwardHitLoader;
+    // optional second tracker, run on the same hits for differential validation
+    ForwardTracker *mCompareTracker;
+    TrackerComparison *mTrackerComparison;
     StarFieldAdaptor *mFieldAdaptor;
 
     SiRasterizer *mSiRasterizer;
+    // projects the tracks once onto the inner / outer geometry planes and the beamline
+    FwdTrackProjector *mTrackProjector;
 
     typedef std::vector<KiTrack::IHit *> Seed_t;
 
@@ -75,6 +83,7 @@ class StFwdTrackMaker : public StMaker {
 
     float mlt_x[MAX_TREE_ELEMENTS], mlt_y[MAX_TREE_ELEMENTS], mlt_z[MAX_TREE_ELEMENTS];
     int mlt_n, mlt_nt, mlt_tid[MAX_TREE_ELEMENTS], mlt_vid[MAX_TREE_ELEMENTS], mlt_hpt[MAX_TREE_ELEMENTS], mlt_hsv[MAX_TREE_ELEMENTS];
+    int mlt_degraded;
     float mlt_pt[MAX_TREE_ELEMENTS], mlt_eta[MAX_TREE_ELEMENTS], mlt_phi[MAX_TREE_ELEMENTS];
     std::map<string, std::vector<float>> mlt_crits;
     std::map<string, std::vector<int>> mlt_crit_track_ids;
@@ -83,6 +92,7 @@ class StFwdTrackMaker : public StMaker {
     // so I have removed them
     #ifndef __CINT__
         jdb::XmlConfig xfg;
+        jdb::XmlConfig mCompareCfg;
 
         void loadMcTracks( std::map<int, std::shared_ptr<McTrack>> &mcTrackMap );
         void loadStgcHits( std::map<int, std::shared_ptr<McTrack>> &mcTrackMap, std::map<int, std::vector<KiTrack::IHit *>> &hitMap, int count = 0 );
@@ -99,7 +109,7 @@ class StFwdTrackMaker : public StMaker {
     void FillDetectorInfo(StTrackDetectorInfo *info, genfit::Track *track, bool increment);
     void FillTrack(StTrack *otrack, genfit::Track *itrack, const Seed_t &iseed, StTrackDetectorInfo *info);
     void FillTrackFlags(StTrack *otrack, genfit::Track *itrack);
-    void FillTrackGeometry(StTrack *otrack, genfit::Track *itrack, double zplane, int io);
+    void FillTrackGeometry(StTrack *otrack, genfit::Track *itrack, int io);
     void FillTrackDcaGeometry ( StGlobalTrack    *otrack, genfit::Track *itrack );
     void FillTrackFitTraits(StTrack *otrack, genfit::Track *itrack);
     void FillTrackMatches(StTrack *otrack, genfit::Track *itrack);
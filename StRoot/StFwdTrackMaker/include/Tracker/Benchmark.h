@@ -0,0 +1,434 @@
+#ifndef FWD_BENCHMARK_H
+#define FWD_BENCHMARK_H
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "TH1.h"
+
+#include "StFwdTrackMaker/XmlConfig/XmlConfig.h"
+#include "StFwdTrackMaker/include/Tracker/loguru.h"
+
+/**
+ * Minimal JSON value used for the benchmark baseline files.
+ *
+ * Only what the benchmark writes is supported: objects, arrays, numbers,
+ * strings and booleans. Not a general purpose parser.
+ */
+struct BenchmarkJson {
+    enum Type { kNull, kNumber, kString, kBool, kArray, kObject };
+
+    Type type = kNull;
+    double number = 0;
+    std::string str;
+    std::vector<BenchmarkJson> array;
+    std::map<std::string, BenchmarkJson> object;
+
+    bool has(const std::string &key) const { return type == kObject && object.count(key) > 0; }
+    const BenchmarkJson &operator[](const std::string &key) const {
+        static BenchmarkJson nil;
+        auto it = object.find(key);
+        if (type != kObject || it == object.end())
+            return nil;
+        return it->second;
+    }
+
+    static bool parse(const std::string &text, BenchmarkJson &out) {
+        size_t pos = 0;
+        if (!parseValue(text, pos, out))
+            return false;
+        skipSpace(text, pos);
+        return pos == text.size();
+    }
+
+  protected:
+    static void skipSpace(const std::string &t, size_t &pos) {
+        while (pos < t.size() && isspace((unsigned char)t[pos]))
+            pos++;
+    }
+
+    static bool parseString(const std::string &t, size_t &pos, std::string &out) {
+        if (pos >= t.size() || t[pos] != '"')
+            return false;
+        pos++;
+        out.clear();
+        while (pos < t.size() && t[pos] != '"') {
+            if (t[pos] == '\\' && pos + 1 < t.size())
+                pos++;
+            out += t[pos++];
+        }
+        if (pos >= t.size())
+            return false;
+        pos++; // closing quote
+        return true;
+    }
+
+    static bool parseValue(const std::string &t, size_t &pos, BenchmarkJson &out) {
+        skipSpace(t, pos);
+        if (pos >= t.size())
+            return false;
+
+        char c = t[pos];
+        if (c == '{') {
+            out.type = kObject;
+            pos++;
+            skipSpace(t, pos);
+            if (pos < t.size() && t[pos] == '}') {
+                pos++;
+                return true;
+            }
+            while (pos < t.size()) {
+                std::string key;
+                skipSpace(t, pos);
+                if (!parseString(t, pos, key))
+                    return false;
+                skipSpace(t, pos);
+                if (pos >= t.size() || t[pos] != ':')
+                    return false;
+                pos++;
+                if (!parseValue(t, pos, out.object[key]))
+                    return false;
+                skipSpace(t, pos);
+                if (pos < t.size() && t[pos] == ',') {
+                    pos++;
+                    continue;
+                }
+                if (pos < t.size() && t[pos] == '}') {
+                    pos++;
+                    return true;
+                }
+                return false;
+            }
+            return false;
+        }
+
+        if (c == '[') {
+            out.type = kArray;
+            pos++;
+            skipSpace(t, pos);
+            if (pos < t.size() && t[pos] == ']') {
+                pos++;
+                return true;
+            }
+            while (pos < t.size()) {
+                out.array.push_back(BenchmarkJson());
+                if (!parseValue(t, pos, out.array.back()))
+                    return false;
+                skipSpace(t, pos);
+                if (pos < t.size() && t[pos] == ',') {
+                    pos++;
+                    continue;
+                }
+                if (pos < t.size() && t[pos] == ']') {
+                    pos++;
+                    return true;
+                }
+                return false;
+            }
+            return false;
+        }
+
+        if (c == '"') {
+            out.type = kString;
+            return parseString(t, pos, out.str);
+        }
+
+        if (t.compare(pos, 4, "true") == 0 || t.compare(pos, 5, "false") == 0) {
+            out.type = kBool;
+            out.number = (t[pos] == 't') ? 1 : 0;
+            pos += (t[pos] == 't') ? 4 : 5;
+            return true;
+        }
+
+        if (t.compare(pos, 4, "null") == 0) {
+            out.type = kNull;
+            pos += 4;
+            return true;
+        }
+
+        char *end = nullptr;
+        out.type = kNumber;
+        out.number = strtod(t.c_str() + pos, &end);
+        if (end == t.c_str() + pos)
+            return false;
+        pos = end - t.c_str();
+        return true;
+    }
+};
+
+// Robust summary (median and median absolute deviation) of timing samples
+struct BenchmarkStats {
+    double median = 0;
+    double mad = 0;
+    size_t n = 0;
+
+    static double medianOf(std::vector<double> v) {
+        if (v.empty())
+            return 0;
+        std::sort(v.begin(), v.end());
+        size_t m = v.size() / 2;
+        if (v.size() % 2 == 1)
+            return v[m];
+        return 0.5 * (v[m - 1] + v[m]);
+    }
+
+    static BenchmarkStats of(const std::vector<double> &samples) {
+        BenchmarkStats s;
+        s.n = samples.size();
+        s.median = medianOf(samples);
+
+        std::vector<double> dev;
+        for (double x : samples)
+            dev.push_back(fabs(x - s.median));
+        s.mad = medianOf(dev);
+        return s;
+    }
+
+    // MAD scaled to be a consistent estimator of sigma for normal samples
+    double sigma() const { return 1.4826 * mad; }
+};
+
+/**
+ * Per-stage timing harness with a stored baseline and a regression gate.
+ *
+ * Every timed stage (and kernel, using "Stage/Kernel" names) accumulates its
+ * wall time per repeat of the replay dataset. With repeat > 1 each event is
+ * processed several times so that the median and MAD over repeats can be
+ * formed within a single job. Only the last repeat fills the QA output, the
+ * others fill scratch copies of the histograms (see scratchCopies).
+ *
+ * Configured from the <Benchmark> node:
+ *   active           : enable timing (default false)
+ *   mode             : "record" writes the baseline, "compare" checks against it
+ *   baseline         : baseline JSON file
+ *   output           : JSON file for the timings of this job
+ *   repeat           : number of times each event is processed (default 1)
+ *   nSigma           : significance required to flag a slowdown (default 3)
+ *   minRelative      : minimum relative slowdown to flag (default 0.05)
+ *   minAbs           : minimum absolute slowdown in ms to flag (default 0.1)
+ *   failOnRegression : make the maker report an error when a slowdown is found
+ */
+class Benchmark {
+  public:
+    Benchmark(jdb::XmlConfig &_cfg) : cfg(_cfg) {}
+
+    // RAII helper to time a scope into a stage
+    class ScopedTimer {
+      public:
+        ScopedTimer(Benchmark *bm, const std::string &stage) : _bm(bm), _stage(stage) {
+            if (_bm != nullptr && _bm->active())
+                _start = loguru::now_ns();
+        }
+        ~ScopedTimer() { stop(); }
+
+        // record the elapsed time now instead of at the end of the scope
+        void stop() {
+            if (_bm != nullptr && _bm->active())
+                _bm->addTime(_stage, loguru::now_ns() - _start);
+            _bm = nullptr;
+        }
+
+      protected:
+        Benchmark *_bm;
+        std::string _stage;
+        long long _start = 0;
+    };
+
+    void setup() {
+        _active = cfg.get<bool>("Benchmark:active", false);
+        if (!_active)
+            return;
+
+        _mode = cfg.get<std::string>("Benchmark:mode", "record");
+        _baseline = cfg.get<std::string>("Benchmark:baseline", "benchmark_baseline.json");
+        _output = cfg.get<std::string>("Benchmark:output", "benchmark.json");
+        _nRepeats = cfg.get<size_t>("Benchmark:repeat", 1);
+        _nSigma = cfg.get<double>("Benchmark:nSigma", 3.0);
+        _minRelative = cfg.get<double>("Benchmark:minRelative", 0.05);
+        _minAbs = cfg.get<double>("Benchmark:minAbs", 0.1);
+        _failOnRegression = cfg.get<bool>("Benchmark:failOnRegression", false);
+
+        if (_nRepeats < 1)
+            _nRepeats = 1;
+
+        LOG_F(INFO, "Benchmark (mode=%s, repeat=%lu, baseline=%s)", _mode.c_str(), _nRepeats, _baseline.c_str());
+    }
+
+    bool active() const { return _active; }
+    size_t nRepeats() const { return _active ? _nRepeats : 1; }
+    bool failOnRegression() const { return _failOnRegression; }
+
+    void startRepeat(size_t iRepeat) { _iRepeat = iRepeat; }
+    // true on the repeat that fills the output
+    bool lastRepeat() const { return _iRepeat + 1 >= nRepeats(); }
+
+    // detached copies of QA histograms, filled instead of them by the other repeats
+    static std::map<std::string, TH1 *> scratchCopies(const std::map<std::string, TH1 *> &hist) {
+        std::map<std::string, TH1 *> scratch;
+        for (auto &kv : hist) {
+            TH1 *h = kv.second ? (TH1 *)kv.second->Clone() : nullptr;
+            if (h)
+                h->SetDirectory(nullptr);
+            scratch[kv.first] = h;
+        }
+        return scratch;
+    }
+
+    // events are only counted once, on the first repeat
+    void countEvent() {
+        if (_active && _iRepeat == 0)
+            _nEvents++;
+    }
+
+    void addTime(const std::string &stage, long long ns) {
+        std::vector<double> &s = _samples[stage];
+        if (s.size() < _nRepeats)
+            s.resize(_nRepeats, 0.0);
+        s[_iRepeat] += ns * 1e-6; // milliseconds
+    }
+
+    /**
+     * Write the timings of this job and, in compare mode, check them against
+     * the baseline.
+     *
+     * @return false if a significant slowdown was found
+     */
+    bool finish() {
+        if (!_active)
+            return true;
+
+        std::string json = toJson();
+        std::string outName = (_mode == "record") ? _baseline : _output;
+        std::ofstream out(outName.c_str());
+        out << json;
+        out.close();
+        LOG_F(INFO, "Benchmark timings written to %s", outName.c_str());
+
+        if (_mode != "compare")
+            return true;
+
+        return compare(_baseline);
+    }
+
+    // Compare the timings of this job against a baseline file, fails without a usable baseline
+    bool compare(const std::string &baselineFile) {
+        std::ifstream in(baselineFile.c_str());
+        if (!in.good()) {
+            LOG_F(ERROR, "Cannot open benchmark baseline %s", baselineFile.c_str());
+            return false;
+        }
+        std::stringstream sstr;
+        sstr << in.rdbuf();
+
+        BenchmarkJson base;
+        if (!BenchmarkJson::parse(sstr.str(), base) || !base.has("stages")) {
+            LOG_F(ERROR, "Cannot parse benchmark baseline %s", baselineFile.c_str());
+            return false;
+        }
+
+        // the samples are totals over the events of a repeat
+        if (base["nEvents"].number != _nEvents) {
+            LOG_F(ERROR, "Baseline was recorded on %0.0f events, this job has %lu, cannot compare", base["nEvents"].number, _nEvents);
+            return false;
+        }
+
+        bool ok = true;
+        LOG_F(INFO, "%-32s %12s %12s %12s %8s", "stage", "base (ms)", "now (ms)", "delta (ms)", "status");
+        for (auto &kv : _samples) {
+            const BenchmarkJson &bs = base["stages"][kv.first];
+            if (!bs.has("samples_ms")) {
+                LOG_F(INFO, "%-32s %12s %12.3f %12s %8s", kv.first.c_str(), "-", BenchmarkStats::of(kv.second).median, "-", "NEW");
+                continue;
+            }
+
+            std::vector<double> baseSamples;
+            for (auto &v : bs["samples_ms"].array)
+                baseSamples.push_back(v.number);
+
+            BenchmarkStats sb = BenchmarkStats::of(baseSamples);
+            BenchmarkStats sc = BenchmarkStats::of(kv.second);
+            bool slow = isSlowdown(sb, sc);
+            if (slow)
+                ok = false;
+
+            if (slow)
+                LOG_F(WARNING, "%-32s %12.3f %12.3f %12.3f %8s", kv.first.c_str(), sb.median, sc.median, sc.median - sb.median, "SLOWER");
+            else
+                LOG_F(INFO, "%-32s %12.3f %12.3f %12.3f %8s", kv.first.c_str(), sb.median, sc.median, sc.median - sb.median, "ok");
+        }
+        for (auto &kv : base["stages"].object) {
+            if (_samples.count(kv.first) == 0)
+                LOG_F(WARNING, "%-32s %12.3f %12s %12s %8s", kv.first.c_str(), kv.second["median_ms"].number, "-", "-", "MISSING");
+        }
+
+        if (!ok)
+            LOG_F(WARNING, "Benchmark found significant slowdowns with respect to %s", baselineFile.c_str());
+        return ok;
+    }
+
+    // A slowdown must be both statistically significant and large enough to matter
+    bool isSlowdown(const BenchmarkStats &base, const BenchmarkStats &now) const {
+        double delta = now.median - base.median;
+        double sigma = sqrt(base.sigma() * base.sigma() + now.sigma() * now.sigma());
+
+        if (delta <= _minAbs)
+            return false;
+        if (delta <= _minRelative * base.median)
+            return false;
+        return delta > _nSigma * sigma;
+    }
+
+    std::string toJson() const {
+        std::stringstream sstr;
+        sstr << "{\n";
+        sstr << "  \"version\": 1,\n";
+        sstr << "  \"nEvents\": " << _nEvents << ",\n";
+        sstr << "  \"nRepeats\": " << _nRepeats << ",\n";
+        sstr << "  \"stages\": {";
+
+        bool first = true;
+        for (auto &kv : _samples) {
+            BenchmarkStats s = BenchmarkStats::of(kv.second);
+            sstr << (first ? "\n" : ",\n");
+            first = false;
+            sstr << "    \"" << kv.first << "\": { ";
+            sstr << "\"median_ms\": " << s.median << ", ";
+            sstr << "\"mad_ms\": " << s.mad << ", ";
+            if (s.median > 0)
+                sstr << "\"throughput_hz\": " << (_nEvents / (s.median * 1e-3)) << ", ";
+            sstr << "\"samples_ms\": [";
+            for (size_t i = 0; i < kv.second.size(); i++)
+                sstr << (i > 0 ? ", " : "") << kv.second[i];
+            sstr << "] }";
+        }
+        sstr << "\n  }\n}\n";
+        return sstr.str();
+    }
+
+  protected:
+    jdb::XmlConfig &cfg;
+
+    bool _active = false;
+    bool _failOnRegression = false;
+    std::string _mode;
+    std::string _baseline;
+    std::string _output;
+    size_t _nRepeats = 1;
+    size_t _iRepeat = 0;
+    size_t _nEvents = 0;
+    double _nSigma = 3.0;
+    double _minRelative = 0.05;
+    double _minAbs = 0.1;
+
+    // stage name -> accumulated time (ms) per repeat
+    std::map<std::string, std::vector<double>> _samples;
+};
+
+#endif
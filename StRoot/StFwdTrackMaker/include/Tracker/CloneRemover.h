@@ -0,0 +1,143 @@
+#ifndef CLONE_REMOVER_H
+#define CLONE_REMOVER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "StFwdTrackMaker/include/Tracker/FwdHit.h"
+
+/**
+ * Removes clone candidates before subset selection.
+ *
+ * A candidate is keyed by a hash of its sorted hit ids. Exact clones have the same key.
+ * With near-duplicate removal every candidate also claims its leave-one-out keys (its
+ * sorted ids with one hit left out), so a later candidate sharing all but one hit with
+ * it (same length), or missing one of its hits (one shorter), is dropped as well.
+ *
+ * Candidates are visited by decreasing SeedQual and then in input order, so the kept
+ * one of each group is the best and the result is deterministic. Key matches are
+ * checked on the ids, so hash collisions never drop a candidate.
+ */
+class CloneRemover {
+  public:
+    CloneRemover(bool _nearDuplicates = false) : nearDuplicates(_nearDuplicates) {}
+
+    std::vector<Seed_t> apply(const std::vector<Seed_t> &seeds) {
+        const size_t n = seeds.size();
+        nExact = 0;
+        nNear = 0;
+
+        offset.assign(1, 0);
+        ids.clear();
+        for (const Seed_t &s : seeds) {
+            for (KiTrack::IHit *h : s)
+                ids.push_back(static_cast<FwdHit *>(h)->_id);
+            std::sort(ids.begin() + offset.back(), ids.end());
+            offset.push_back(ids.size());
+        }
+
+        std::vector<size_t> order(n);
+        for (size_t i = 0; i < n; i++)
+            order[i] = i;
+        SeedQual quality;
+        std::vector<double> q(n);
+        for (size_t i = 0; i < n; i++)
+            q[i] = quality(seeds[i]);
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return q[a] > q[b]; });
+
+        claimed.clear();
+        std::vector<unsigned char> keep(n, 0);
+        for (size_t i : order) {
+            if (isClaimed(i, kAll, true)) {
+                nExact++;
+                continue;
+            }
+            // a subset of a kept candidate, or the same but one hit
+            bool near = nearDuplicates && isClaimed(i, kAll, false);
+            for (size_t k = 0; nearDuplicates && k < length(i) && !near; k++)
+                near = isClaimed(i, k, false);
+            if (near) {
+                nNear++;
+                continue;
+            }
+
+            keep[i] = 1;
+            claim(i, kAll);
+            for (size_t k = 0; nearDuplicates && k < length(i); k++)
+                claim(i, k);
+        }
+
+        std::vector<Seed_t> result;
+        result.reserve(n - nExact - nNear);
+        for (size_t i = 0; i < n; i++) {
+            if (keep[i])
+                result.push_back(seeds[i]);
+        }
+        return result;
+    }
+
+    size_t nExact = 0; // exact clones removed by the last apply
+    size_t nNear = 0;  // near duplicates removed by the last apply
+
+  protected:
+    static const size_t kAll = size_t(-1); // no hit left out
+
+    size_t length(size_t seed) const { return offset[seed + 1] - offset[seed]; }
+
+    // hash of the sorted ids of seed, leaving out position skip
+    uint64_t key(size_t seed, size_t skip) const {
+        uint64_t h = 1469598103934665603ULL;
+        for (size_t k = 0; k < length(seed); k++) {
+            if (k == skip)
+                continue;
+            h ^= ids[offset[seed] + k];
+            h *= 1099511628211ULL;
+        }
+        return h;
+    }
+
+    // the same ids with one hit (or none) left out on each side
+    bool sameIds(size_t a, size_t skipA, size_t b, size_t skipB) const {
+        size_t ia = offset[a], ea = offset[a + 1];
+        size_t ib = offset[b], eb = offset[b + 1];
+        if (skipA != kAll)
+            skipA += ia;
+        if (skipB != kAll)
+            skipB += ib;
+        while (true) {
+            if (ia == skipA)
+                ia++;
+            if (ib == skipB)
+                ib++;
+            if (ia == ea || ib == eb)
+                return ia == ea && ib == eb;
+            if (ids[ia++] != ids[ib++])
+                return false;
+        }
+    }
+
+    // exactOnly: only match keys claimed with no hit left out
+    bool isClaimed(size_t seed, size_t skip, bool exactOnly) const {
+        auto it = claimed.find(key(seed, skip));
+        if (it == claimed.end())
+            return false;
+        for (auto &owner : it->second) {
+            if (exactOnly && owner.second != kAll)
+                continue;
+            if (sameIds(seed, skip, owner.first, owner.second))
+                return true;
+        }
+        return false;
+    }
+
+    void claim(size_t seed, size_t skip) { claimed[key(seed, skip)].push_back(std::make_pair(seed, skip)); }
+
+    bool nearDuplicates;
+    std::vector<unsigned int> ids; // sorted hit ids of all seeds
+    std::vector<size_t> offset;    // seed i owns ids[offset[i] ... offset[i+1])
+    std::unordered_map<uint64_t, std::vector<std::pair<size_t, size_t>>> claimed; // key -> (kept seed, left out position)
+};
+
+#endif
@@ -0,0 +1,336 @@
+#ifndef CRITERIA_PIPELINE_H
+#define CRITERIA_PIPELINE_H
+
+#include <cmath>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "TH1.h"
+
+#include "Criteria/ICriterion.h"
+#include "KiTrack/IHit.h"
+#include "KiTrack/Segment.h"
+
+#include "StFwdTrackMaker/include/Tracker/loguru.h"
+
+/**
+ * Compile-time fused criteria chains.
+ *
+ * Each cut below reproduces the arithmetic of the KiTrack criterion of the same name,
+ * taking the hit positions directly. A FusedChain<Cuts...> evaluates them inline with
+ * short-circuiting, and FusedCriterion wraps a chain as a single ICriterion, so a pair
+ * or triplet costs one virtual call and no per-criterion map lookups.
+ *
+ * CriteriaPipeline::fuse picks the chain whose cut set matches the configured criteria
+ * exactly; any other combination keeps the generic per-criterion path.
+ */
+namespace CriteriaPipeline {
+
+// (min, max) of each configured criterion, by name
+typedef std::map<std::string, std::pair<float, float>> CutValues;
+
+/** A cut window scaled by factor. Windows containing 0 (the ideal value of the differences,
+ * e.g. DeltaRho in [-5, 1]) have both limits scaled towards it, so they keep 0 inside;
+ * other windows (e.g. RZRatio in [0.9, 1.1]) are shrunk around their centre.
+ */
+inline std::pair<float, float> tightened(float vmin, float vmax, float factor) {
+    if (factor >= 1)
+        return std::make_pair(vmin, vmax);
+    if (vmin <= 0 && vmax >= 0)
+        return std::make_pair(vmin * factor, vmax * factor);
+    float centre = 0.5f * (vmin + vmax), half = 0.5f * (vmax - vmin) * factor;
+    return std::make_pair(centre - half, centre + half);
+}
+
+// hit positions of a 2-hit (a = parent, b = child) or 3-hit (a, b from parent, c from child) combination
+struct Points {
+    float ax, ay, az;
+    float bx, by, bz;
+    float cx, cy, cz;
+};
+
+/**************** two hit cuts ****************/
+struct RZRatio {
+    struct Params {
+        float min2, max2;
+    };
+    static const char *name() { return "Crit2_RZRatio"; }
+    static Params params(float min, float max) { return Params{min * min, max * max}; }
+    static inline bool pass(const Points &p, const Params &c) {
+        float dx = p.ax - p.bx, dy = p.ay - p.by, dz = p.az - p.bz;
+        float ratio2 = 0.;
+        if (dz * dz != 0.)
+            ratio2 = (dx * dx + dy * dy + dz * dz) / (dz * dz);
+        return ratio2 <= c.max2 && ratio2 >= c.min2;
+    }
+};
+
+struct DeltaRho {
+    struct Params {
+        float min, max;
+    };
+    static const char *name() { return "Crit2_DeltaRho"; }
+    static Params params(float min, float max) { return Params{min, max}; }
+    static inline bool pass(const Points &p, const Params &c) {
+        float deltaRho = sqrt(p.ax * p.ax + p.ay * p.ay) - sqrt(p.bx * p.bx + p.by * p.by);
+        return deltaRho <= c.max && deltaRho >= c.min;
+    }
+};
+
+struct DeltaPhi {
+    struct Params {
+        float min, max;
+    };
+    static const char *name() { return "Crit2_DeltaPhi"; }
+    static Params params(float min, float max) { return Params{min, max}; }
+    static inline bool pass(const Points &p, const Params &c) {
+        float deltaPhi = atan2(p.ay, p.ax) - atan2(p.by, p.bx);
+        if (deltaPhi > M_PI)
+            deltaPhi -= 2 * M_PI;
+        if (deltaPhi < -M_PI)
+            deltaPhi += 2 * M_PI;
+        if ((p.bx * p.bx + p.by * p.by < 0.0001) || (p.ax * p.ax + p.ay * p.ay < 0.0001))
+            deltaPhi = 0.;
+        deltaPhi = 180. * fabs(deltaPhi) / M_PI;
+        return deltaPhi <= c.max && deltaPhi >= c.min;
+    }
+};
+
+/**************** three hit cuts ****************/
+struct Angle3D {
+    struct Params {
+        double cosMin2, cosMax2;
+    };
+    static const char *name() { return "Crit3_3DAngle"; }
+    // angles in degrees, compared as cos^2
+    static Params params(float min, float max) {
+        double cosMin = cos(max * M_PI / 180.), cosMax = cos(min * M_PI / 180.);
+        return Params{cosMin * cosMin, cosMax * cosMax};
+    }
+    static inline bool pass(const Points &p, const Params &c) {
+        float ux = p.bx - p.ax, uy = p.by - p.ay, uz = p.bz - p.az;
+        float vx = p.cx - p.bx, vy = p.cy - p.by, vz = p.cz - p.bz;
+        double numerator = ux * vx + uy * vy + uz * vz;
+        double uSquared = ux * ux + uy * uy + uz * uz;
+        double vSquared = vx * vx + vy * vy + vz * vz;
+        if (uSquared * vSquared <= 0.)
+            return true;
+        double cosThetaSquared = numerator * numerator / (uSquared * vSquared);
+        if (cosThetaSquared > 1.)
+            cosThetaSquared = 1;
+        return cosThetaSquared >= c.cosMin2 && cosThetaSquared <= c.cosMax2;
+    }
+};
+
+struct Angle2D {
+    struct Params {
+        double cosMin2, cosMax2;
+    };
+    static const char *name() { return "Crit3_2DAngle"; }
+    static Params params(float min, float max) {
+        double cosMin = cos(max * M_PI / 180.), cosMax = cos(min * M_PI / 180.);
+        return Params{cosMin * cosMin, cosMax * cosMax};
+    }
+    static inline bool pass(const Points &p, const Params &c) {
+        float ux = p.bx - p.ax, uy = p.by - p.ay;
+        float vx = p.cx - p.bx, vy = p.cy - p.by;
+        double numerator = ux * vx + uy * vy;
+        double uSquared = ux * ux + uy * uy;
+        double vSquared = vx * vx + vy * vy;
+        if (uSquared * vSquared <= 0.)
+            return true;
+        double cosThetaSquared = numerator * numerator / (uSquared * vSquared);
+        if (cosThetaSquared > 1.)
+            cosThetaSquared = 1;
+        return cosThetaSquared >= c.cosMin2 && cosThetaSquared <= c.cosMax2;
+    }
+};
+
+struct ChangeRZRatio {
+    struct Params {
+        float min2, max2;
+    };
+    static const char *name() { return "Crit3_ChangeRZRatio"; }
+    static Params params(float min, float max) { return Params{min * min, max * max}; }
+    static inline bool pass(const Points &p, const Params &c) {
+        float ratioSquaredParent = 0.;
+        float dz = p.az - p.bz;
+        if (dz * dz != 0.)
+            ratioSquaredParent = ((p.ax - p.bx) * (p.ax - p.bx) + (p.ay - p.by) * (p.ay - p.by) + dz * dz) / (dz * dz);
+
+        float ratioSquaredChild = 0.;
+        dz = p.cz - p.bz;
+        if (dz * dz != 0.)
+            ratioSquaredChild = ((p.cx - p.bx) * (p.cx - p.bx) + (p.cy - p.by) * (p.cy - p.by) + dz * dz) / (dz * dz);
+
+        float ratioOfRZRatioSquared = 0.;
+        if (ratioSquaredChild != 0.)
+            ratioOfRZRatioSquared = ratioSquaredParent / ratioSquaredChild;
+        return ratioOfRZRatioSquared >= c.min2 && ratioOfRZRatioSquared <= c.max2;
+    }
+};
+
+/**************** the chain ****************/
+template <typename... Cuts>
+class FusedChain;
+
+template <>
+class FusedChain<> {
+  public:
+    static void names(std::set<std::string> &) {}
+    void configure(const CutValues &) {}
+    inline bool pass(const Points &) const { return true; }
+};
+
+template <typename Cut, typename... Rest>
+class FusedChain<Cut, Rest...> : public FusedChain<Rest...> {
+  public:
+    static void names(std::set<std::string> &n) {
+        n.insert(Cut::name());
+        FusedChain<Rest...>::names(n);
+    }
+    void configure(const CutValues &cuts) {
+        auto it = cuts.find(Cut::name());
+        params = Cut::params(it->second.first, it->second.second);
+        FusedChain<Rest...>::configure(cuts);
+    }
+    inline bool pass(const Points &p) const { return Cut::pass(p, params) && FusedChain<Rest...>::pass(p); }
+
+  protected:
+    typename Cut::Params params;
+};
+
+// A criterion that can also be evaluated directly on hit positions, without Segments
+class PointCriterion : public KiTrack::ICriterion {
+  public:
+    virtual bool passPoints(const Points &p) = 0;
+};
+
+// A fused chain exposed as a single KiTrack criterion
+template <size_t nHits, typename... Cuts>
+class FusedCriterion : public PointCriterion {
+  public:
+    FusedCriterion(const CutValues &cuts) {
+        chain.configure(cuts);
+        _name = "Fused";
+        for (auto &kv : cuts)
+            _name += "_" + kv.first;
+        _type = nHits == 2 ? "2Hit" : "3Hit";
+    }
+
+    static std::set<std::string> names() {
+        std::set<std::string> n;
+        FusedChain<Cuts...>::names(n);
+        return n;
+    }
+
+    virtual bool areCompatible(KiTrack::Segment *parent, KiTrack::Segment *child) {
+        Points p;
+        if (nHits == 2) {
+            set(parent->getHits()[0], p.ax, p.ay, p.az);
+            set(child->getHits()[0], p.bx, p.by, p.bz);
+        } else {
+            const std::vector<KiTrack::IHit *> &ph = parent->getHits();
+            set(ph[0], p.ax, p.ay, p.az);
+            set(ph[1], p.bx, p.by, p.bz);
+            set(child->getHits()[1], p.cx, p.cy, p.cz);
+        }
+        return chain.pass(p);
+    }
+
+    virtual bool passPoints(const Points &p) { return chain.pass(p); }
+
+  protected:
+    static inline void set(KiTrack::IHit *h, float &x, float &y, float &z) {
+        x = h->getX();
+        y = h->getY();
+        z = h->getZ();
+    }
+
+    FusedChain<Cuts...> chain;
+};
+
+/**
+ * Runs the fused criterion and the generic criteria side by side, counts disagreements
+ * and returns the generic result
+ */
+class ValidatingCriterion : public KiTrack::ICriterion {
+  public:
+    ValidatingCriterion(KiTrack::ICriterion *_fused, std::vector<KiTrack::ICriterion *> _generic, TH1 *_hist)
+        : fused(_fused), generic(_generic), hist(_hist) {
+        _name = fused->getName();
+        _type = fused->getType();
+    }
+
+    virtual bool areCompatible(KiTrack::Segment *parent, KiTrack::Segment *child) {
+        bool reference = true;
+        for (auto crit : generic) {
+            if (!crit->areCompatible(parent, child)) {
+                reference = false;
+                break;
+            }
+        }
+
+        bool result = fused->areCompatible(parent, child);
+        if (result != reference) {
+            nDifferent++;
+            if (hist)
+                hist->Fill("Different", 1);
+        } else if (hist) {
+            hist->Fill("Same", 1);
+        }
+        return reference;
+    }
+
+    size_t nDifferent = 0;
+
+  protected:
+    KiTrack::ICriterion *fused;
+    std::vector<KiTrack::ICriterion *> generic;
+    TH1 *hist;
+};
+
+// the precompiled combinations
+typedef FusedCriterion<2, RZRatio, DeltaPhi, DeltaRho> TwoHitAll;
+typedef FusedCriterion<2, RZRatio, DeltaPhi> TwoHitRZPhi;
+typedef FusedCriterion<2, RZRatio, DeltaRho> TwoHitRZRho;
+typedef FusedCriterion<2, DeltaPhi, DeltaRho> TwoHitPhiRho;
+typedef FusedCriterion<3, Angle3D, ChangeRZRatio, Angle2D> ThreeHitAll;
+typedef FusedCriterion<3, Angle3D, ChangeRZRatio> ThreeHit3DRZ;
+typedef FusedCriterion<3, Angle3D, Angle2D> ThreeHitAngles;
+typedef FusedCriterion<3, Angle3D> ThreeHit3D;
+
+template <typename Fused>
+bool tryFuse(const std::set<std::string> &configured, const CutValues &cuts, KiTrack::ICriterion *&result) {
+    if (result != nullptr || configured != Fused::names())
+        return false;
+    result = new Fused(cuts);
+    return true;
+}
+
+/** Returns a fused criterion for the given cuts, or nullptr if no precompiled
+ * combination matches them exactly
+ */
+inline KiTrack::ICriterion *fuse(const CutValues &cuts) {
+    std::set<std::string> configured;
+    for (auto &kv : cuts)
+        configured.insert(kv.first);
+
+    KiTrack::ICriterion *result = nullptr;
+    tryFuse<TwoHitAll>(configured, cuts, result);
+    tryFuse<TwoHitRZPhi>(configured, cuts, result);
+    tryFuse<TwoHitRZRho>(configured, cuts, result);
+    tryFuse<TwoHitPhiRho>(configured, cuts, result);
+    tryFuse<ThreeHitAll>(configured, cuts, result);
+    tryFuse<ThreeHit3DRZ>(configured, cuts, result);
+    tryFuse<ThreeHitAngles>(configured, cuts, result);
+    tryFuse<ThreeHit3D>(configured, cuts, result);
+    return result;
+}
+
+} // namespace CriteriaPipeline
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef FIT_SCHEDULER_H
+#define FIT_SCHEDULER_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "StFwdTrackMaker/include/Tracker/FwdHit.h"
+
+/**
+ * Order in which the seeds of an iteration are fitted, best seeds first.
+ *
+ * Seeds are ranked by their number of hits, then SeedQual, then the consistency of
+ * the seed curvature: the relative spread of the circle radii fitted to the hit
+ * triplets in seedState (TrackFitter::seedCurvatures). Seeds with fewer than two
+ * valid radii rank last among equals. The sort is stable, so the order is the same
+ * for every run.
+ */
+class FitScheduler {
+  public:
+    struct Priority {
+        size_t nHits;
+        double quality;
+        double curvatureSpread;
+    };
+
+    // relative RMS of the valid (> minRadius) radii, 1 if there are fewer than two
+    static double curvatureSpread(const std::vector<float> &radii, float minRadius = 10) {
+        double sum = 0, sum2 = 0;
+        size_t n = 0;
+        for (float r : radii) {
+            if (r <= minRadius || std::isinf(r))
+                continue;
+            sum += r;
+            sum2 += r * r;
+            n++;
+        }
+        if (n < 2)
+            return 1;
+        double mean = sum / n;
+        return std::sqrt(std::max(0.0, sum2 / n - mean * mean)) / mean;
+    }
+
+    static bool before(const Priority &a, const Priority &b) {
+        if (a.nHits != b.nHits)
+            return a.nHits > b.nHits;
+        if (a.quality != b.quality)
+            return a.quality > b.quality;
+        return a.curvatureSpread < b.curvatureSpread;
+    }
+
+    /** Indices of the seeds in fitting order.
+     * @param radii callable returning the triplet circle radii of a seed
+     */
+    template <typename F>
+    std::vector<size_t> order(const std::vector<Seed_t> &seeds, F radii) {
+        SeedQual quality;
+        priorities.resize(seeds.size());
+        for (size_t i = 0; i < seeds.size(); i++) {
+            priorities[i].nHits = seeds[i].size();
+            priorities[i].quality = quality(seeds[i]);
+            priorities[i].curvatureSpread = curvatureSpread(radii(seeds[i]));
+        }
+
+        std::vector<size_t> result(seeds.size());
+        for (size_t i = 0; i < result.size(); i++)
+            result[i] = i;
+        std::stable_sort(result.begin(), result.end(), [&](size_t a, size_t b) { return before(priorities[a], priorities[b]); });
+        return result;
+    }
+
+    // the seeds reordered for fitting
+    template <typename F>
+    std::vector<Seed_t> schedule(const std::vector<Seed_t> &seeds, F radii) {
+        std::vector<Seed_t> result;
+        result.reserve(seeds.size());
+        for (size_t i : order(seeds, radii))
+            result.push_back(seeds[i]);
+        return result;
+    }
+
+  protected:
+    std::vector<Priority> priorities;
+};
+
+#endif
@@ -0,0 +1,454 @@
+#ifndef FLAT_AUTOMATON_H
+#define FLAT_AUTOMATON_H
+
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+#include "Criteria/ICriterion.h"
+#include "KiTrack/Automaton.h"
+#include "KiTrack/IHit.h"
+#include "KiTrack/Segment.h"
+
+#include "StFwdTrackMaker/include/Tracker/CriteriaPipeline.h"
+#include "StFwdTrackMaker/include/Tracker/FwdHit.h"
+#include "StFwdTrackMaker/include/Tracker/ParallelUtils.h"
+#include "StFwdTrackMaker/include/Tracker/loguru.h"
+
+/**
+ * Cellular automaton over contiguous arrays, replacing the KiTrack::Automaton steps
+ * lengthenSegments / doAutomaton / cleanBadStates / getTracks.
+ *
+ * Hits are indexed in hitmap order. The 1-hit connections (outer -> inner hit) are the
+ * 2-hit segments; their parent/child links after lengthening are stored in CSR form
+ * (childOffset / childIndex). States are updated synchronously, one array pass per step.
+ *
+ * Like KiTrack, a 2-hit segment holds its hits outer first and sits on the layer of its
+ * inner hit, and cleanBadStates keeps the segments whose state equals their layer.
+ * Candidates are returned with their hits in ascending z.
+ *
+ * Lengthening and the state evolution can run on several threads (setNumThreads). Each
+ * thread handles a contiguous block of segments and the blocks are merged in order, so
+ * the result does not depend on the number of threads. Lengthening with generic (non
+ * point) criteria stays on one thread since KiTrack criteria keep per-call state.
+ */
+class FlatAutomaton {
+  public:
+    FlatAutomaton(std::map<int, std::vector<KiTrack::IHit *>> &hitmap) {
+        for (auto &kv : hitmap) {
+            sectorOffset[kv.first] = hits.size();
+            for (KiTrack::IHit *h : kv.second) {
+                hits.push_back(h);
+                hitX.push_back(h->getX());
+                hitY.push_back(h->getY());
+                hitZ.push_back(h->getZ());
+                hitLayer.push_back(h->getLayer());
+            }
+        }
+    }
+
+    ~FlatAutomaton() {
+        for (auto seg : segObjects)
+            delete seg;
+    }
+
+    unsigned int hitIndex(int sector, size_t i) const { return sectorOffset.at(sector) + i; }
+
+    // outer = parent hit, inner = child hit of a 1-hit segment connection
+    void addConnection(unsigned int outer, unsigned int inner) {
+        segOuter.push_back(outer);
+        segInner.push_back(inner);
+    }
+
+    // Takes the connections of a KiTrack 1-hit segment automaton
+    void addConnections(KiTrack::Automaton &automaton) {
+        std::unordered_map<KiTrack::IHit *, unsigned int> index;
+        for (size_t i = 0; i < hits.size(); i++)
+            index[hits[i]] = i;
+
+        for (KiTrack::Segment *parent : automaton.getSegments()) {
+            unsigned int outer = index[parent->getHits()[0]];
+            for (KiTrack::Segment *child : parent->getChildren())
+                addConnection(outer, index[child->getHits()[0]]);
+        }
+    }
+
+    void setNumThreads(size_t n) { nThreads = ParallelUtils::nThreads(n); }
+
+    size_t nSegments() const { return segOuter.size(); }
+    size_t nConnections() const { return childIndex.size(); }
+
+    // Connects the 2-hit segments (a, b) -> (b, c) passing all three-hit criteria
+    void lengthenSegments(const std::vector<KiTrack::ICriterion *> &crits) {
+        const size_t nSeg = segOuter.size();
+
+        // all segments starting at a given hit, in CSR form
+        std::vector<unsigned int> outerOffset(hits.size() + 1, 0);
+        std::vector<unsigned int> byOuter(nSeg);
+        for (size_t s = 0; s < nSeg; s++)
+            outerOffset[segOuter[s] + 1]++;
+        for (size_t h = 0; h < hits.size(); h++)
+            outerOffset[h + 1] += outerOffset[h];
+        std::vector<unsigned int> fill(outerOffset.begin(), outerOffset.end() - 1);
+        for (size_t s = 0; s < nSeg; s++)
+            byOuter[fill[segOuter[s]]++] = s;
+
+        // Point criteria (the fused chains) avoid building Segment objects
+        std::vector<CriteriaPipeline::PointCriterion *> pointCrits;
+        for (auto crit : crits) {
+            auto pc = dynamic_cast<CriteriaPipeline::PointCriterion *>(crit);
+            if (pc)
+                pointCrits.push_back(pc);
+        }
+        usePoints = (pointCrits.size() == crits.size());
+        if (!usePoints)
+            makeSegmentObjects();
+
+        // children of each block of segments, merged in block order
+        size_t nBlocks = usePoints ? ParallelUtils::nChunks(nSeg, nThreads, minPerThread) : 1;
+        std::vector<std::vector<unsigned int>> blockChildren(nBlocks);
+        std::vector<std::vector<unsigned int>> blockCounts(nBlocks);
+        ParallelUtils::parallelFor(nSeg, nBlocks, [&](size_t begin, size_t end, size_t iBlock) {
+            std::vector<unsigned int> &children = blockChildren[iBlock];
+            std::vector<unsigned int> &counts = blockCounts[iBlock];
+            for (size_t s = begin; s < end; s++) {
+                unsigned int b = segInner[s];
+                size_t before = children.size();
+                for (unsigned int k = outerOffset[b]; k < outerOffset[b + 1]; k++) {
+                    unsigned int c = byOuter[k];
+                    if (usePoints ? passPoints(pointCrits, s, c) : passSegments(crits, s, c))
+                        children.push_back(c);
+                }
+                counts.push_back(children.size() - before);
+            }
+        }, minPerThread);
+
+        childOffset.assign(nSeg + 1, 0);
+        childIndex.clear();
+        size_t s = 0;
+        for (size_t iBlock = 0; iBlock < nBlocks; iBlock++) {
+            childIndex.insert(childIndex.end(), blockChildren[iBlock].begin(), blockChildren[iBlock].end());
+            for (unsigned int n : blockCounts[iBlock]) {
+                childOffset[s + 1] = childOffset[s] + n;
+                s++;
+            }
+        }
+
+        state.assign(nSeg, 0);
+        alive.assign(nSeg, 1);
+    }
+
+    // Synchronous state evolution, returns the number of steps taken
+    size_t doAutomaton(size_t maxSteps = 1000) {
+        const size_t nSeg = segOuter.size();
+        std::vector<int> next(nSeg);
+        size_t nBlocks = ParallelUtils::nChunks(nSeg, nThreads, minPerThread);
+        std::vector<unsigned char> blockChanged(nBlocks);
+        size_t nSteps = 0;
+        bool changed = true;
+        while (changed && nSteps < maxSteps) {
+            std::fill(blockChanged.begin(), blockChanged.end(), 0);
+            ParallelUtils::parallelFor(nSeg, nBlocks, [&](size_t begin, size_t end, size_t iBlock) {
+                for (size_t s = begin; s < end; s++) {
+                    next[s] = state[s];
+                    for (unsigned int k = childOffset[s]; k < childOffset[s + 1]; k++) {
+                        if (state[childIndex[k]] == state[s]) {
+                            next[s] = state[s] + 1;
+                            blockChanged[iBlock] = 1;
+                            break;
+                        }
+                    }
+                }
+            }, minPerThread);
+            changed = std::find(blockChanged.begin(), blockChanged.end(), 1) != blockChanged.end();
+            state.swap(next);
+            nSteps++;
+        }
+        return nSteps;
+    }
+
+    // keep only segments whose state equals their layer, i.e. those with an unbroken chain to the innermost layer
+    void cleanBadStates() {
+        for (size_t s = 0; s < segOuter.size(); s++)
+            alive[s] = (state[s] == (int)hitLayer[segInner[s]]);
+    }
+
+    size_t nAlive() const { return std::count(alive.begin(), alive.end(), 1); }
+
+    // All root-to-leaf paths through the surviving segments with at least minHits hits
+    std::vector<Seed_t> getTracks(size_t minHits) {
+        std::vector<Seed_t> tracks;
+        std::vector<unsigned char> hasParent = aliveParents();
+        std::vector<unsigned char> hasChild(segOuter.size(), 0);
+        for (size_t s = 0; s < segOuter.size(); s++) {
+            for (unsigned int k = childOffset[s]; k < childOffset[s + 1] && !hasChild[s]; k++)
+                hasChild[s] = alive[childIndex[k]];
+        }
+
+        std::vector<unsigned int> path;
+        std::vector<unsigned int> cursor;
+        for (size_t root = 0; root < segOuter.size(); root++) {
+            if (!alive[root] || hasParent[root])
+                continue;
+
+            path.assign(1, root);
+            cursor.assign(1, childOffset[root]);
+            while (!path.empty()) {
+                unsigned int s = path.back();
+                unsigned int &k = cursor.back();
+
+                // next surviving child
+                while (k < childOffset[s + 1] && !alive[childIndex[k]])
+                    k++;
+
+                if (k < childOffset[s + 1]) {
+                    unsigned int c = childIndex[k++];
+                    path.push_back(c);
+                    cursor.push_back(childOffset[c]);
+                    continue;
+                }
+
+                // a leaf ends a candidate
+                if (!hasChild[s] && path.size() + 1 >= minHits)
+                    tracks.push_back(seedOf(path));
+
+                path.pop_back();
+                cursor.pop_back();
+            }
+        }
+        return tracks;
+    }
+
+    // what getBestTracks had to drop
+    struct Truncation {
+        size_t nRootsTruncated = 0; // roots with more than maxPerRoot paths
+        unsigned long long nPaths = 0; // all root-to-leaf paths (saturating)
+        size_t nKept = 0;
+        bool totalCapped = false; // maxTotal was hit
+
+        bool truncated() const { return nRootsTruncated > 0 || totalCapped; }
+    };
+
+    /**
+     * Bounded alternative to getTracks: keeps the maxPerRoot best root-to-leaf paths of
+     * each root segment, and at most maxTotal candidates overall (0 = no limit).
+     *
+     * The best suffixes of every segment are built bottom-up (inner layers first) from
+     * those of its children, so no path is enumerated unless it is kept. Paths are ranked
+     * by number of hits, then by the summed kink 1 - cos^2 between consecutive segments.
+     */
+    std::vector<Seed_t> getBestTracks(size_t minHits, size_t maxPerRoot, size_t maxTotal, Truncation &report) {
+        const size_t nSeg = segOuter.size();
+        const size_t K = std::max<size_t>(1, maxPerRoot);
+        const unsigned long long maxCount = std::numeric_limits<unsigned long long>::max() / 2;
+
+        // children before parents: children always sit on a lower layer
+        std::vector<unsigned int> order(nSeg);
+        for (size_t s = 0; s < nSeg; s++)
+            order[s] = s;
+        std::stable_sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) { return hitLayer[segInner[a]] < hitLayer[segInner[b]]; });
+
+        // up to K best suffixes per segment, stored at suffix[suffixStart[s]...]
+        std::vector<Suffix> suffix;
+        std::vector<size_t> suffixStart(nSeg, 0);
+        std::vector<unsigned int> nSuffix(nSeg, 0);
+        std::vector<unsigned long long> nPaths(nSeg, 0);
+        std::vector<Suffix> merged;
+
+        for (unsigned int s : order) {
+            if (!alive[s])
+                continue;
+
+            merged.clear();
+            for (unsigned int k = childOffset[s]; k < childOffset[s + 1]; k++) {
+                unsigned int c = childIndex[k];
+                if (!alive[c])
+                    continue;
+                nPaths[s] = std::min(maxCount, nPaths[s] + nPaths[c]);
+                float kink = kinkOf(s, c);
+                for (unsigned int r = 0; r < nSuffix[c]; r++) {
+                    const Suffix &cs = suffix[suffixStart[c] + r];
+                    merged.push_back(Suffix{cs.cost + kink, (unsigned short)(cs.nSegments + 1), c, (unsigned short)r});
+                }
+            }
+
+            suffixStart[s] = suffix.size();
+            if (merged.empty()) { // leaf
+                nPaths[s] = 1;
+                suffix.push_back(Suffix{0.f, 1, 0, 0});
+                nSuffix[s] = 1;
+                continue;
+            }
+
+            size_t keep = std::min(K, merged.size());
+            std::partial_sort(merged.begin(), merged.begin() + keep, merged.end(), betterSuffix);
+            suffix.insert(suffix.end(), merged.begin(), merged.begin() + keep);
+            nSuffix[s] = keep;
+        }
+
+        // roots
+        std::vector<unsigned char> hasParent = aliveParents();
+        std::vector<std::pair<Suffix, unsigned int>> candidates; // (suffix, root)
+        report = Truncation();
+        for (size_t root = 0; root < nSeg; root++) {
+            if (!alive[root] || hasParent[root])
+                continue;
+            report.nPaths = std::min(maxCount, report.nPaths + nPaths[root]);
+            if (nPaths[root] > K)
+                report.nRootsTruncated++;
+            for (unsigned int r = 0; r < nSuffix[root]; r++) {
+                const Suffix &sf = suffix[suffixStart[root] + r];
+                if (sf.nSegments + 1u >= minHits)
+                    candidates.push_back(std::make_pair(sf, (unsigned int)root));
+            }
+        }
+
+        if (maxTotal > 0 && candidates.size() > maxTotal) {
+            std::stable_sort(candidates.begin(), candidates.end(), [](const std::pair<Suffix, unsigned int> &a, const std::pair<Suffix, unsigned int> &b) { return betterSuffix(a.first, b.first); });
+            candidates.resize(maxTotal);
+            report.totalCapped = true;
+        }
+
+        std::vector<Seed_t> tracks;
+        std::vector<unsigned int> path;
+        for (auto &cand : candidates) {
+            // follow the (child, rank) links down to the leaf
+            path.assign(1, cand.second);
+            Suffix sf = cand.first;
+            while (sf.nSegments > 1) {
+                path.push_back(sf.child);
+                sf = suffix[suffixStart[sf.child] + sf.childRank];
+            }
+            tracks.push_back(seedOf(path));
+        }
+        report.nKept = tracks.size();
+        return tracks;
+    }
+
+    // (outer hit id, inner hit id) of every 2-hit segment
+    std::vector<std::pair<unsigned int, unsigned int>> connectionIds() const {
+        std::vector<std::pair<unsigned int, unsigned int>> ids;
+        ids.reserve(segOuter.size());
+        for (size_t s = 0; s < segOuter.size(); s++)
+            ids.push_back(std::make_pair(static_cast<FwdHit *>(hits[segOuter[s]])->_id, static_cast<FwdHit *>(hits[segInner[s]])->_id));
+        return ids;
+    }
+
+    // candidates as sorted hit id sets, for comparisons with the KiTrack automaton
+    static std::set<std::vector<unsigned int>> idSets(const std::vector<Seed_t> &tracks) {
+        std::set<std::vector<unsigned int>> sets;
+        for (auto &t : tracks) {
+            std::vector<unsigned int> ids;
+            for (auto h : t)
+                ids.push_back(static_cast<FwdHit *>(h)->_id);
+            std::sort(ids.begin(), ids.end());
+            sets.insert(ids);
+        }
+        return sets;
+    }
+
+  protected:
+    // best path from a segment down to a leaf: its length, cost and the (child, rank) it continues with
+    struct Suffix {
+        float cost;
+        unsigned short nSegments;
+        unsigned int child;
+        unsigned short childRank;
+    };
+
+    static bool betterSuffix(const Suffix &a, const Suffix &b) {
+        if (a.nSegments != b.nSegments)
+            return a.nSegments > b.nSegments;
+        return a.cost < b.cost;
+    }
+
+    // 1 - cos^2 of the angle between a segment and its child
+    float kinkOf(unsigned int parent, unsigned int child) const {
+        unsigned int a = segOuter[parent], b = segInner[parent], c = segInner[child];
+        float ux = hitX[b] - hitX[a], uy = hitY[b] - hitY[a], uz = hitZ[b] - hitZ[a];
+        float vx = hitX[c] - hitX[b], vy = hitY[c] - hitY[b], vz = hitZ[c] - hitZ[b];
+        float uv = ux * vx + uy * vy + uz * vz;
+        float uu = ux * ux + uy * uy + uz * uz;
+        float vv = vx * vx + vy * vy + vz * vz;
+        if (uu * vv <= 0.f)
+            return 0.f;
+        return 1.f - uv * uv / (uu * vv);
+    }
+
+    std::vector<unsigned char> aliveParents() const {
+        std::vector<unsigned char> hasParent(segOuter.size(), 0);
+        for (size_t s = 0; s < segOuter.size(); s++) {
+            if (!alive[s])
+                continue;
+            for (unsigned int k = childOffset[s]; k < childOffset[s + 1]; k++)
+                hasParent[childIndex[k]] = 1;
+        }
+        return hasParent;
+    }
+
+    Seed_t seedOf(const std::vector<unsigned int> &path) const {
+        Seed_t seed;
+        for (unsigned int s : path)
+            seed.push_back(hits[segOuter[s]]);
+        seed.push_back(hits[segInner[path.back()]]);
+        std::sort(seed.begin(), seed.end(), [](KiTrack::IHit *a, KiTrack::IHit *b) { return a->getZ() < b->getZ(); });
+        return seed;
+    }
+
+    inline bool passPoints(const std::vector<CriteriaPipeline::PointCriterion *> &crits, unsigned int parent, unsigned int child) const {
+        CriteriaPipeline::Points p;
+        unsigned int a = segOuter[parent], b = segInner[parent], c = segInner[child];
+        p.ax = hitX[a], p.ay = hitY[a], p.az = hitZ[a];
+        p.bx = hitX[b], p.by = hitY[b], p.bz = hitZ[b];
+        p.cx = hitX[c], p.cy = hitY[c], p.cz = hitZ[c];
+        for (auto crit : crits) {
+            if (!crit->passPoints(p))
+                return false;
+        }
+        return true;
+    }
+
+    inline bool passSegments(const std::vector<KiTrack::ICriterion *> &crits, unsigned int parent, unsigned int child) const {
+        for (auto crit : crits) {
+            if (!crit->areCompatible(segObjects[parent], segObjects[child]))
+                return false;
+        }
+        return true;
+    }
+
+    // 2-hit KiTrack segments (outer hit first), needed by the generic criteria only
+    void makeSegmentObjects() {
+        if (!segObjects.empty())
+            return;
+        segObjects.reserve(segOuter.size());
+        for (size_t s = 0; s < segOuter.size(); s++) {
+            std::vector<KiTrack::IHit *> segHits = {hits[segOuter[s]], hits[segInner[s]]};
+            KiTrack::Segment *seg = new KiTrack::Segment(segHits);
+            seg->setLayer(hitLayer[segInner[s]]);
+            segObjects.push_back(seg);
+        }
+    }
+
+    std::vector<KiTrack::IHit *> hits;
+    std::vector<float> hitX, hitY, hitZ;
+    std::vector<unsigned int> hitLayer;
+    std::map<int, unsigned int> sectorOffset;
+
+    // 2-hit segments
+    std::vector<unsigned int> segOuter, segInner;
+    std::vector<unsigned int> childOffset, childIndex;
+    std::vector<int> state;
+    std::vector<unsigned char> alive;
+
+    bool usePoints = false;
+    std::vector<KiTrack::Segment *> segObjects;
+
+    size_t nThreads = 1;
+    // below this many segments per thread the threads cost more than they save
+    static const size_t minPerThread = 4096;
+};
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef FWD_CACHE_FILE_H
+#define FWD_CACHE_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#include <unistd.h>
+
+#include "StFwdTrackMaker/include/Tracker/loguru.h"
+
+/**
+ * Helpers shared by the binary cache files of the tracker (field grid, geometry snapshot),
+ * each made of a fixed header followed by a payload checksummed in the header.
+ */
+class FwdCacheFile {
+  public:
+    // FNV-1a over n bytes
+    static uint64_t checksum(const void *data, size_t n) {
+        const unsigned char *p = static_cast<const unsigned char *>(data);
+        uint64_t h = 14695981039346656037ULL;
+        for (size_t i = 0; i < n; i++) {
+            h ^= p[i];
+            h *= 1099511628211ULL;
+        }
+        return h;
+    }
+
+    /** Writes the header and the payload to a temporary file renamed to the cache, so readers
+     * never see a partial file
+     * @param what description of the file for the warnings
+     */
+    static bool write(const std::string &file, const void *header, size_t headerSize, const void *payload, size_t payloadSize, const char *what) {
+        std::string tmp = file + ".tmp." + std::to_string((long)getpid());
+        FILE *out = fopen(tmp.c_str(), "wb");
+        if (out == nullptr) {
+            LOG_F(WARNING, "Cannot write the %s %s", what, tmp.c_str());
+            return false;
+        }
+        bool ok = fwrite(header, headerSize, 1, out) == 1 && (payloadSize == 0 || fwrite(payload, payloadSize, 1, out) == 1);
+        ok = (fclose(out) == 0) && ok;
+        if (!ok || rename(tmp.c_str(), file.c_str()) != 0) {
+            LOG_F(WARNING, "Cannot write the %s %s", what, file.c_str());
+            remove(tmp.c_str());
+            return false;
+        }
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,167 @@
+#ifndef FWD_GEOM_SNAPSHOT_H
+#define FWD_GEOM_SNAPSHOT_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "StFwdTrackMaker/include/Tracker/FwdCacheFile.h"
+#include "StFwdTrackMaker/include/Tracker/loguru.h"
+
+/**
+ * Compact description of the forward geometry, so jobs can start without importing TGeo.
+ *
+ * It holds the Si and sTGC planes (position, orientation and r/phi pitch of the sensors)
+ * and the summary of the material between them used by FwdMaterialInterface. It is built
+ * once from TGeo and saved to a small binary file with a format version, the key of the
+ * geometry it was built from (file name and modification time) and a checksum.
+ */
+class FwdGeomSnapshot {
+  public:
+    static const uint32_t kVersion = 1;
+
+    enum Detector { kSi = 0, kStgc = 1 };
+
+    struct Plane {
+        int32_t detector = kSi;
+        int32_t index = 0;
+        double o[3] = {0, 0, 0};
+        double u[3] = {1, 0, 0};
+        double v[3] = {0, 1, 0};
+        double rPitch = 0, phiPitch = 0; // sensor segmentation, 0 if not segmented in r/phi
+    };
+
+    // effective material of one (layer, r, phi) bin, see FwdMaterialInterface
+    struct MaterialBin {
+        double density, Z, A, radiationLength, mEE, xOverX0;
+    };
+
+    // parameters the material map was built with
+    struct MaterialParams {
+        double planeThickness = 0, zMin = 0, zMax = 0, rMax = 0;
+        uint64_t nR = 0, nPhi = 0;
+
+        bool operator==(const MaterialParams &o) const {
+            return planeThickness == o.planeThickness && zMin == o.zMin && zMax == o.zMax && rMax == o.rMax && nR == o.nR && nPhi == o.nPhi;
+        }
+    };
+
+    std::vector<Plane> planes;
+    MaterialParams material;
+    std::vector<double> bounds; // layer boundaries in z
+    std::vector<MaterialBin> bins;
+
+    // key of a geometry file, empty if the file does not exist
+    static std::string keyFor(const std::string &geometryFile) {
+        struct stat st;
+        if (stat(geometryFile.c_str(), &st) != 0)
+            return "";
+        return geometryFile + " " + std::to_string((long long)st.st_mtime);
+    }
+
+    // z of the planes of a detector, in the order they were added
+    std::vector<float> planeZ(Detector detector) const {
+        std::vector<float> z;
+        for (const Plane &p : planes) {
+            if (p.detector == detector)
+                z.push_back(p.o[2]);
+        }
+        return z;
+    }
+
+    /** Reads the snapshot file
+     * @param key expected geometry key, empty to accept any geometry
+     * @returns false if the file is missing, of another version or geometry, or corrupt
+     */
+    bool load(const std::string &file, const std::string &key) {
+        FILE *in = fopen(file.c_str(), "rb");
+        if (in == nullptr)
+            return false;
+        Header h;
+        std::vector<char> payload;
+        bool ok = fread(&h, sizeof(h), 1, in) == 1 && memcmp(h.magic, "FWDGSNAP", 8) == 0 && h.version == kVersion && h.headerSize == sizeof(Header);
+        struct stat st;
+        ok = ok && fstat(fileno(in), &st) == 0 && (uint64_t)st.st_size == sizeof(Header) + payloadSize(h.nPlanes, h.nBounds, h.nBins);
+        if (ok) {
+            payload.resize(payloadSize(h.nPlanes, h.nBounds, h.nBins));
+            ok = payload.empty() || fread(payload.data(), payload.size(), 1, in) == 1;
+        }
+        fclose(in);
+        h.key[sizeof(h.key) - 1] = 0;
+
+        if (!ok || h.checksum != FwdCacheFile::checksum(payload.data(), payload.size())) {
+            LOG_F(WARNING, "Geometry snapshot %s is of another version or corrupt", file.c_str());
+            return false;
+        }
+        if (!key.empty() && key != h.key) {
+            LOG_F(WARNING, "Geometry snapshot %s is for '%s', not '%s'", file.c_str(), h.key, key.c_str());
+            return false;
+        }
+        if (key.empty())
+            LOG_F(WARNING, "Geometry file not found, using the snapshot %s of '%s'", file.c_str(), h.key);
+
+        const char *p = payload.data();
+        planes.resize(h.nPlanes);
+        bounds.resize(h.nBounds);
+        bins.resize(h.nBins);
+        copyFrom(p, planes);
+        copyFrom(p, bounds);
+        copyFrom(p, bins);
+        material = h.material;
+        return true;
+    }
+
+    // writes the snapshot, replacing the file at once
+    bool write(const std::string &file, const std::string &key) const {
+        Header h = Header();
+        memcpy(h.magic, "FWDGSNAP", 8);
+        h.version = kVersion;
+        h.headerSize = sizeof(Header);
+        strncpy(h.key, key.c_str(), sizeof(h.key) - 1);
+        h.material = material;
+        h.nPlanes = planes.size();
+        h.nBounds = bounds.size();
+        h.nBins = bins.size();
+
+        std::vector<char> payload(payloadSize(h.nPlanes, h.nBounds, h.nBins));
+        char *p = payload.data();
+        copyTo(p, planes);
+        copyTo(p, bounds);
+        copyTo(p, bins);
+        h.checksum = FwdCacheFile::checksum(payload.data(), payload.size());
+        return FwdCacheFile::write(file, &h, sizeof(h), payload.data(), payload.size(), "geometry snapshot");
+    }
+
+  protected:
+    struct Header {
+        char magic[8]; // "FWDGSNAP"
+        uint32_t version;
+        uint32_t headerSize;
+        char key[256]; // geometry file and modification time
+        MaterialParams material;
+        uint64_t nPlanes, nBounds, nBins;
+        uint64_t checksum; // of the payload
+    };
+
+    static size_t payloadSize(uint64_t nPlanes, uint64_t nBounds, uint64_t nBins) {
+        return nPlanes * sizeof(Plane) + nBounds * sizeof(double) + nBins * sizeof(MaterialBin);
+    }
+
+    template <typename T> static void copyTo(char *&p, const std::vector<T> &values) {
+        if (!values.empty())
+            memcpy(p, values.data(), values.size() * sizeof(T));
+        p += values.size() * sizeof(T);
+    }
+
+    template <typename T> static void copyFrom(const char *&p, std::vector<T> &values) {
+        if (!values.empty())
+            memcpy(values.data(), p, values.size() * sizeof(T));
+        p += values.size() * sizeof(T);
+    }
+};
+
+#endif
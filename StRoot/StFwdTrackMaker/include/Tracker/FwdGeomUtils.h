@@ -19,6 +19,8 @@ class FwdGeomUtils {
         }
 
         bool cd( const char* path ){
+            if ( _navigator == nullptr )
+                return false;
             // Change to the specified path
             bool ret = _navigator -> cd(path);
             // If successful, set the node, the volume, and the GLOBAL transformation
@@ -59,6 +61,18 @@ class FwdGeomUtils {
             return 0.0;
         }
 
+        // local x and y axes of the current node in global coordinates
+        bool axes( double u[3], double v[3] ) const {
+            if ( _matrix == nullptr )
+                return false;
+            const double *r = _matrix->GetRotationMatrix();
+            for ( int i = 0; i < 3; i++ ){
+                u[i] = r[3 * i];
+                v[i] = r[3 * i + 1];
+            }
+            return true;
+        }
+
     protected:
     TGeoVolume    *_volume    = nullptr;
     TGeoNode      *_node      = nullptr;
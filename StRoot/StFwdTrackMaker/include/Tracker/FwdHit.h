@@ -124,6 +124,8 @@ class FwdConnector : public KiTrack::ISectorConnector {
         return r;
     };
 
+    unsigned int getDistance() const { return _distance; }
+
   private:
   protected:
     const FwdSystem _system; // numbering system
@@ -132,27 +134,20 @@ class FwdConnector : public KiTrack::ISectorConnector {
 
 class SeedQual {
   public:
-    inline double operator()(Seed_t s) { return double(s.size()) / 7.0; }
+    inline double operator()(const Seed_t &s) { return double(s.size()) / 7.0; }
 };
 
 class SeedCompare {
   public:
-    inline bool operator()(Seed_t trackA, Seed_t trackB) {
-        std::map<unsigned int, unsigned int> hit_counts;
+    inline bool operator()(const Seed_t &trackA, const Seed_t &trackB) {
         // we are assuming that the same hit can never be used twice on a single
-        // track!
-
-        for (auto h : trackA) {
-            hit_counts[static_cast<FwdHit *>(h)->_id]++;
-        }
-
-        // now look at the other track and see if it has the same hits in it
-        for (auto h : trackB) {
-            hit_counts[static_cast<FwdHit *>(h)->_id]++;
-
-            // incompatible if they share a single hit
-            if (hit_counts[static_cast<FwdHit *>(h)->_id] >= 2) {
-                return false;
+        // track, and seeds are short, so compare all pairs of hits
+        for (auto ha : trackA) {
+            unsigned int id = static_cast<FwdHit *>(ha)->_id;
+            for (auto hb : trackB) {
+                // incompatible if they share a single hit
+                if (static_cast<FwdHit *>(hb)->_id == id)
+                    return false;
             }
         }
 
@@ -0,0 +1,403 @@
+#ifndef FWD_KALMAN_BATCH_H
+#define FWD_KALMAN_BATCH_H
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <vector>
+
+#include "StFwdTrackMaker/include/Tracker/FwdKalmanFitter.h"
+
+/**
+ * Batched version of FwdKalmanFitter for many tracks with the same plane structure
+ * (e.g. all seeds with one hit on each of the 4 sTGC planes).
+ *
+ * The states, covariances (packed symmetric) and Jacobians of a block of tracks are
+ * stored as SoA, and every predict / update step is a loop over the tracks of the block
+ * (the update kLanes tracks at a time on local arrays) that the compiler can vectorize
+ * (-O3, checked with -fopt-info-vec). Only the field lookup is done one track at a time.
+ * Tracks are processed in blocks of blockSize to stay in cache.
+ *
+ * Same model as FwdKalmanFitter (RK4 with the Jacobian of the state, Highland scattering
+ * at every plane, forward + backward filter per iteration), except that the RK steps are
+ * shared by the block and the iterations only stop early once all its tracks are stable.
+ */
+class FwdKalmanBatch {
+  public:
+    typedef FwdKalmanFitter::Measurement Measurement;
+    typedef FwdKalmanFitter::Result Result;
+    typedef std::array<double, 5> Seed; // x, y, tx, ty, q/p on the plane of the first hit
+
+    FwdKalmanBatch(FwdKalmanFitter::Field _field) : field(_field) {}
+
+    void setIterations(size_t n) { nIterations = std::max<size_t>(2, n); }
+    void setMaxStep(double cm) { maxStep = cm; }
+    void setXOverX0(double x) { xOverX0 = x; }
+    void setConvergence(double relChi2Change) { convergence = relChi2Change; }
+    void setMass(double m) { mass = m; }
+    void setBlockSize(size_t n) { blockSize = std::max<size_t>(1, n); }
+
+    /** Fits tracks with the same number (at least 3) of hits sorted in z,
+     * hits[t][k] being the k-th plane of track t
+     */
+    std::vector<Result> fit(const std::vector<std::vector<Measurement>> &hits, const std::vector<Seed> &seeds) {
+        std::vector<Result> results(hits.size());
+        if (hits.empty() || hits[0].size() < 3)
+            return results;
+        for (size_t begin = 0; begin < hits.size(); begin += blockSize)
+            fitBlock(hits, seeds, begin, std::min(hits.size(), begin + blockSize), results);
+        return results;
+    }
+
+  protected:
+    static constexpr double kappa = 0.299792458e-3; // GeV/c per (kGauss cm)
+
+    // index of (i, j) in a packed symmetric 5x5 matrix
+    static int sym(int i, int j) { return i >= j ? i * (i + 1) / 2 + j : j * (j + 1) / 2 + i; }
+
+    // RK variables: x, y, tx, ty, then the Jacobian entries d(x, y, tx, ty)/d(tx, ty, q/p)
+    enum { kNRK = 16 };
+
+    void fitBlock(const std::vector<std::vector<Measurement>> &hits, const std::vector<Seed> &seeds, size_t begin, size_t end, std::vector<Result> &results) {
+        n = end - begin;
+        const size_t nPlanes = hits[begin].size();
+        resize(nPlanes);
+
+        for (size_t k = 0; k < nPlanes; k++) {
+            for (size_t t = 0; t < n; t++) {
+                const Measurement &m = hits[begin + t][k];
+                mx[k][t] = m.x;
+                my[k][t] = m.y;
+                mz[k][t] = m.z;
+                cxx[k][t] = m.cxx;
+                cxy[k][t] = m.cxy;
+                cyy[k][t] = m.cyy;
+            }
+        }
+        for (size_t t = 0; t < n; t++) {
+            z[t] = mz[0][t];
+            for (int i = 0; i < 5; i++)
+                v[i][t] = seeds[begin + t][i];
+            chi2Previous[t] = -1;
+            converged[t] = 0;
+        }
+
+        size_t it = 0;
+        for (; it < nIterations; it++) {
+            resetCovariance();
+            std::fill(chi2.begin(), chi2.end(), 0);
+            for (size_t k = 0; k < nPlanes; k++) {
+                if (k > 0)
+                    propagate(mz[k]);
+                update(k);
+                scatter();
+            }
+
+            resetCovariance();
+            std::fill(chi2.begin(), chi2.end(), 0);
+            for (size_t k = nPlanes; k-- > 0;) {
+                if (k + 1 < nPlanes)
+                    propagate(mz[k]);
+                update(k);
+                if (k > 0)
+                    scatter();
+            }
+
+            size_t nStable = 0;
+            for (size_t t = 0; t < n; t++) {
+                converged[t] = FwdKalmanFitter::chi2Stable(chi2[t], chi2Previous[t], convergence);
+                nStable += FwdKalmanFitter::chi2Stable(chi2[t], chi2Previous[t]);
+                chi2Previous[t] = chi2[t];
+            }
+            if (nStable == n) {
+                it++;
+                break;
+            }
+        }
+
+        for (size_t t = 0; t < n; t++) {
+            Result &r = results[begin + t];
+            r.first.z = z[t];
+            bool finite = std::isfinite(chi2[t]);
+            for (int i = 0; i < 5; i++) {
+                r.first.v[i] = v[i][t];
+                for (int j = 0; j < 5; j++)
+                    r.first.C[i][j] = C[sym(i, j)][t];
+                finite = finite && std::isfinite(v[i][t]) && std::isfinite(C[sym(i, i)][t]);
+            }
+            r.chi2 = chi2[t];
+            r.ndf = 2 * (int)nPlanes - 5;
+            r.nIterations = it;
+            r.converged = converged[t] && finite && v[4][t] != 0;
+        }
+    }
+
+    void resize(size_t nPlanes) {
+        auto zero = [&](std::vector<double> &a) { a.assign(n, 0); };
+        mx.resize(nPlanes);
+        my.resize(nPlanes);
+        mz.resize(nPlanes);
+        cxx.resize(nPlanes);
+        cxy.resize(nPlanes);
+        cyy.resize(nPlanes);
+        for (size_t k = 0; k < nPlanes; k++) {
+            zero(mx[k]);
+            zero(my[k]);
+            zero(mz[k]);
+            zero(cxx[k]);
+            zero(cxy[k]);
+            zero(cyy[k]);
+        }
+        zero(z);
+        zero(h);
+        zero(chi2);
+        zero(chi2Previous);
+        converged.assign(n, 0);
+        zero(bx);
+        zero(by);
+        zero(bz);
+        for (int i = 0; i < 5; i++)
+            zero(v[i]);
+        for (int i = 0; i < 15; i++)
+            zero(C[i]);
+        for (int i = 0; i < 25; i++) {
+            zero(J[i]);
+            zero(JC[i]);
+        }
+        for (int i = 0; i < kNRK; i++) {
+            zero(y[i]);
+            zero(ys[i]);
+            zero(dy[i]);
+            zero(acc[i]);
+        }
+    }
+
+    void resetCovariance() {
+        for (int i = 0; i < 15; i++)
+            std::fill(C[i].begin(), C[i].end(), 0);
+        double *qop = v[4].data();
+        double *c44 = C[sym(4, 4)].data();
+        for (size_t t = 0; t < n; t++) {
+            C[sym(0, 0)][t] = C[sym(1, 1)][t] = 1e2;
+            C[sym(2, 2)][t] = C[sym(3, 3)][t] = 1;
+            c44[t] = std::max(1e-2, qop[t] * qop[t]);
+        }
+    }
+
+    // derivative of the RK variables ys at z + c h into dy
+    void derivative(double c) {
+        for (size_t t = 0; t < n; t++)
+            field(ys[0][t], ys[1][t], z[t] + c * h[t], bx[t], by[t], bz[t]);
+
+        const double *qop = v[4].data();
+        for (size_t t = 0; t < n; t++) {
+            double tx = ys[2][t], ty = ys[3][t];
+            double nn = std::sqrt(1 + tx * tx + ty * ty);
+            double axn = tx * ty * bx[t] - (1 + tx * tx) * by[t] + ty * bz[t];
+            double ayn = (1 + ty * ty) * bx[t] - tx * ty * by[t] - tx * bz[t];
+            double kq = kappa * qop[t];
+            double a22 = kq * (tx / nn * axn + nn * (ty * bx[t] - 2 * tx * by[t]));
+            double a23 = kq * (ty / nn * axn + nn * (tx * bx[t] + bz[t]));
+            double a24 = kappa * nn * axn;
+            double a32 = kq * (tx / nn * ayn + nn * (-ty * by[t] - bz[t]));
+            double a33 = kq * (ty / nn * ayn + nn * (2 * ty * bx[t] - tx * by[t]));
+            double a34 = kappa * nn * ayn;
+
+            dy[0][t] = tx;
+            dy[1][t] = ty;
+            dy[2][t] = kq * nn * axn;
+            dy[3][t] = kq * nn * ayn;
+            // rows x and y of the Jacobian follow rows tx and ty
+            dy[4][t] = ys[10][t];
+            dy[5][t] = ys[11][t];
+            dy[6][t] = ys[12][t];
+            dy[7][t] = ys[13][t];
+            dy[8][t] = ys[14][t];
+            dy[9][t] = ys[15][t];
+            dy[10][t] = a22 * ys[10][t] + a23 * ys[13][t];
+            dy[11][t] = a22 * ys[11][t] + a23 * ys[14][t];
+            dy[12][t] = a22 * ys[12][t] + a23 * ys[15][t] + a24;
+            dy[13][t] = a32 * ys[10][t] + a33 * ys[13][t];
+            dy[14][t] = a32 * ys[11][t] + a33 * ys[14][t];
+            dy[15][t] = a32 * ys[12][t] + a33 * ys[15][t] + a34;
+        }
+    }
+
+    // propagates the block to the planes at zTarget (one z per track)
+    void propagate(const std::vector<double> &zTarget) {
+        double maxDz = 0;
+        for (size_t t = 0; t < n; t++)
+            maxDz = std::max(maxDz, std::fabs(zTarget[t] - z[t]));
+        int nSteps = std::max(1, (int)std::ceil(maxDz / maxStep));
+        for (size_t t = 0; t < n; t++)
+            h[t] = (zTarget[t] - z[t]) / nSteps;
+
+        for (int i = 0; i < 4; i++)
+            std::copy(v[i].begin(), v[i].end(), y[i].begin());
+        for (int i = 4; i < kNRK; i++)
+            std::fill(y[i].begin(), y[i].end(), 0);
+        std::fill(y[10].begin(), y[10].end(), 1); // d tx / d tx
+        std::fill(y[14].begin(), y[14].end(), 1); // d ty / d ty
+
+        const double c[4] = {0, 0.5, 0.5, 1};
+        const double w[4] = {1, 2, 2, 1};
+        for (int step = 0; step < nSteps; step++) {
+            for (int i = 0; i < kNRK; i++)
+                std::fill(acc[i].begin(), acc[i].end(), 0);
+            for (int stage = 0; stage < 4; stage++) {
+                for (int i = 0; i < kNRK; i++) {
+                    double *ysi = ys[i].data(), *ki = dy[i].data();
+                    const double *yi = y[i].data(), *hh = h.data();
+                    for (size_t t = 0; t < n; t++)
+                        ysi[t] = yi[t] + c[stage] * hh[t] * ki[t];
+                }
+                derivative(c[stage]);
+                for (int i = 0; i < kNRK; i++) {
+                    double *a = acc[i].data(), *ki = dy[i].data();
+                    for (size_t t = 0; t < n; t++)
+                        a[t] += w[stage] * ki[t];
+                }
+            }
+            for (int i = 0; i < kNRK; i++) {
+                double *yi = y[i].data(), *a = acc[i].data();
+                const double *hh = h.data();
+                for (size_t t = 0; t < n; t++)
+                    yi[t] += hh[t] / 6 * a[t];
+            }
+            for (size_t t = 0; t < n; t++)
+                z[t] += h[t];
+        }
+        for (size_t t = 0; t < n; t++)
+            z[t] = zTarget[t];
+        for (int i = 0; i < 4; i++)
+            std::copy(y[i].begin(), y[i].end(), v[i].begin());
+
+        // full Jacobian, then C = J C J^T
+        for (int i = 0; i < 25; i++)
+            std::fill(J[i].begin(), J[i].end(), (i % 6 == 0) ? 1 : 0);
+        for (int row = 0; row < 4; row++) {
+            for (int col = 2; col < 5; col++)
+                std::copy(y[4 + 3 * row + col - 2].begin(), y[4 + 3 * row + col - 2].end(), J[5 * row + col].begin());
+        }
+        for (int i = 0; i < 5; i++) {
+            for (int j = 0; j < 5; j++) {
+                double *jc = JC[5 * i + j].data();
+                std::fill(JC[5 * i + j].begin(), JC[5 * i + j].end(), 0);
+                for (int m = 0; m < 5; m++) {
+                    const double *jim = J[5 * i + m].data(), *cmj = C[sym(m, j)].data();
+                    for (size_t t = 0; t < n; t++)
+                        jc[t] += jim[t] * cmj[t];
+                }
+            }
+        }
+        for (int i = 0; i < 5; i++) {
+            for (int j = 0; j <= i; j++) {
+                double *cij = C[sym(i, j)].data();
+                std::fill(C[sym(i, j)].begin(), C[sym(i, j)].end(), 0);
+                for (int m = 0; m < 5; m++) {
+                    const double *jc = JC[5 * i + m].data(), *jjm = J[5 * j + m].data();
+                    for (size_t t = 0; t < n; t++)
+                        cij[t] += jc[t] * jjm[t];
+                }
+            }
+        }
+    }
+
+    /** Kalman update of the block with the measurements of plane k, kLanes tracks at a
+     * time: every step is a loop over the lanes on local arrays, which the compiler
+     * vectorizes. Tracks with a singular residual covariance are not updated.
+     */
+    void update(size_t pk) {
+        const double *mxk = mx[pk].data(), *myk = my[pk].data(), *sxx = cxx[pk].data(), *sxy = cxy[pk].data(), *syy = cyy[pk].data();
+        for (size_t t0 = 0; t0 < n; t0 += kLanes) {
+            const size_t m = n - t0 < kLanes ? n - t0 : kLanes;
+            double hc[2][5][kLanes]; // rows x and y of the covariance before the update
+            for (int row = 0; row < 2; row++) {
+                for (int j = 0; j < 5; j++) {
+                    const double *c = C[sym(row, j)].data() + t0;
+                    for (size_t l = 0; l < m; l++)
+                        hc[row][j][l] = c[l];
+                }
+            }
+
+            double r0[kLanes], r1[kLanes], det[kLanes], i00[kLanes], i01[kLanes], i11[kLanes];
+            const double *x = v[0].data() + t0, *y = v[1].data() + t0;
+            for (size_t l = 0; l < m; l++) {
+                size_t t = t0 + l;
+                r0[l] = mxk[t] - x[l];
+                r1[l] = myk[t] - y[l];
+                double S00 = sxx[t] + hc[0][0][l], S01 = sxy[t] + hc[0][1][l], S11 = syy[t] + hc[1][1][l];
+                det[l] = S00 * S11 - S01 * S01;
+                double inv = 1.0 / det[l];
+                i00[l] = S11 * inv;
+                i01[l] = -S01 * inv;
+                i11[l] = S00 * inv;
+            }
+            // kept out of the loop above, a select on a comparison prevents its vectorization
+            for (size_t l = 0; l < m; l++) {
+                if (!(det[l] > 0))
+                    i00[l] = i01[l] = i11[l] = 0;
+            }
+            double *x2 = chi2.data() + t0;
+            for (size_t l = 0; l < m; l++)
+                x2[l] += r0[l] * r0[l] * i00[l] + 2 * r0[l] * r1[l] * i01[l] + r1[l] * r1[l] * i11[l];
+
+            // gain and state, then C -= K H C
+            double k0[5][kLanes], k1[5][kLanes];
+            for (int i = 0; i < 5; i++) {
+                double *vi = v[i].data() + t0;
+                for (size_t l = 0; l < m; l++) {
+                    k0[i][l] = hc[0][i][l] * i00[l] + hc[1][i][l] * i01[l];
+                    k1[i][l] = hc[0][i][l] * i01[l] + hc[1][i][l] * i11[l];
+                    vi[l] += k0[i][l] * r0[l] + k1[i][l] * r1[l];
+                }
+            }
+            for (int i = 0; i < 5; i++) {
+                for (int j = 0; j <= i; j++) {
+                    double *cij = C[sym(i, j)].data() + t0;
+                    for (size_t l = 0; l < m; l++)
+                        cij[l] -= k0[i][l] * hc[0][j][l] + k1[i][l] * hc[1][j][l];
+                }
+            }
+        }
+    }
+
+    // Highland multiple scattering at the current plane
+    void scatter() {
+        if (xOverX0 <= 0)
+            return;
+        for (size_t t = 0; t < n; t++) {
+            double tx = v[2][t], ty = v[3][t];
+            double n2 = 1 + tx * tx + ty * ty;
+            double x = xOverX0 * std::sqrt(n2);
+            double qop = std::fabs(v[4][t]);
+            double p = qop > 0 ? 1.0 / qop : 0;
+            double beta = qop > 0 ? p / std::sqrt(p * p + mass * mass) : 1;
+            double theta0 = 0.0136 * qop / beta * std::sqrt(x) * (1 + 0.038 * std::log(x));
+            double t2 = theta0 * theta0 * n2;
+            C[sym(2, 2)][t] += t2 * (1 + tx * tx);
+            C[sym(3, 3)][t] += t2 * (1 + ty * ty);
+            C[sym(3, 2)][t] += t2 * tx * ty;
+        }
+    }
+
+    static const size_t kLanes = 8; // tracks per step of update()
+
+    FwdKalmanFitter::Field field;
+    size_t nIterations = 3;
+    double maxStep = 10;
+    double xOverX0 = 0.01;
+    double mass = 0.105658; // muon
+    double convergence = 0.2;
+    size_t blockSize = 256;
+
+    // block of n tracks
+    size_t n = 0;
+    std::vector<std::vector<double>> mx, my, mz, cxx, cxy, cyy; // [plane][track]
+    std::vector<double> z, h, chi2, chi2Previous, bx, by, bz;
+    std::vector<unsigned char> converged; // per track, see FwdKalmanFitter::setConvergence
+    std::vector<double> v[5], C[15], J[25], JC[25];
+    std::vector<double> y[kNRK], ys[kNRK], dy[kNRK], acc[kNRK];
+};
+
+#endif
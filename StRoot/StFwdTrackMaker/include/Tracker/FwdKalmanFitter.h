@@ -0,0 +1,317 @@
+#ifndef FWD_KALMAN_FITTER_H
+#define FWD_KALMAN_FITTER_H
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <vector>
+
+/**
+ * Lightweight Kalman fitter for the planar forward geometry.
+ *
+ * The state on a plane of constant z is (x, y, tx = dx/dz, ty = dy/dz, q/p) with a fixed
+ * size 5x5 covariance, so no dynamic matrices or per-hit heap objects are needed. States
+ * are propagated between planes with a 4th order Runge-Kutta integration of the track
+ * equations in the field, the transport Jacobian being integrated along (field gradients
+ * neglected). Multiple scattering is added at every measurement plane with the Highland
+ * formula for a configurable thickness x/X0; energy loss is neglected.
+ *
+ * Each iteration runs a forward filter (increasing z) and a backward filter that ends on
+ * the first hit, which then carries the information of all hits. The next iteration
+ * starts from that state, until the chi2 changes by less than 1e-3 (relative). As in
+ * GenFit, the fit has converged when the relative chi2 change of its last iteration is
+ * below the convergence limit (0.2 by default).
+ *
+ * Units are cm, kGauss and GeV/c (as in GenFit).
+ */
+class FwdKalmanFitter {
+  public:
+    // field (bx, by, bz) at (x, y, z)
+    typedef std::function<void(double, double, double, double &, double &, double &)> Field;
+
+    struct State {
+        double z = 0;
+        double v[5] = {0, 0, 0, 0, 0}; // x, y, tx, ty, q/p
+        double C[5][5] = {{0}};
+    };
+
+    struct Measurement {
+        double x, y, z;
+        double cxx, cxy, cyy; // covariance of (x, y)
+    };
+
+    struct Result {
+        bool converged = false; // the chi2 was stable in the last iteration, see setConvergence
+        State first; // at the first hit in z
+        double chi2 = 0;
+        int ndf = 0;
+        size_t nIterations = 0;
+
+        int charge() const { return first.v[4] > 0 ? 1 : -1; }
+        double p() const { return first.v[4] != 0 ? 1.0 / std::fabs(first.v[4]) : 0; }
+        // momentum at the first hit, tracks go to +z
+        void momentum(double &px, double &py, double &pz) const {
+            double n = std::sqrt(1 + first.v[2] * first.v[2] + first.v[3] * first.v[3]);
+            pz = p() / n;
+            px = first.v[2] * pz;
+            py = first.v[3] * pz;
+        }
+    };
+
+    FwdKalmanFitter(Field _field) : field(_field) {}
+
+    // at least 2, so convergence can be seen
+    void setIterations(size_t n) { nIterations = std::max<size_t>(2, n); }
+    void setMaxStep(double cm) { maxStep = cm; }
+    void setXOverX0(double x) { xOverX0 = x; }
+    void setMass(double m) { mass = m; }
+    // largest relative chi2 change of the last iteration of a converged fit
+    void setConvergence(double relChi2Change) { convergence = relChi2Change; }
+
+    /** Fits the measurements (at least 3), starting from the seed state
+     * (x, y, tx, ty, q/p) on the plane of the first hit in z
+     */
+    Result fit(std::vector<Measurement> hits, const double seed[5]) {
+        Result r;
+        if (hits.size() < 3)
+            return r;
+        std::sort(hits.begin(), hits.end(), [](const Measurement &a, const Measurement &b) { return a.z < b.z; });
+
+        State start;
+        start.z = hits[0].z;
+        std::copy(seed, seed + 5, start.v);
+        double previousChi2 = -1;
+
+        for (size_t it = 0; it < nIterations; it++) {
+            r.nIterations = it + 1;
+            State s = start;
+            resetCovariance(s);
+
+            // forward
+            double chi2 = 0;
+            for (size_t i = 0; i < hits.size(); i++) {
+                if (i > 0 && !propagate(s, hits[i].z))
+                    return r;
+                chi2 += update(s, hits[i]);
+                scatter(s);
+            }
+
+            // backward from the forward result, with a fresh covariance
+            resetCovariance(s);
+            chi2 = 0;
+            for (size_t i = hits.size(); i-- > 0;) {
+                if (i + 1 < hits.size() && !propagate(s, hits[i].z))
+                    return r;
+                chi2 += update(s, hits[i]);
+                if (i > 0)
+                    scatter(s);
+            }
+
+            if (!finite(s))
+                return r;
+            start = s;
+            r.first = s;
+            r.chi2 = chi2;
+            r.converged = chi2Stable(chi2, previousChi2, convergence);
+            // stop once the chi2 is stable
+            if (chi2Stable(chi2, previousChi2))
+                break;
+            previousChi2 = chi2;
+        }
+
+        r.ndf = 2 * (int)hits.size() - 5;
+        r.converged = r.converged && r.first.v[4] != 0 && std::isfinite(r.chi2);
+        return r;
+    }
+
+    // the chi2 changed by less than tolerance (relative) since the previous iteration (< 0 for none)
+    static bool chi2Stable(double chi2, double previousChi2, double tolerance = 1e-3) { return previousChi2 >= 0 && std::fabs(chi2 - previousChi2) < tolerance * std::max(1.0, chi2); }
+
+    /** Propagates the state and its covariance to the plane at z
+     * @returns false if the propagation failed
+     */
+    bool propagate(State &s, double z) {
+        double J[5][5];
+        identity(J);
+        double dzTotal = z - s.z;
+        int nSteps = std::max(1, (int)std::ceil(std::fabs(dzTotal) / maxStep));
+        double h = dzTotal / nSteps;
+        for (int i = 0; i < nSteps; i++) {
+            rkStep(s.z, s.v, J, h);
+            s.z += h;
+        }
+        if (!finite(s))
+            return false;
+
+        // C = J C J^T
+        double JC[5][5];
+        for (int i = 0; i < 5; i++) {
+            for (int j = 0; j < 5; j++) {
+                JC[i][j] = 0;
+                for (int k = 0; k < 5; k++)
+                    JC[i][j] += J[i][k] * s.C[k][j];
+            }
+        }
+        for (int i = 0; i < 5; i++) {
+            for (int j = 0; j <= i; j++) {
+                double c = 0;
+                for (int k = 0; k < 5; k++)
+                    c += JC[i][k] * J[j][k];
+                s.C[i][j] = s.C[j][i] = c;
+            }
+        }
+        return true;
+    }
+
+  protected:
+    static constexpr double kappa = 0.299792458e-3; // GeV/c per (kGauss cm)
+
+    static void identity(double M[5][5]) {
+        for (int i = 0; i < 5; i++) {
+            for (int j = 0; j < 5; j++)
+                M[i][j] = (i == j) ? 1 : 0;
+        }
+    }
+
+    static bool finite(const State &s) {
+        for (int i = 0; i < 5; i++) {
+            if (!std::isfinite(s.v[i]) || !std::isfinite(s.C[i][i]))
+                return false;
+        }
+        return true;
+    }
+
+    // large initial uncertainties, the q/p one relative to the seed
+    void resetCovariance(State &s) const {
+        for (int i = 0; i < 5; i++) {
+            for (int j = 0; j < 5; j++)
+                s.C[i][j] = 0;
+        }
+        s.C[0][0] = s.C[1][1] = 1e2;
+        s.C[2][2] = s.C[3][3] = 1;
+        s.C[4][4] = std::max(1e-2, s.v[4] * s.v[4]);
+    }
+
+    /** Derivative of the state along z and its Jacobian A = df/ds
+     * for the field at the state position
+     */
+    void derivative(double z, const double v[5], double f[5], double A[5][5]) {
+        double bx, by, bz;
+        field(v[0], v[1], z, bx, by, bz);
+        double tx = v[2], ty = v[3], qop = v[4];
+        double n = std::sqrt(1 + tx * tx + ty * ty);
+        double axn = tx * ty * bx - (1 + tx * tx) * by + ty * bz;
+        double ayn = (1 + ty * ty) * bx - tx * ty * by - tx * bz;
+
+        f[0] = tx;
+        f[1] = ty;
+        f[2] = kappa * qop * n * axn;
+        f[3] = kappa * qop * n * ayn;
+        f[4] = 0;
+
+        for (int i = 0; i < 5; i++) {
+            for (int j = 0; j < 5; j++)
+                A[i][j] = 0;
+        }
+        A[0][2] = 1;
+        A[1][3] = 1;
+        A[2][2] = kappa * qop * (tx / n * axn + n * (ty * bx - 2 * tx * by));
+        A[2][3] = kappa * qop * (ty / n * axn + n * (tx * bx + bz));
+        A[2][4] = kappa * n * axn;
+        A[3][2] = kappa * qop * (tx / n * ayn + n * (-ty * by - bz));
+        A[3][3] = kappa * qop * (ty / n * ayn + n * (2 * ty * bx - tx * by));
+        A[3][4] = kappa * n * ayn;
+    }
+
+    // one Runge-Kutta step of the state and of the accumulated Jacobian J
+    void rkStep(double z, double v[5], double J[5][5], double h) {
+        double k[4][5], kJ[4][5][5], A[5][5];
+        double vs[5], Js[5][5];
+        const double c[4] = {0, 0.5, 0.5, 1};
+
+        for (int stage = 0; stage < 4; stage++) {
+            for (int i = 0; i < 5; i++) {
+                vs[i] = v[i] + (stage ? c[stage] * h * k[stage - 1][i] : 0);
+                for (int j = 0; j < 5; j++)
+                    Js[i][j] = J[i][j] + (stage ? c[stage] * h * kJ[stage - 1][i][j] : 0);
+            }
+            derivative(z + c[stage] * h, vs, k[stage], A);
+            for (int i = 0; i < 5; i++) {
+                for (int j = 0; j < 5; j++) {
+                    double sum = 0;
+                    for (int m = 0; m < 5; m++)
+                        sum += A[i][m] * Js[m][j];
+                    kJ[stage][i][j] = sum;
+                }
+            }
+        }
+
+        for (int i = 0; i < 5; i++) {
+            v[i] += h / 6 * (k[0][i] + 2 * k[1][i] + 2 * k[2][i] + k[3][i]);
+            for (int j = 0; j < 5; j++)
+                J[i][j] += h / 6 * (kJ[0][i][j] + 2 * kJ[1][i][j] + 2 * kJ[2][i][j] + kJ[3][i][j]);
+        }
+    }
+
+    // Highland multiple scattering in a plane of thickness xOverX0 (along z)
+    void scatter(State &s) const {
+        if (xOverX0 <= 0 || s.v[4] == 0)
+            return;
+        double tx = s.v[2], ty = s.v[3];
+        double n2 = 1 + tx * tx + ty * ty;
+        double x = xOverX0 * std::sqrt(n2);
+        double p = 1.0 / std::fabs(s.v[4]);
+        double beta = p / std::sqrt(p * p + mass * mass);
+        double theta0 = 0.0136 / (beta * p) * std::sqrt(x) * (1 + 0.038 * std::log(x));
+        double t2 = theta0 * theta0 * n2;
+        s.C[2][2] += t2 * (1 + tx * tx);
+        s.C[3][3] += t2 * (1 + ty * ty);
+        s.C[2][3] += t2 * tx * ty;
+        s.C[3][2] += t2 * tx * ty;
+    }
+
+    // Kalman update with an (x, y) measurement, returns the chi2 increment
+    double update(State &s, const Measurement &m) const {
+        double r0 = m.x - s.v[0], r1 = m.y - s.v[1];
+        double S00 = m.cxx + s.C[0][0], S01 = m.cxy + s.C[0][1], S11 = m.cyy + s.C[1][1];
+        double det = S00 * S11 - S01 * S01;
+        if (!(det > 0))
+            return 0;
+        double I00 = S11 / det, I01 = -S01 / det, I11 = S00 / det;
+
+        // K = C H^T S^-1, H selects (x, y)
+        double K[5][2];
+        for (int i = 0; i < 5; i++) {
+            K[i][0] = s.C[i][0] * I00 + s.C[i][1] * I01;
+            K[i][1] = s.C[i][0] * I01 + s.C[i][1] * I11;
+        }
+        for (int i = 0; i < 5; i++)
+            s.v[i] += K[i][0] * r0 + K[i][1] * r1;
+
+        // C = (1 - K H) C
+        double row0[5], row1[5];
+        for (int j = 0; j < 5; j++) {
+            row0[j] = s.C[0][j];
+            row1[j] = s.C[1][j];
+        }
+        for (int i = 0; i < 5; i++) {
+            for (int j = 0; j < 5; j++)
+                s.C[i][j] -= K[i][0] * row0[j] + K[i][1] * row1[j];
+        }
+        for (int i = 0; i < 5; i++) {
+            for (int j = 0; j < i; j++)
+                s.C[i][j] = s.C[j][i] = 0.5 * (s.C[i][j] + s.C[j][i]);
+        }
+
+        return r0 * r0 * I00 + 2 * r0 * r1 * I01 + r1 * r1 * I11;
+    }
+
+    Field field;
+    size_t nIterations = 3;
+    double convergence = 0.2;
+    double maxStep = 10;
+    double xOverX0 = 0.01;
+    double mass = 0.105658; // muon
+};
+
+#endif
@@ -0,0 +1,230 @@
+#ifndef FWD_MATERIAL_INTERFACE_H
+#define FWD_MATERIAL_INTERFACE_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "GenFit/AbsMaterialInterface.h"
+#include "GenFit/Material.h"
+#include "GenFit/RKTools.h"
+
+#include "TGeoManager.h"
+#include "TGeoMaterial.h"
+#include "TGeoMedium.h"
+#include "TGeoNavigator.h"
+#include "TGeoNode.h"
+
+#include "StFwdTrackMaker/include/Tracker/FwdGeomSnapshot.h"
+#include "StFwdTrackMaker/include/Tracker/loguru.h"
+
+/**
+ * Simplified material model of the forward region for GenFit, so that propagation steps
+ * do not navigate TGeo.
+ *
+ * The region zMin < z < zMax is split into layers along z: a slab of the given thickness
+ * around every detector plane, and the gaps between them. Each layer is binned in
+ * (r, phi) and every bin holds one effective material, built at setup by walking TGeo
+ * along the ray from the nominal vertex through the bin centre (at the middle of the
+ * layer). The effective material keeps the x/X0 and the mass thickness along that ray,
+ * with Z, Z/A and the mean excitation energy (I = 16 Z^0.9 eV per material) weighted by
+ * the electron density, so the Bethe-Bloch energy loss and the scattering are those of
+ * the real materials for tracks from the vertex. Outside the region there is vacuum.
+ *
+ * The layer boundaries (planes of constant z) are the only boundaries GenFit sees.
+ */
+class FwdMaterialInterface : public genfit::AbsMaterialInterface {
+  public:
+    FwdMaterialInterface() {}
+    virtual ~FwdMaterialInterface() {}
+
+    /** Builds the model from gGeoManager
+     * @param planeZ    z of the detector planes
+     * @param thickness thickness of the slab around each plane (cm)
+     */
+    void build(std::vector<float> planeZ, double thickness, double zMin, double zMax, double _rMax, size_t _nR, size_t _nPhi, double vertexZ = 0) {
+        rMax = _rMax;
+        nR = std::max<size_t>(1, _nR);
+        nPhi = std::max<size_t>(1, _nPhi);
+
+        bounds.clear();
+        bounds.push_back(zMin);
+        bounds.push_back(zMax);
+        for (float z : planeZ) {
+            bounds.push_back(std::min(zMax, std::max(zMin, z - 0.5 * thickness)));
+            bounds.push_back(std::min(zMax, std::max(zMin, z + 0.5 * thickness)));
+        }
+        std::sort(bounds.begin(), bounds.end());
+        bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+
+        materials.assign(nLayers() * nR * nPhi, vacuum());
+        xX0.assign(materials.size(), 0);
+        if (gGeoManager == nullptr) {
+            LOG_F(ERROR, "FwdMaterialInterface: no geometry, the forward region is vacuum");
+            return;
+        }
+        TGeoNavigator *nav = gGeoManager->GetCurrentNavigator();
+
+        for (size_t l = 0; l < nLayers(); l++) {
+            double z1 = bounds[l], z2 = bounds[l + 1], zMid = 0.5 * (z1 + z2);
+            double sumX0 = 0;
+            for (size_t ir = 0; ir < nR; ir++) {
+                double r = (ir + 0.5) * rMax / nR;
+                for (size_t ip = 0; ip < nPhi; ip++) {
+                    double phi = -M_PI + (ip + 0.5) * 2 * M_PI / nPhi;
+                    // projective ray from the vertex, parallel to z for layers around or before it
+                    double d[3] = {0, 0, 1};
+                    if (zMid - vertexZ > 1) {
+                        double n = std::sqrt(r * r + (zMid - vertexZ) * (zMid - vertexZ));
+                        d[0] = r * cos(phi) / n;
+                        d[1] = r * sin(phi) / n;
+                        d[2] = (zMid - vertexZ) / n;
+                    }
+                    double s1 = (z1 - zMid) / d[2];
+                    double p[3] = {r * cos(phi) + s1 * d[0], r * sin(phi) + s1 * d[1], z1};
+                    double x = 0;
+                    materials[index(l, ir, ip)] = walk(nav, p, d, (z2 - z1) / d[2], x);
+                    xX0[index(l, ir, ip)] = x;
+                    sumX0 += x;
+                }
+            }
+            LOG_F(INFO, "FwdMaterialInterface: layer %lu (%0.1f < z < %0.1f) mean x/X0 = %0.4f", l, z1, z2, sumX0 / (nR * nPhi));
+        }
+    }
+
+    // stores the map in a geometry snapshot
+    void fill(FwdGeomSnapshot &snapshot) const {
+        snapshot.bounds = bounds;
+        snapshot.bins.resize(materials.size());
+        for (size_t i = 0; i < materials.size(); i++) {
+            const genfit::Material &m = materials[i];
+            snapshot.bins[i] = {m.density, m.Z, m.A, m.radiationLength, m.mEE, xX0[i]};
+        }
+    }
+
+    // restores the map from a geometry snapshot, no TGeo needed
+    void load(const FwdGeomSnapshot &snapshot) {
+        rMax = snapshot.material.rMax;
+        nR = std::max<size_t>(1, snapshot.material.nR);
+        nPhi = std::max<size_t>(1, snapshot.material.nPhi);
+        bounds = snapshot.bounds;
+        materials.clear();
+        xX0.clear();
+        for (const FwdGeomSnapshot::MaterialBin &b : snapshot.bins) {
+            materials.push_back(genfit::Material(b.density, b.Z, b.A, b.radiationLength, b.mEE));
+            xX0.push_back(b.xOverX0);
+        }
+        if (materials.size() != nLayers() * nR * nPhi) {
+            LOG_F(ERROR, "FwdMaterialInterface: the snapshot has %lu bins instead of %lu, the forward region is vacuum", materials.size(), nLayers() * nR * nPhi);
+            materials.assign(nLayers() * nR * nPhi, vacuum());
+            xX0.assign(materials.size(), 0);
+        }
+    }
+
+    size_t nLayers() const { return bounds.size() > 1 ? bounds.size() - 1 : 0; }
+    // x/X0 along the ray through a bin of a layer
+    double xOverX0(size_t layer, size_t ir, size_t iphi) const { return xX0[index(layer, ir, iphi)]; }
+
+    virtual bool initTrack(double posX, double posY, double posZ, double dirX, double dirY, double dirZ) {
+        // on a boundary the layer ahead is the current one
+        long c = cellOf(posX, posY, posZ + (dirZ >= 0 ? kEpsilon : -kEpsilon));
+        bool changed = c != cell;
+        cell = c;
+        return changed;
+    }
+
+    virtual genfit::Material getMaterialParameters() {
+        return cell < 0 ? vacuum() : materials[cell];
+    }
+
+    /** Signed path length to the next layer boundary along a straight line, at most sMax.
+     * Exact for a field along z, where dz/ds is constant
+     */
+    virtual double findNextBoundary(const genfit::RKTrackRep *rep, const genfit::M1x7 &state7, double sMax, bool varField = true) {
+        double z = state7[2], dirZ = state7[5];
+        double dz = (sMax >= 0 ? 1 : -1) * dirZ; // direction of travel in z
+        if (std::fabs(dirZ) < 1e-9 || bounds.empty())
+            return sMax;
+
+        double zb;
+        if (dz > 0) {
+            auto it = std::upper_bound(bounds.begin(), bounds.end(), z + kEpsilon);
+            if (it == bounds.end())
+                return sMax;
+            zb = *it;
+        } else {
+            auto it = std::lower_bound(bounds.begin(), bounds.end(), z - kEpsilon);
+            if (it == bounds.begin())
+                return sMax;
+            zb = *(it - 1);
+        }
+        double s = (zb - z) / dirZ;
+        return std::fabs(s) < std::fabs(sMax) ? s : sMax;
+    }
+
+  protected:
+    static constexpr double kEpsilon = 1e-4; // cm
+
+    static genfit::Material vacuum() { return genfit::Material(0, 0, 0, 1e30, 0); }
+
+    // mean excitation energy (eV) for atomic number Z
+    static double meanExcitationEnergy(double Z) { return Z < 1.5 ? 19.2 : 16 * std::pow(Z, 0.9); }
+
+    size_t index(size_t layer, size_t ir, size_t iphi) const { return (layer * nR + ir) * nPhi + iphi; }
+
+    // cell index of a position, -1 outside the region
+    long cellOf(double x, double y, double z) const {
+        if (bounds.size() < 2 || !(z >= bounds.front() && z < bounds.back()))
+            return -1;
+        size_t layer = std::upper_bound(bounds.begin(), bounds.end(), z) - bounds.begin() - 1;
+        size_t ir = std::min(nR - 1, (size_t)(std::sqrt(x * x + y * y) / rMax * nR));
+        size_t ip = std::min(nPhi - 1, (size_t)((std::atan2(y, x) + M_PI) / (2 * M_PI) * nPhi));
+        return index(layer, ir, ip);
+    }
+
+    // effective material along a straight path through the geometry, x gets its x/X0
+    genfit::Material walk(TGeoNavigator *nav, const double p[3], const double d[3], double length, double &x) const {
+        double sumL = 0, sumRhoL = 0, sumLX0 = 0, sumEl = 0, sumElZ = 0, sumElLnI = 0;
+        nav->InitTrack(p[0], p[1], p[2], d[0], d[1], d[2]);
+        for (int i = 0; i < 10000 && sumL < length; i++) {
+            TGeoNode *node = nav->GetCurrentNode();
+            TGeoMaterial *mat = (node && node->GetMedium()) ? node->GetMedium()->GetMaterial() : nullptr;
+            nav->FindNextBoundaryAndStep(length - sumL);
+            double step = std::min(nav->GetStep(), length - sumL);
+            if (!(step > 0)) {
+                // stuck on a boundary, move on a little
+                step = std::min(1e-3, length - sumL);
+                nav->InitTrack(p[0] + (sumL + step) * d[0], p[1] + (sumL + step) * d[1], p[2] + (sumL + step) * d[2], d[0], d[1], d[2]);
+            }
+            if (mat && mat->GetDensity() > 0 && mat->GetA() > 0) {
+                double rho = mat->GetDensity(), Z = mat->GetZ(), A = mat->GetA();
+                double electrons = rho * step * Z / A;
+                sumRhoL += rho * step;
+                if (mat->GetRadLen() > 0)
+                    sumLX0 += step / mat->GetRadLen();
+                sumEl += electrons;
+                sumElZ += electrons * Z;
+                sumElLnI += electrons * std::log(meanExcitationEnergy(Z));
+            }
+            sumL += step;
+            if (nav->IsOutside())
+                break;
+        }
+
+        x = sumLX0;
+        if (!(sumEl > 0) || !(length > 0))
+            return vacuum();
+        double Z = sumElZ / sumEl;
+        double ZoverA = sumEl / sumRhoL;
+        return genfit::Material(sumRhoL / length, Z, Z / ZoverA, sumLX0 > 0 ? length / sumLX0 : 1e30, std::exp(sumElLnI / sumEl));
+    }
+
+    double rMax = 150;
+    size_t nR = 1, nPhi = 1;
+    std::vector<double> bounds;               // layer boundaries in z
+    std::vector<genfit::Material> materials; // per (layer, r, phi) bin
+    std::vector<double> xX0;
+    long cell = -1;
+};
+
+#endif
@@ -0,0 +1,471 @@
+#ifndef FWD_SEGMENT_BUILDER_H
+#define FWD_SEGMENT_BUILDER_H
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Criteria/ICriterion.h"
+#include "KiTrack/Automaton.h"
+#include "KiTrack/IHit.h"
+#include "KiTrack/ISectorConnector.h"
+#include "KiTrack/Segment.h"
+
+#include "StFwdTrackMaker/XmlConfig/XmlConfig.h"
+#include "StFwdTrackMaker/include/Tracker/CriteriaPipeline.h"
+#include "StFwdTrackMaker/include/Tracker/FwdHit.h"
+#include "StFwdTrackMaker/include/Tracker/loguru.h"
+
+/**
+ * Builds the 1-hit segment automaton like KiTrack::SegmentBuilder, but evaluates
+ * the common two-hit criteria over whole (sector, target sector) blocks.
+ *
+ * Hits are stored per sector as SoA (x, y, z, rho, phi), so rho and phi are computed
+ * once per hit instead of once per pair. For each parent hit the criteria are applied
+ * as branch-free loops over all hits of the target sector, which the compiler can
+ * vectorize, and only the surviving pairs are connected. Criteria without a batch
+ * kernel are still evaluated through their ICriterion, but only on those pairs.
+ *
+ * getNewConnections() finds only the pairs admitted by loosening the criteria, for
+ * SegmentGraphCache: when only the DeltaPhi or DeltaRho windows were widened, the target
+ * hits are searched in phi or rho order and only those in the added parts of the windows
+ * are evaluated.
+ */
+class FwdSegmentBuilder {
+  public:
+    FwdSegmentBuilder(std::map<int, std::vector<KiTrack::IHit *>> &hitmap) : _hitmap(hitmap) {
+        for (auto &kv : _hitmap) {
+            LayerSoA &l = _layers[kv.first];
+            size_t n = kv.second.size();
+            l.x.resize(n);
+            l.y.resize(n);
+            l.z.resize(n);
+            l.rho.resize(n);
+            l.phi.resize(n);
+            for (size_t i = 0; i < n; i++) {
+                KiTrack::IHit *h = kv.second[i];
+                l.x[i] = h->getX();
+                l.y[i] = h->getY();
+                l.z[i] = h->getZ();
+                l.rho[i] = sqrt(l.x[i] * l.x[i] + l.y[i] * l.y[i]);
+                l.phi[i] = atan2(l.y[i], l.x[i]);
+            }
+        }
+    }
+
+    enum KernelType { kNone = 0,
+                      kRZRatio,
+                      kDeltaRho,
+                      kDeltaPhi };
+
+    // the batch kernel implementing the named two-hit criterion, if any
+    static KernelType kernelOf(const std::string &name) {
+        if (name == "Crit2_RZRatio")
+            return kRZRatio;
+        if (name == "Crit2_DeltaRho")
+            return kDeltaRho;
+        if (name == "Crit2_DeltaPhi")
+            return kDeltaPhi;
+        return kNone;
+    }
+
+    /** Adds the criteria configured under path.
+     *
+     * Criteria with a batch kernel take their min/max from the config, the others
+     * are taken from crits (as created by ForwardTrackMaker::loadCriteria)
+     */
+    void addCriteria(jdb::XmlConfig &cfg, std::string path, std::vector<KiTrack::ICriterion *> crits, float tighten = 1) {
+        for (std::string p : cfg.childrenOf(path)) {
+            std::string name = cfg.get<std::string>(p + ":name");
+            if (false == cfg.get<bool>(p + ":active", true))
+                continue;
+
+            KernelType type = kernelOf(name);
+            auto window = CriteriaPipeline::tightened(cfg.get<float>(p + ":min", 0), cfg.get<float>(p + ":max", 1), tighten);
+            if (type != kNone) {
+                _kernels.push_back(Kernel{type, window.first, window.second});
+                continue;
+            }
+
+            bool found = false;
+            for (auto crit : crits) {
+                if (crit->getName() == name) {
+                    _residual.push_back(crit);
+                    _residualCuts.push_back(window);
+                    found = true;
+                }
+            }
+            if (!found)
+                _nMissing++;
+        }
+        LOG_F(INFO, "FwdSegmentBuilder: %lu batch criteria, %lu per-pair criteria", _kernels.size(), _residual.size());
+    }
+
+    void addSectorConnector(KiTrack::ISectorConnector *connector) { _connectors.push_back(connector); }
+
+    // false if a configured criterion was not among the crits given to addCriteria (e.g. a fused chain)
+    bool complete() const { return _nMissing == 0; }
+
+    /** Calls connect(sector, ia, target, ib) for the pairs passing all criteria but not the
+     * previous cuts, each of which must contain the range of the same criterion now.
+     * @returns the number of new connections
+     */
+    template <typename F>
+    size_t getNewConnections(const CriteriaPipeline::CutValues &previous, F connect) {
+        // previous range of each kernel and per-pair criterion, and what was loosened
+        std::vector<std::pair<float, float>> kernelPrevious, residualPrevious;
+        const Kernel *phiShell = nullptr, *rhoShell = nullptr, *phiWindow = nullptr;
+        bool otherLoosened = false;
+        for (const Kernel &k : _kernels) {
+            std::pair<float, float> prev = previous.at(nameOf(k.type));
+            kernelPrevious.push_back(prev);
+            bool loosened = k.min < prev.first || k.max > prev.second;
+            if (k.type == kDeltaPhi) {
+                phiWindow = &k;
+                if (loosened)
+                    phiShell = &k;
+            } else if (k.type == kDeltaRho && loosened) {
+                rhoShell = &k;
+            } else if (loosened) {
+                otherLoosened = true;
+            }
+        }
+        for (size_t k = 0; k < _residual.size(); k++) {
+            std::pair<float, float> prev = previous.at(_residual[k]->getName());
+            residualPrevious.push_back(prev);
+            otherLoosened = otherLoosened || _residualCuts[k].first < prev.first || _residualCuts[k].second > prev.second;
+        }
+        size_t iPhi = phiShell ? phiShell - _kernels.data() : 0, iRho = rhoShell ? rhoShell - _kernels.data() : 0;
+
+        std::map<int, std::vector<KiTrack::Segment *>> segments;
+        if (!_residual.empty())
+            segments = makeSegments();
+
+        size_t n = 0;
+        std::vector<size_t> candidates;
+        std::vector<unsigned char> seen;
+        for (auto &kv : _hitmap) {
+            int sector = kv.first;
+            const LayerSoA &la = _layers[sector];
+
+            for (size_t ia = 0; ia < kv.second.size(); ia++) {
+                for (auto connector : _connectors) {
+                    for (int target : connector->getTargetSectors(sector)) {
+                        auto itTarget = _layers.find(target);
+                        if (itTarget == _layers.end())
+                            continue;
+                        LayerSoA &lb = itTarget->second;
+                        lb.sort();
+
+                        // the target hits that can have been admitted
+                        candidates.clear();
+                        seen.assign(lb.x.size(), 0);
+                        bool aNearOrigin = la.x[ia] * la.x[ia] + la.y[ia] * la.y[ia] < 0.0001f;
+                        if (otherLoosened || aNearOrigin) {
+                            if (phiWindow && !aNearOrigin)
+                                collectPhi(lb, la.phi[ia], phiWindow->min, phiWindow->max, seen, candidates);
+                            else
+                                collectAll(lb, seen, candidates);
+                        } else {
+                            if (phiShell) {
+                                collectPhi(lb, la.phi[ia], phiShell->min, kernelPrevious[iPhi].first, seen, candidates);
+                                collectPhi(lb, la.phi[ia], kernelPrevious[iPhi].second, phiShell->max, seen, candidates);
+                            }
+                            if (rhoShell) {
+                                collectRho(lb, la.rho[ia] - kernelPrevious[iRho].first, la.rho[ia] - rhoShell->min, seen, candidates);
+                                collectRho(lb, la.rho[ia] - rhoShell->max, la.rho[ia] - kernelPrevious[iRho].second, seen, candidates);
+                            }
+                        }
+
+                        for (size_t ib : candidates) {
+                            bool pass = true, passedBefore = true;
+                            for (size_t k = 0; k < _kernels.size() && pass; k++) {
+                                pass = passes(_kernels[k].type, _kernels[k].min, _kernels[k].max, la, ia, lb, ib);
+                                passedBefore = passedBefore && passes(_kernels[k].type, kernelPrevious[k].first, kernelPrevious[k].second, la, ia, lb, ib);
+                            }
+                            for (size_t k = 0; k < _residual.size() && pass; k++) {
+                                pass = _residual[k]->areCompatible(segments[sector][ia], segments[target][ib]);
+                                float v = _residual[k]->getMapOfValues()[_residual[k]->getName()];
+                                passedBefore = passedBefore && v >= residualPrevious[k].first && v <= residualPrevious[k].second;
+                            }
+                            if (pass && !passedBefore) {
+                                connect(sector, ia, target, ib);
+                                n++;
+                            }
+                        }
+                    } // target sectors
+                }     // connectors
+            }         // hits in sector
+        }             // sectors
+
+        for (auto &kv : segments) {
+            for (KiTrack::Segment *seg : kv.second)
+                delete seg;
+        }
+        return n;
+    }
+
+    KiTrack::Automaton get1SegAutomaton() {
+        KiTrack::Automaton automaton;
+
+        // one segment per hit
+        std::map<int, std::vector<KiTrack::Segment *>> segments = makeSegments();
+        for (auto &kv : segments) {
+            for (KiTrack::Segment *seg : kv.second)
+                automaton.addSegment(seg);
+        }
+
+        forEachConnection(segments, [&](int sector, size_t ia, int target, size_t ib) {
+            KiTrack::Segment *parent = segments[sector][ia];
+            KiTrack::Segment *child = segments[target][ib];
+            parent->addChild(child);
+            child->addParent(parent);
+        });
+
+        return automaton;
+    }
+
+    /** Calls connect(sector, ia, target, ib) for every (parent, child) pair of hits passing all criteria,
+     * without building an automaton. Indices refer to the hit vectors of the hitmap.
+     */
+    template <typename F>
+    void getConnections(F connect) {
+        // Segments are only needed by the per-pair criteria
+        std::map<int, std::vector<KiTrack::Segment *>> segments;
+        if (!_residual.empty())
+            segments = makeSegments();
+
+        forEachConnection(segments, connect);
+
+        for (auto &kv : segments) {
+            for (KiTrack::Segment *seg : kv.second)
+                delete seg;
+        }
+    }
+
+    // (parent hit id, child hit id) of every connection in a 1-hit segment automaton
+    static std::set<std::pair<unsigned int, unsigned int>> connectionsOf(KiTrack::Automaton &automaton) {
+        std::set<std::pair<unsigned int, unsigned int>> conns;
+        for (KiTrack::Segment *parent : automaton.getSegments()) {
+            unsigned int pid = static_cast<FwdHit *>(parent->getHits()[0])->_id;
+            for (KiTrack::Segment *child : parent->getChildren())
+                conns.insert(std::make_pair(pid, static_cast<FwdHit *>(child->getHits()[0])->_id));
+        }
+        return conns;
+    }
+
+  protected:
+    std::map<int, std::vector<KiTrack::Segment *>> makeSegments() {
+        std::map<int, std::vector<KiTrack::Segment *>> segments;
+        for (auto &kv : _hitmap) {
+            for (KiTrack::IHit *h : kv.second) {
+                KiTrack::Segment *seg = new KiTrack::Segment(std::vector<KiTrack::IHit *>(1, h));
+                seg->setLayer(h->getLayer());
+                segments[kv.first].push_back(seg);
+            }
+        }
+        return segments;
+    }
+
+    template <typename F>
+    void forEachConnection(std::map<int, std::vector<KiTrack::Segment *>> &segments, F connect) {
+        std::vector<unsigned char> pass;
+        for (auto &kv : _hitmap) {
+            int sector = kv.first;
+            const LayerSoA &la = _layers[sector];
+
+            for (size_t ia = 0; ia < kv.second.size(); ia++) {
+                for (auto connector : _connectors) {
+                    for (int target : connector->getTargetSectors(sector)) {
+                        auto itTarget = _layers.find(target);
+                        if (itTarget == _layers.end())
+                            continue;
+
+                        const LayerSoA &lb = itTarget->second;
+                        size_t nb = lb.x.size();
+                        pass.assign(nb, 1);
+                        for (const Kernel &k : _kernels)
+                            apply(k, la, ia, lb, pass.data());
+
+                        for (size_t ib = 0; ib < nb; ib++) {
+                            if (!pass[ib])
+                                continue;
+
+                            bool allPass = true;
+                            for (auto crit : _residual) {
+                                if (!crit->areCompatible(segments[sector][ia], segments[target][ib])) {
+                                    allPass = false;
+                                    break;
+                                }
+                            }
+                            if (allPass)
+                                connect(sector, ia, target, ib);
+                        }
+                    } // target sectors
+                }     // connectors
+            }         // hits in sector
+        }             // sectors
+    }
+
+    struct LayerSoA {
+        std::vector<float> x, y, z, rho, phi;
+        // hit indices in phi and rho order, with the sorted values, see sort()
+        std::vector<size_t> byPhi, byRho;
+        std::vector<float> sortedPhi, sortedRho;
+
+        void sort() {
+            if (byPhi.size() == x.size())
+                return;
+            sortBy(phi, byPhi, sortedPhi);
+            sortBy(rho, byRho, sortedRho);
+        }
+        static void sortBy(const std::vector<float> &v, std::vector<size_t> &order, std::vector<float> &sorted) {
+            order.resize(v.size());
+            for (size_t i = 0; i < v.size(); i++)
+                order[i] = i;
+            std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return v[a] < v[b]; });
+            sorted.resize(v.size());
+            for (size_t i = 0; i < v.size(); i++)
+                sorted[i] = v[order[i]];
+        }
+    };
+
+    struct Kernel {
+        KernelType type;
+        float min, max;
+    };
+
+    static std::string nameOf(KernelType type) {
+        return type == kRZRatio ? "Crit2_RZRatio" : (type == kDeltaRho ? "Crit2_DeltaRho" : "Crit2_DeltaPhi");
+    }
+
+    // apply() for one pair
+    static bool passes(KernelType type, float min, float max, const LayerSoA &la, size_t ia, const LayerSoA &lb, size_t j) {
+        unsigned char pass = 1;
+        apply(Kernel{type, min, max}, la, ia, lb, &pass, j, j + 1);
+        return pass;
+    }
+
+    // the target hits not seen yet
+    static void collectAll(const LayerSoA &lb, std::vector<unsigned char> &seen, std::vector<size_t> &out) {
+        for (size_t j = 0; j < lb.x.size(); j++) {
+            if (!seen[j]) {
+                seen[j] = 1;
+                out.push_back(j);
+            }
+        }
+    }
+
+    // the target hits with rho in [lo, hi], and a little margin for the rounding
+    static void collectRho(const LayerSoA &lb, float lo, float hi, std::vector<unsigned char> &seen, std::vector<size_t> &out) {
+        auto first = std::lower_bound(lb.sortedRho.begin(), lb.sortedRho.end(), lo - kMargin);
+        auto last = std::upper_bound(lb.sortedRho.begin(), lb.sortedRho.end(), hi + kMargin);
+        for (auto it = first; it < last; it++) {
+            size_t j = lb.byRho[it - lb.sortedRho.begin()];
+            if (!seen[j]) {
+                seen[j] = 1;
+                out.push_back(j);
+            }
+        }
+    }
+
+    /** The target hits with |delta phi| in [loDeg, hiDeg] degrees from phiA (on both sides, wrapped),
+     * with a little margin, and those near the origin (whose delta phi is 0)
+     */
+    static void collectPhi(const LayerSoA &lb, float phiA, float loDeg, float hiDeg, std::vector<unsigned char> &seen, std::vector<size_t> &out) {
+        if (hiDeg >= 180 - kMargin) {
+            collectAll(lb, seen, out);
+            return;
+        }
+        double lo = std::max(0., loDeg * M_PI / 180. - kMargin), hi = hiDeg * M_PI / 180. + kMargin;
+        addPhiRange(lb, phiA + lo, phiA + hi, seen, out);
+        addPhiRange(lb, phiA - hi, phiA - lo, seen, out);
+        for (size_t j = 0; j < lb.x.size(); j++) {
+            if (!seen[j] && lb.x[j] * lb.x[j] + lb.y[j] * lb.y[j] < 0.0001f) {
+                seen[j] = 1;
+                out.push_back(j);
+            }
+        }
+    }
+
+    // hits with phi in [from, to] (to - from < 2 pi), wrapped into [-pi, pi]
+    static void addPhiRange(const LayerSoA &lb, double from, double to, std::vector<unsigned char> &seen, std::vector<size_t> &out) {
+        while (from < -M_PI) {
+            from += 2 * M_PI;
+            to += 2 * M_PI;
+        }
+        while (from > M_PI) {
+            from -= 2 * M_PI;
+            to -= 2 * M_PI;
+        }
+        if (to > M_PI) {
+            addPhiRange(lb, -M_PI, to - 2 * M_PI, seen, out);
+            to = M_PI;
+        }
+        auto first = std::lower_bound(lb.sortedPhi.begin(), lb.sortedPhi.end(), (float)from);
+        auto last = std::upper_bound(lb.sortedPhi.begin(), lb.sortedPhi.end(), (float)to);
+        for (auto it = first; it < last; it++) {
+            size_t j = lb.byPhi[it - lb.sortedPhi.begin()];
+            if (!seen[j]) {
+                seen[j] = 1;
+                out.push_back(j);
+            }
+        }
+    }
+
+    static constexpr float kMargin = 1e-3; // cm or rad, against the rounding of the windows
+
+    /** Same arithmetic as the KiTrack criteria (parent = a, child = b), applied to all b at once
+     * (or to b in [begin, end), with pass[j - begin])
+     */
+    static void apply(const Kernel &k, const LayerSoA &la, size_t ia, const LayerSoA &lb, unsigned char *pass, size_t begin = 0, size_t end = (size_t)-1) {
+        const size_t nb = std::min(end, lb.x.size());
+        const float ax = la.x[ia], ay = la.y[ia], az = la.z[ia];
+        const float *bx = lb.x.data();
+        const float *by = lb.y.data();
+        const float *bz = lb.z.data();
+
+        if (k.type == kRZRatio) {
+            const float min2 = k.min * k.min, max2 = k.max * k.max;
+            for (size_t j = begin; j < nb; j++) {
+                float dx = ax - bx[j], dy = ay - by[j], dz = az - bz[j];
+                float dz2 = dz * dz;
+                float ratio2 = (dz2 != 0.f) ? (dx * dx + dy * dy + dz2) / dz2 : 0.f;
+                pass[j - begin] &= (ratio2 <= max2) & (ratio2 >= min2);
+            }
+        } else if (k.type == kDeltaRho) {
+            const float rhoA = la.rho[ia];
+            const float *rhoB = lb.rho.data();
+            for (size_t j = begin; j < nb; j++) {
+                float deltaRho = rhoA - rhoB[j];
+                pass[j - begin] &= (deltaRho <= k.max) & (deltaRho >= k.min);
+            }
+        } else if (k.type == kDeltaPhi) {
+            const float phiA = la.phi[ia];
+            const bool aNearOrigin = (ax * ax + ay * ay < 0.0001f);
+            const float *phiB = lb.phi.data();
+            for (size_t j = begin; j < nb; j++) {
+                float d = phiA - phiB[j];
+                d = (d > (float)M_PI) ? d - 2 * (float)M_PI : d;
+                d = (d < -(float)M_PI) ? d + 2 * (float)M_PI : d;
+                bool nearOrigin = aNearOrigin | (bx[j] * bx[j] + by[j] * by[j] < 0.0001f);
+                float deg = nearOrigin ? 0.f : (float)(180. * fabs(d) / M_PI);
+                pass[j - begin] &= (deg <= k.max) & (deg >= k.min);
+            }
+        }
+    }
+
+    std::map<int, std::vector<KiTrack::IHit *>> &_hitmap;
+    std::map<int, LayerSoA> _layers;
+    std::vector<Kernel> _kernels;
+    std::vector<KiTrack::ICriterion *> _residual;
+    std::vector<std::pair<float, float>> _residualCuts; // (min, max) of each per-pair criterion
+    std::vector<KiTrack::ISectorConnector *> _connectors;
+    size_t _nMissing = 0; // configured criteria without a kernel or an ICriterion
+};
+
+#endif
@@ -0,0 +1,140 @@
+#ifndef FWD_TRACK_PROJECTOR_H
+#define FWD_TRACK_PROJECTOR_H
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include "GenFit/AbsTrackRep.h"
+#include "GenFit/DetPlane.h"
+#include "GenFit/Exception.h"
+#include "GenFit/MeasuredStateOnPlane.h"
+#include "GenFit/Track.h"
+
+#include "TVector3.h"
+
+#include "StFwdTrackMaker/include/Tracker/loguru.h"
+
+/**
+ * Projects fitted tracks onto a fixed list of target surfaces: planes of constant z and
+ * lines (e.g. the beamline).
+ *
+ * Each track is propagated once from one fitted state: the targets below it in z are
+ * visited in decreasing z and then the lines, the targets above it in increasing z,
+ * each step starting from the state on the previous target. A target can be given its
+ * own fitted point to start from, the targets sharing a start point are propagated
+ * together. The planes are created once, and the projection of a track is cached until
+ * clear() (e.g. per event).
+ */
+class FwdTrackProjector {
+  public:
+    struct Projection {
+        std::vector<genfit::MeasuredStateOnPlane> states; // per target, in the order they were added
+        std::vector<bool> ok;
+
+        bool valid(size_t target) const { return target < ok.size() && ok[target]; }
+        const genfit::MeasuredStateOnPlane &state(size_t target) const { return states[target]; }
+    };
+
+    /**
+     * @param _startPoint fitted point the projection starts from
+     */
+    FwdTrackProjector(int _startPoint = 1) : startPoint(_startPoint) {}
+
+    // adds a plane at z, returns its target index; start is the fitted point to start from (-1: the default one)
+    size_t addPlane(double z, int start = -1) { return addPlane(genfit::SharedPlanePtr(new genfit::DetPlane(TVector3(0, 0, z), TVector3(1, 0, 0), TVector3(0, 1, 0))), start); }
+    size_t addPlane(genfit::SharedPlanePtr plane, int start = -1) {
+        targets.push_back(Target{plane, TVector3(), TVector3(), start});
+        return targets.size() - 1;
+    }
+
+    // adds a line through point along direction, returns its target index
+    size_t addLine(const TVector3 &point, const TVector3 &direction, int start = -1) {
+        targets.push_back(Target{genfit::SharedPlanePtr(), point, direction, start});
+        return targets.size() - 1;
+    }
+    // moves a line target, e.g. to the vertex of the event; clears the cache
+    void setLine(size_t target, const TVector3 &point, const TVector3 &direction) {
+        targets[target].point = point;
+        targets[target].direction = direction;
+        clear();
+    }
+
+    void clear() { cache.clear(); }
+
+    // projection of the track onto all targets, cached
+    const Projection &project(genfit::Track *track) {
+        auto it = cache.find(track);
+        if (it != cache.end())
+            return it->second;
+        Projection &p = cache[track];
+        p.states.resize(targets.size());
+        p.ok.assign(targets.size(), false);
+        if (track == nullptr || track->getCardinalRep() == nullptr)
+            return p;
+
+        std::map<int, std::vector<size_t>> byStart;
+        for (size_t i = 0; i < targets.size(); i++)
+            byStart[targets[i].start < 0 ? startPoint : targets[i].start].push_back(i);
+
+        genfit::AbsTrackRep *rep = track->getCardinalRep();
+        for (auto &group : byStart) {
+            genfit::MeasuredStateOnPlane start;
+            try {
+                start = track->getFittedState(group.first);
+            } catch (genfit::Exception &e) {
+                LOG_F(WARNING, "No fitted state to project from: %s", e.what());
+                continue;
+            }
+
+            // targets ordered away from the start, planes first then lines on the way in
+            double z0 = start.getPos().Z();
+            std::vector<size_t> inward, outward;
+            for (size_t i : group.second) {
+                if (targets[i].plane && targets[i].plane->getO().Z() >= z0)
+                    outward.push_back(i);
+                else
+                    inward.push_back(i);
+            }
+            auto z = [&](size_t i) { return targets[i].plane ? targets[i].plane->getO().Z() : -1e30; };
+            std::stable_sort(inward.begin(), inward.end(), [&](size_t a, size_t b) { return z(a) > z(b); });
+            std::sort(outward.begin(), outward.end(), [&](size_t a, size_t b) { return z(a) < z(b); });
+
+            propagate(rep, start, inward, p);
+            propagate(rep, start, outward, p);
+        }
+        return p;
+    }
+
+  protected:
+    struct Target {
+        genfit::SharedPlanePtr plane; // null for a line
+        TVector3 point, direction;
+        int start;                    // fitted point to start from, -1 for startPoint
+    };
+
+    // steps through the targets in order, stops at the first failure
+    void propagate(genfit::AbsTrackRep *rep, const genfit::MeasuredStateOnPlane &start, const std::vector<size_t> &order, Projection &p) const {
+        genfit::MeasuredStateOnPlane state(start);
+        for (size_t i : order) {
+            const Target &t = targets[i];
+            try {
+                if (t.plane)
+                    rep->extrapolateToPlane(state, t.plane, false, true);
+                else
+                    rep->extrapolateToLine(state, t.point, t.direction, false, true);
+            } catch (genfit::Exception &e) {
+                LOG_F(WARNING, "Projection to target %lu failed: %s", i, e.what());
+                return;
+            }
+            p.states[i] = state;
+            p.ok[i] = true;
+        }
+    }
+
+    int startPoint;
+    std::vector<Target> targets;
+    std::map<genfit::Track *, Projection> cache;
+};
+
+#endif
@@ -16,10 +16,22 @@
 #include <string>
 #include <vector>
 
+#include "StFwdTrackMaker/include/Tracker/Benchmark.h"
+#include "StFwdTrackMaker/include/Tracker/CloneRemover.h"
+#include "StFwdTrackMaker/include/Tracker/FitScheduler.h"
 #include "StFwdTrackMaker/include/Tracker/ConfigUtil.h"
+#include "StFwdTrackMaker/include/Tracker/CriteriaPipeline.h"
+#include "StFwdTrackMaker/include/Tracker/FlatAutomaton.h"
 #include "StFwdTrackMaker/include/Tracker/FwdHit.h"
+#include "StFwdTrackMaker/include/Tracker/FwdSegmentBuilder.h"
 #include "StFwdTrackMaker/include/Tracker/HitLoader.h"
+#include "StFwdTrackMaker/include/Tracker/PhiSlicer.h"
 #include "StFwdTrackMaker/include/Tracker/QualityPlotter.h"
+#include "StFwdTrackMaker/include/Tracker/SeedSignatures.h"
+#include "StFwdTrackMaker/include/Tracker/SegmentGraphCache.h"
+#include "StFwdTrackMaker/include/Tracker/SiHitIndex.h"
+#include "StFwdTrackMaker/include/Tracker/SubsetSolver.h"
+#include "StFwdTrackMaker/include/Tracker/TimeBudget.h"
 #include "StFwdTrackMaker/include/Tracker/TrackFitter.h"
 #include "StFwdTrackMaker/include/Tracker/loguru.h"
 
@@ -70,6 +82,11 @@ struct MCTruthUtils {
 
 class ForwardTrackMaker {
   public:
+    // outcome of the refit with Si hits, per fitted track
+    enum SiRefitStatus { kNoSiRefit = 0,
+                         kGoodSiRefit,
+                         kBadSiRefit };
+
     ForwardTrackMaker() : tree(nullptr), fInput(nullptr), configFile("config.xml") {
         LOG_SCOPE_FUNCTION(INFO);
     }
@@ -93,6 +110,7 @@ class ForwardTrackMaker {
 
     virtual void initialize() {
         setupHistograms();
+        setupTiming();
 
         doTrackFitting = !(cfg.get<bool>("TrackFitter:off", false));
         if (cfg.exists("TrackFitter") == false)
@@ -123,9 +141,32 @@ class ForwardTrackMaker {
         trackFitter = new TrackFitter(cfg);
         trackFitter->setup(cfg.get<bool>("TrackFitter:display"));
 
+        setupTiming();
         setupHistograms();
     }
 
+    // stage timings and the per-event time budget
+    void setupTiming() {
+        benchmark = new Benchmark(cfg);
+        benchmark->setup();
+        timeBudget = new TimeBudget(cfg);
+        timeBudget->setup();
+    }
+
+    /** With fill = false events are only tracked: the QA histograms of the tracker and the
+     * fitter are swapped for scratch copies and the quality plotter is skipped. Used for
+     * the benchmark repeats, so that the output of an event is filled once
+     */
+    void setFillOutputs(bool fill) {
+        if (fill == fillOutputs)
+            return;
+        if (scratchHist.empty())
+            scratchHist = Benchmark::scratchCopies(hist);
+        std::swap(hist, scratchHist);
+        trackFitter->setFillOutputs(fill);
+        fillOutputs = fill;
+    }
+
     void writeEventHistograms() {
         LOG_SCOPE_FUNCTION(INFO);
         // build the name
@@ -157,11 +198,14 @@ class ForwardTrackMaker {
     /** Loads Criteria from XML configuration.
    *
    * Utility function for loading criteria from XML config.
+   * With <path>:fused="true" the criteria are replaced by a single precompiled
+   * chain if one matches the configured set (see CriteriaPipeline.h)
    *
    * @return vector of ICriterion pointers
    */
-    std::vector<KiTrack::ICriterion *> loadCriteria(string path) {
+    std::vector<KiTrack::ICriterion *> loadCriteria(string path, bool allowFused = true) {
         std::vector<KiTrack::ICriterion *> crits;
+        CriteriaPipeline::CutValues cuts;
         auto paths = cfg.childrenOf(path);
 
         for (string p : paths) {
@@ -173,8 +217,10 @@ class ForwardTrackMaker {
                 continue;
             }
 
-            float vmin = cfg.get<float>(p + ":min", 0);
-            float vmax = cfg.get<float>(p + ":max", 1);
+            // narrower windows when the event is over its time budget
+            auto window = CriteriaPipeline::tightened(cfg.get<float>(p + ":min", 0), cfg.get<float>(p + ":max", 1), timeBudget->tighten());
+            float vmin = window.first;
+            float vmax = window.second;
             LOG_F(INFO, "Loading Criteria from %s (name=%s, min=%f, max=%f)", p.c_str(), name.c_str(), vmin, vmax);
             auto crit = KiTrack::Criteria::createCriterion(name, vmin, vmax);
             crit->setSaveValues(saveCriteriaValues);
@@ -182,9 +228,24 @@ class ForwardTrackMaker {
                 crits.push_back(new KiTrack::CriteriaKeeper(crit)); // KiTrack::CriteriaKeeper intercepts values and saves them
             else
                 crits.push_back(crit);
+            cuts[name] = std::make_pair(vmin, vmax);
+        }
+
+        // the fused chain does not report per-criterion values, so never use it when saving them
+        if (!allowFused || saveCriteriaValues || false == cfg.get<bool>(path + ":fused", false) || cuts.size() != crits.size())
+            return crits;
+
+        KiTrack::ICriterion *fused = CriteriaPipeline::fuse(cuts);
+        if (fused == nullptr) {
+            LOG_F(INFO, "No precompiled criteria chain for %s, using the generic criteria", path.c_str());
+            return crits;
         }
 
-        return crits;
+        LOG_F(INFO, "Using precompiled criteria chain %s", fused->getName().c_str());
+        if (cfg.get<bool>(path + ":validate", false))
+            return std::vector<KiTrack::ICriterion *>(1, new CriteriaPipeline::ValidatingCriterion(fused, crits, hist["CriteriaPipelineValidation"]));
+
+        return std::vector<KiTrack::ICriterion *>(1, fused);
     }
 
     std::vector<float> getCriteriaValues(std::string crit_name) {
@@ -266,10 +327,25 @@ class ForwardTrackMaker {
         hist["nFailedReFits"] = new TH1I("nFailedReFits", ";;# failed REfits", 10, 0, 10);
 
         hist["FitStatus"] = new TH1I("FitStatus", ";;# failed REfits", 15, 0, 15);
-        jdb::HistoBins::labelAxis(hist["FitStatus"]->GetXaxis(), {"Seeds", "AttemptFit", "GoodFit", "BadFit", "GoodCardinal", "PossibleReFit", "AttemptReFit", "GoodReFit", "BadReFit", "w3Si","w2Si", "w1Si", "w0Si" });
+        jdb::HistoBins::labelAxis(hist["FitStatus"]->GetXaxis(), {"Seeds", "AttemptFit", "GoodFit", "BadFit", "GoodCardinal", "PossibleReFit", "AttemptReFit", "GoodReFit", "BadReFit", "w3Si","w2Si", "w1Si", "w0Si", "PreFitReject" });
 
         hist["FitDuration"] = new TH1I("FitDuration", ";Duration (ms)", 5000, 0, 50000);
         hist["nSiHitsFound"] = new TH2I( "nSiHitsFound", ";Si Disk; n Hits", 5, 0, 5, 10, 0, 10 );
+
+        hist["SegmentBuilderValidation"] = new TH1I("SegmentBuilderValidation", ";;# segment builds", 2, 0, 2);
+        jdb::HistoBins::labelAxis(hist["SegmentBuilderValidation"]->GetXaxis(), {"Same", "Different"});
+        hist["CriteriaPipelineValidation"] = new TH1I("CriteriaPipelineValidation", ";;# evaluations", 2, 0, 2);
+        jdb::HistoBins::labelAxis(hist["CriteriaPipelineValidation"]->GetXaxis(), {"Same", "Different"});
+        hist["FlatAutomatonValidation"] = new TH1I("FlatAutomatonValidation", ";;# automaton runs", 2, 0, 2);
+        jdb::HistoBins::labelAxis(hist["FlatAutomatonValidation"]->GetXaxis(), {"Same", "Different"});
+        hist["CandidateTruncation"] = new TH1I("CandidateTruncation", ";;# hitmap subsets", 3, 0, 3);
+        jdb::HistoBins::labelAxis(hist["CandidateTruncation"]->GetXaxis(), {"Complete", "PerSeed", "Total"});
+        hist["CloneRemoval"] = new TH1I("CloneRemoval", ";;# candidates", 3, 0, 3);
+        jdb::HistoBins::labelAxis(hist["CloneRemoval"]->GetXaxis(), {"Candidates", "Exact", "Near"});
+        hist["SegmentGraphReuse"] = new TH1I("SegmentGraphReuse", ";;# segment builds", 4, 0, 4);
+        jdb::HistoBins::labelAxis(hist["SegmentGraphReuse"]->GetXaxis(), {"Rebuild", "Same", "Tighter", "Looser"});
+        hist["TimeBudget"] = new TH1I("TimeBudget", ";;# events", 7, 0, 7);
+        jdb::HistoBins::labelAxis(hist["TimeBudget"]->GetXaxis(), {"Events", "Full", "capCandidates", "tightenCriteria", "skipIterations", "skipSiRefit", "skipFits"});
     }
 
     void fillHistograms() {
@@ -313,13 +389,19 @@ class ForwardTrackMaker {
         // loop over events
         LOG_F(INFO, "Looping on %llu events starting from event %llu", nEvents, firstEvent);
 
-        for (unsigned long long iEvent = firstEvent; iEvent < firstEvent + nEvents; iEvent++) {
-            doEvent(iEvent);
+        // when benchmarking, the whole dataset is replayed several times and the last replay fills the output
+        for (size_t iRepeat = 0; iRepeat < benchmark->nRepeats(); iRepeat++) {
+            benchmark->startRepeat(iRepeat);
+            setFillOutputs(benchmark->lastRepeat());
+            for (unsigned long long iEvent = firstEvent; iEvent < firstEvent + nEvents; iEvent++) {
+                doEvent(iEvent);
+            }
         }
 
         trackFitter->showEvents();
         qPlotter->finish();
         writeEventHistograms();
+        benchmark->finish();
     }
 
     Seed_t::iterator findHitById(Seed_t &track, unsigned int _id) {
@@ -371,6 +453,9 @@ class ForwardTrackMaker {
         recoTrackIdTruth.clear();
         fitMoms.clear();
         fitStatus.clear();
+        siRefitStatus.clear();
+        fitSeeds.clear();
+        segmentCache.clear();
 
         // Clear pointers to the track reps from previous event
         for (auto p : _globalTrackReps)
@@ -383,9 +468,19 @@ class ForwardTrackMaker {
             delete p;
 
         _globalTracks.clear();
+        _globalTrackFits.clear();
+        _globalTrackSeeds.clear();
+        trackFitter->clearSeedCache();
         /************** Cleanup **************************/
 
-        qPlotter->startEvent(); // starts the timer for this event
+        // another tracker in the job (the compare tracker) may have installed its own field and material
+        trackFitter->activate();
+
+        if (fillOutputs)
+            qPlotter->startEvent(); // starts the timer for this event
+        benchmark->countEvent();
+        Benchmark::ScopedTimer eventTimer(benchmark, "Event");
+        timeBudget->startEvent();
 
         totalHitsRemoved = 0;
 
@@ -410,8 +505,10 @@ class ForwardTrackMaker {
 
             /***********************************************/
             // REFIT with Silicon hits
-            if (cfg.get<bool>("TrackFitter:refitSi", true)) {
+            timeBudget->check("SiRefit");
+            if (cfg.get<bool>("TrackFitter:refitSi", true) && !timeBudget->has(TimeBudget::kSkipSiRefit)) {
                 LOG_SCOPE_F(INFO, "Refitting with Si hits (MC association)");
+                Benchmark::ScopedTimer timer(benchmark, "SiRefit");
                 addSiHitsMc();
                 LOG_F(INFO, "Finished adding Si hits");
             } else {
@@ -419,7 +516,9 @@ class ForwardTrackMaker {
             }
             /***********************************************/
 
-            qPlotter->summarizeEvent(recoTracks, mcTrackMap, fitMoms, fitStatus);
+            if (fillOutputs)
+                qPlotter->summarizeEvent(recoTracks, mcTrackMap, fitMoms, fitStatus);
+            fillTimeBudget();
             return;
         }
 
@@ -427,13 +526,20 @@ class ForwardTrackMaker {
         LOG_F(INFO, "Running %lu Tracking Iterations", nIterations);
 
         for (size_t iIteration = 0; iIteration < nIterations; iIteration++) {
+            timeBudget->check("Iteration");
+            if (timeBudget->has(TimeBudget::kSkipIterations)) {
+                LOG_F(WARNING, "TimeBudget: skipping tracking iterations %lu - %lu", iIteration, nIterations - 1);
+                break;
+            }
             doTrackIteration(iIteration, hitmap);
         }
 
         /***********************************************/
         // REFIT with Silicon hits
-        if (cfg.get<bool>("TrackFitter:refitSi", true)) {
+        timeBudget->check("SiRefit");
+        if (cfg.get<bool>("TrackFitter:refitSi", true) && !timeBudget->has(TimeBudget::kSkipSiRefit)) {
             LOG_SCOPE_F(INFO, "Refitting");
+            Benchmark::ScopedTimer timer(benchmark, "SiRefit");
             addSiHits();
             LOG_F(INFO, "Finished adding Si hits");
         } else {
@@ -441,9 +547,27 @@ class ForwardTrackMaker {
         }
         /***********************************************/
 
-        qPlotter->summarizeEvent(recoTracks, mcTrackMap, fitMoms, fitStatus);
+        if (fillOutputs)
+            qPlotter->summarizeEvent(recoTracks, mcTrackMap, fitMoms, fitStatus);
+        fillTimeBudget();
     } // doEvent
 
+    // records how the event was tracked, in full or with which degradations
+    void fillTimeBudget() {
+        if (!timeBudget->active())
+            return;
+        hist["TimeBudget"]->Fill("Events", 1);
+        if (timeBudget->degradation() == TimeBudget::kNone) {
+            hist["TimeBudget"]->Fill("Full", 1);
+            return;
+        }
+        for (TimeBudget::Action a : {TimeBudget::kCapCandidates, TimeBudget::kTightenCriteria, TimeBudget::kSkipIterations, TimeBudget::kSkipSiRefit, TimeBudget::kSkipFits}) {
+            if (timeBudget->has(a))
+                hist["TimeBudget"]->Fill(TimeBudget::nameOf(a), 1);
+        }
+        LOG_F(WARNING, "Event tracked in reduced mode (degradation = %u) after %0.1f ms", timeBudget->degradation(), timeBudget->elapsedMs());
+    }
+
     void trackFitting(Seed_t &track) {
         LOG_SCOPE_FUNCTION(INFO);
 
@@ -501,6 +625,12 @@ class ForwardTrackMaker {
 
             fitMoms.push_back(p);
             fitStatus.push_back(trackFitter->getStatus());
+            siRefitStatus.push_back(kNoSiRefit);
+            fitSeeds.push_back(track);
+
+            // the fast Kalman fitter makes no genfit::Track, nothing to keep for the Si refit or StEvent
+            if (trackFitter->lastFitFast())
+                return;
 
             auto ft = trackFitter->getTrack();
             if (ft->getFitStatus(ft->getCardinalRep())->isFitConverged() && p.Perp() > 1e-3) {
@@ -514,6 +644,8 @@ class ForwardTrackMaker {
             int idtruth = MCTruthUtils::domCon(track, qatruth);
             mytrack->setMcTrackId(idtruth);
             _globalTracks.push_back(mytrack);
+            _globalTrackFits.push_back(fitMoms.size() - 1);
+            _globalTrackSeeds.push_back(track);
         } else {
             LOG_F(INFO, "Skipping Track Fitting");
         }
@@ -521,7 +653,8 @@ class ForwardTrackMaker {
 
     void doMcTrackFinding(std::map<int, shared_ptr<McTrack>> mcTrackMap) {
         LOG_SCOPE_FUNCTION( INFO );
-        qPlotter->startIteration();
+        if (fillOutputs)
+            qPlotter->startIteration();
 
         // we will build reco tracks from each McTrack
         for (auto kv : mcTrackMap) {
@@ -559,14 +692,19 @@ class ForwardTrackMaker {
 
         long long itStart = loguru::now_ns();
         // Fit each accepted track seed
-        for (auto t : recoTracks) {
-            trackFitting(t);
+        {
+            Benchmark::ScopedTimer timer(benchmark, "Fitting");
+            trackFitter->fitBatch(recoTracks);
+            for (auto t : recoTracks) {
+                trackFitting(t);
+            }
         }
         long long itEnd = loguru::now_ns();
         long long duration = (itEnd - itStart) * 1e-6; // milliseconds
         this->hist["FitDuration"]->Fill(duration);
 
-        qPlotter->afterIteration(0, recoTracks);
+        if (fillOutputs)
+            qPlotter->afterIteration(0, recoTracks);
     }
 
 
@@ -576,7 +714,7 @@ class ForwardTrackMaker {
     * @param inputMap INPUT hitmap to process
     * @param outputMap OUTPUT hitmap, will be cleared and filled with only the hits from inputMap that are within phi region
     * @param phi_min The minimum phi to accept
-    * @param phi_max The maximum Phi to accept
+    * @param phi_max The maximum Phi to accept, the range may extend past +-pi
     * 
     * @returns The number of hits in the outputMap
     */
@@ -587,7 +725,7 @@ class ForwardTrackMaker {
         for ( auto kv : inputMap ){
             for ( KiTrack::IHit* hit : kv.second ){
                 TVector3 vec(hit->getX(), hit->getY(), hit->getZ() );
-                if ( vec.Phi() < phi_min || vec.Phi() > phi_max ) continue;
+                if ( false == PhiSlicer::contains( PhiSlicer::Range( phi_min, phi_max ), vec.Phi() ) ) continue;
 
                 // now add the hits to the sliced map
                 outputMap[kv.first].push_back( hit );
@@ -597,43 +735,96 @@ class ForwardTrackMaker {
         return n_hits_kept;
     }
 
-    vector<Seed_t> doTrackingOnHitmapSubset( size_t iIteration, std::map<int, std::vector<KiTrack::IHit*> > &hitmap  ) {
-        LOG_SCOPE_FUNCTION(INFO);
-        /*************************************************************/
-        // Step 2
-        // build 2-hit segments (setup parent child relationships)
-        /*************************************************************/
+    KiTrack::Automaton get1SegAutomatonKiTrack(std::map<int, std::vector<KiTrack::IHit *>> &hitmap, FwdConnector &connector) {
         // Initialize the segment builder with sorted hits
         KiTrack::SegmentBuilder builder(hitmap);
+        builder.addCriteria(twoHitCrit);
+        builder.addSectorConnector(&connector);
+        return builder.get1SegAutomaton();
+    }
 
-        // Load the criteria used for 2-hit segments
-        // This loads from XML config if available
-        std::string criteriaPath = "TrackFinder.Iteration[" + std::to_string(iIteration) + "].SegmentBuilder";
+    KiTrack::Automaton get1SegAutomatonVectorized(std::map<int, std::vector<KiTrack::IHit *>> &hitmap, std::string criteriaPath, FwdConnector &connector) {
+        FwdSegmentBuilder builder(hitmap);
+        builder.addCriteria(cfg, criteriaPath, twoHitCrit, timeBudget->tighten());
+        builder.addSectorConnector(&connector);
+        return builder.get1SegAutomaton();
+    }
 
-        if (false == cfg.exists(criteriaPath)) {
-            // Use the default for all iterations if it is given.
-            // If not then no criteria will be applied
-            criteriaPath = "TrackFinder.SegmentBuilder";
+    /** How the 2-hit segments cached for this slice can be reused, counted in SegmentGraphReuse.
+     * Fills cuts with the current 2-hit criteria when incremental, and widener with the
+     * builder of the new pairs when the criteria are looser.
+     */
+    SegmentGraphCache::Reuse segmentReuse(bool incremental, const SegmentGraphCache::SliceKey &slice, std::map<int, std::vector<KiTrack::IHit *>> &hitmap, std::string criteriaPath, FwdConnector &connector, CriteriaPipeline::CutValues &cuts, std::unique_ptr<FwdSegmentBuilder> &widener) {
+        if (!incremental)
+            return SegmentGraphCache::kRebuild;
+
+        cuts = SegmentGraphCache::cutsOf(cfg, criteriaPath, timeBudget->tighten());
+        SegmentGraphCache::Reuse reuse = segmentCache.reuseFor(slice, cuts, connector.getDistance());
+        if (reuse == SegmentGraphCache::kLooser) {
+            widener.reset(new FwdSegmentBuilder(hitmap));
+            widener->addCriteria(cfg, criteriaPath, twoHitCrit, timeBudget->tighten());
+            widener->addSectorConnector(&connector);
+            // a fused chain cannot be evaluated per criterion
+            if (!widener->complete()) {
+                widener.reset();
+                reuse = SegmentGraphCache::kRebuild;
+            }
         }
 
-        twoHitCrit.clear();
-        twoHitCrit = loadCriteria(criteriaPath);
-        builder.addCriteria(twoHitCrit);
-
-        // Setup the connector (this tells it how to connect hits together into segments)
-        std::string connPath = "TrackFinder.Iteration[" + std::to_string(iIteration) + "].Connector";
-
-        if (false == cfg.exists(connPath))
-            connPath = "TrackFinder.Connector";
+        if (reuse == SegmentGraphCache::kSame) {
+            LOG_F(INFO, "Reusing the 2-hit segments of the previous iteration");
+            hist["SegmentGraphReuse"]->Fill("Same", 1);
+        } else if (reuse == SegmentGraphCache::kTighter) {
+            LOG_F(INFO, "Filtering the 2-hit segments of the previous iteration with tighter criteria");
+            hist["SegmentGraphReuse"]->Fill("Tighter", 1);
+        } else if (reuse == SegmentGraphCache::kLooser) {
+            LOG_F(INFO, "Widening the 2-hit segments of the previous iteration with looser criteria");
+            hist["SegmentGraphReuse"]->Fill("Looser", 1);
+        } else {
+            hist["SegmentGraphReuse"]->Fill("Rebuild", 1);
+        }
+        return reuse;
+    }
 
-        unsigned int distance = cfg.get<unsigned int>(connPath + ":distance", 1);
-        LOG_F(INFO, "Connector( distance = %u )", distance);
-        FwdConnector connector(distance);
-        builder.addSectorConnector(&connector);
+    /**
+     * Steps 2 - 3 with the KiTrack automaton.
+     *
+     * With incremental, the 2-hit segments of this slice are reused from the previous
+     * iteration where possible (see SegmentGraphCache.h)
+     *
+     * @returns all candidates with at least minHitsOnTrack hits
+     */
+    vector<Seed_t> findCandidatesKiTrack( size_t iIteration, std::map<int, std::vector<KiTrack::IHit*> > &hitmap, std::string criteriaPath, FwdConnector &connector, bool vectorized, bool validate, size_t minHitsOnTrack, bool incremental = false, SegmentGraphCache::SliceKey slice = SegmentGraphCache::SliceKey() ) {
+        /*************************************************************/
+        // Step 2
+        // build 2-hit segments (setup parent child relationships)
+        /*************************************************************/
+        Benchmark::ScopedTimer segmentTimer(benchmark, "Finding/SegmentBuilder");
 
         // Get the segments and return an automaton object for further work
-        LOG_F(INFO, "Getting the 1 hit segments");
-        KiTrack::Automaton automaton = builder.get1SegAutomaton();
+        LOG_F(INFO, "Getting the 1 hit segments (vectorized=%d)", (int)vectorized);
+        CriteriaPipeline::CutValues cuts;
+        std::unique_ptr<FwdSegmentBuilder> widener;
+        SegmentGraphCache::Reuse reuse = segmentReuse(incremental, slice, hitmap, criteriaPath, connector, cuts, widener);
+        KiTrack::Automaton automaton = reuse != SegmentGraphCache::kRebuild ? segmentCache.restoreAutomaton(slice, reuse, hitmap, twoHitCrit, widener.get())
+                                                                            : (vectorized ? get1SegAutomatonVectorized(hitmap, criteriaPath, connector) : get1SegAutomatonKiTrack(hitmap, connector));
+        if (incremental) {
+            auto conns = FwdSegmentBuilder::connectionsOf(automaton);
+            segmentCache.store(slice, cuts, connector.getDistance(), std::vector<SegmentGraphCache::Connection>(conns.begin(), conns.end()));
+        }
+
+        if (vectorized && validate) {
+            // cross-check against the per-pair KiTrack evaluation
+            KiTrack::Automaton reference = get1SegAutomatonKiTrack(hitmap, connector);
+            auto conns = FwdSegmentBuilder::connectionsOf(automaton);
+            auto refConns = FwdSegmentBuilder::connectionsOf(reference);
+            if (conns != refConns) {
+                LOG_F(ERROR, "Vectorized segment builder disagrees with KiTrack: %lu vs. %lu connections", conns.size(), refConns.size());
+                hist["SegmentBuilderValidation"]->Fill("Different", 1);
+            } else {
+                hist["SegmentBuilderValidation"]->Fill("Same", 1);
+            }
+        }
 
         // at any point we can get a list of tracks out like this:
         // std::vector < std::vector< KiTrack::IHit* > > tracks = automaton.getTracks();
@@ -642,11 +833,13 @@ class ForwardTrackMaker {
         // Report the number of segments and connections after the first step
         LOG_F(INFO, "nSegments=%lu", automaton.getSegments().size());
         LOG_F(INFO, "nConnections=%u", automaton.getNumberOfConnections());
+        segmentTimer.stop();
 
         /*************************************************************/
         // Step 3
         // build 3-hit segments from the 2-hit segments
         /*************************************************************/
+        Benchmark::ScopedTimer threeHitTimer(benchmark, "Finding/ThreeHitSegments");
         automaton.clearCriteria();
         automaton.resetStates();
         criteriaPath = "TrackFinder.Iteration[" + std::to_string(iIteration) + "].ThreeHitSegments";
@@ -658,7 +851,9 @@ class ForwardTrackMaker {
         threeHitCrit = loadCriteria(criteriaPath);
         automaton.addCriteria(threeHitCrit);
         automaton.lengthenSegments();
+        threeHitTimer.stop();
 
+        Benchmark::ScopedTimer automatonTimer(benchmark, "Finding/Automaton");
         bool doAutomation = cfg.get<bool>(criteriaPath + ":doAutomation", true);
         bool doCleanBadStates = cfg.get<bool>(criteriaPath + ":cleanBadStates", true);
 
@@ -675,30 +870,220 @@ class ForwardTrackMaker {
 
         LOG_F(INFO, "nSegments=%lu", automaton.getSegments().size());
         LOG_F(INFO, "nConnections=%u", automaton.getNumberOfConnections());
+        automatonTimer.stop();
+
+        Benchmark::ScopedTimer candidateTimer(benchmark, "Finding/Candidates");
+        LOG_F(INFO, "Getting all tracks with at least %lu hits on them", minHitsOnTrack);
+        return automaton.getTracks(minHitsOnTrack);
+    }
+
+    /**
+     * Steps 2 - 3 with the flat (CSR) automaton, see FlatAutomaton.h
+     *
+     * @returns all candidates with at least minHitsOnTrack hits, or only the best
+     * maxPathsPerSeed of each root segment (at most maxCandidates overall) when set
+     */
+    vector<Seed_t> findCandidatesFlat( size_t iIteration, std::map<int, std::vector<KiTrack::IHit*> > &hitmap, std::string criteriaPath, FwdConnector &connector, bool vectorized, size_t minHitsOnTrack, size_t maxPathsPerSeed = 0, size_t maxCandidates = 0, bool incremental = false, SegmentGraphCache::SliceKey slice = SegmentGraphCache::SliceKey() ) {
+        Benchmark::ScopedTimer segmentTimer(benchmark, "Finding/SegmentBuilder");
+        FlatAutomaton automaton(hitmap);
+        // 0 = all hardware threads
+        automaton.setNumThreads(cfg.get<size_t>("TrackFinder:nThreads", 1));
+
+        CriteriaPipeline::CutValues cuts;
+        std::unique_ptr<FwdSegmentBuilder> widener;
+        SegmentGraphCache::Reuse reuse = segmentReuse(incremental, slice, hitmap, criteriaPath, connector, cuts, widener);
+        if (reuse != SegmentGraphCache::kRebuild) {
+            segmentCache.restore(slice, reuse, hitmap, twoHitCrit, [&](int sector, size_t ia, int target, size_t ib) {
+                automaton.addConnection(automaton.hitIndex(sector, ia), automaton.hitIndex(target, ib));
+            }, widener.get());
+        } else if (vectorized) {
+            FwdSegmentBuilder builder(hitmap);
+            builder.addCriteria(cfg, criteriaPath, twoHitCrit, timeBudget->tighten());
+            builder.addSectorConnector(&connector);
+            builder.getConnections([&](int sector, size_t ia, int target, size_t ib) {
+                automaton.addConnection(automaton.hitIndex(sector, ia), automaton.hitIndex(target, ib));
+            });
+        } else {
+            KiTrack::Automaton oneHitAutomaton = get1SegAutomatonKiTrack(hitmap, connector);
+            automaton.addConnections(oneHitAutomaton);
+        }
+        if (incremental)
+            segmentCache.store(slice, cuts, connector.getDistance(), automaton.connectionIds());
+        LOG_F(INFO, "nSegments=%lu", automaton.nSegments());
+        segmentTimer.stop();
+
+        Benchmark::ScopedTimer threeHitTimer(benchmark, "Finding/ThreeHitSegments");
+        criteriaPath = "TrackFinder.Iteration[" + std::to_string(iIteration) + "].ThreeHitSegments";
+
+        if (false == cfg.exists(criteriaPath))
+            criteriaPath = "TrackFinder.ThreeHitSegments";
+
+        threeHitCrit.clear();
+        threeHitCrit = loadCriteria(criteriaPath);
+        automaton.lengthenSegments(threeHitCrit);
+        LOG_F(INFO, "nConnections=%lu", automaton.nConnections());
+        threeHitTimer.stop();
+
+        Benchmark::ScopedTimer automatonTimer(benchmark, "Finding/Automaton");
+        bool doAutomation = cfg.get<bool>(criteriaPath + ":doAutomation", true);
+        bool doCleanBadStates = cfg.get<bool>(criteriaPath + ":cleanBadStates", true);
+
+        if (doAutomation) {
+            size_t nSteps = automaton.doAutomaton();
+            LOG_F(INFO, "Automaton converged after %lu steps", nSteps);
+        }
+
+        if (doAutomation && doCleanBadStates) {
+            automaton.cleanBadStates();
+        }
+
+        LOG_F(INFO, "nSegments (good states)=%lu", automaton.nAlive());
+        automatonTimer.stop();
+
+        Benchmark::ScopedTimer candidateTimer(benchmark, "Finding/Candidates");
+        if (maxPathsPerSeed == 0 && maxCandidates == 0) {
+            LOG_F(INFO, "Getting all tracks with at least %lu hits on them", minHitsOnTrack);
+            return automaton.getTracks(minHitsOnTrack);
+        }
+
+        // without a per-seed limit keep every path of a root, only the total is capped
+        if (maxPathsPerSeed == 0)
+            maxPathsPerSeed = std::max<size_t>(1, maxCandidates);
+        LOG_F(INFO, "Getting the best %lu tracks per seed (%lu in total) with at least %lu hits on them", maxPathsPerSeed, maxCandidates, minHitsOnTrack);
+
+        FlatAutomaton::Truncation truncation;
+        vector<Seed_t> tracks = automaton.getBestTracks(minHitsOnTrack, maxPathsPerSeed, maxCandidates, truncation);
+        if (truncation.truncated()) {
+            LOG_F(WARNING, "Candidate extraction truncated: kept %lu of %llu paths (%lu seeds over the limit%s)",
+                  truncation.nKept, truncation.nPaths, truncation.nRootsTruncated, truncation.totalCapped ? ", total capped" : "");
+        }
+        if (truncation.nRootsTruncated > 0)
+            hist["CandidateTruncation"]->Fill("PerSeed", 1);
+        if (truncation.totalCapped)
+            hist["CandidateTruncation"]->Fill("Total", 1);
+        if (!truncation.truncated())
+            hist["CandidateTruncation"]->Fill("Complete", 1);
+        return tracks;
+    }
+
+    vector<Seed_t> doTrackingOnHitmapSubset( size_t iIteration, std::map<int, std::vector<KiTrack::IHit*> > &hitmap, SegmentGraphCache::SliceKey slice = SegmentGraphCache::SliceKey(-TMath::Pi(), TMath::Pi()) ) {
+        LOG_SCOPE_FUNCTION(INFO);
+
+        // Load the criteria used for 2-hit segments
+        // This loads from XML config if available
+        std::string criteriaPath = "TrackFinder.Iteration[" + std::to_string(iIteration) + "].SegmentBuilder";
+
+        if (false == cfg.exists(criteriaPath)) {
+            // Use the default for all iterations if it is given.
+            // If not then no criteria will be applied
+            criteriaPath = "TrackFinder.SegmentBuilder";
+        }
+
+        // The batch builder cannot record per-pair criteria values, so use KiTrack when saving them
+        bool vectorized = cfg.get<bool>(criteriaPath + ":vectorized", false) && !saveCriteriaValues;
+        bool validate = cfg.get<bool>(criteriaPath + ":validate", false);
+        // reuse the previous iteration's 2-hit segments of this slice, criteria values would not be saved for them
+        bool incremental = cfg.get<bool>(criteriaPath + ":incremental", false) && !saveCriteriaValues;
+
+        // the batch builder needs the individual criteria
+        twoHitCrit.clear();
+        twoHitCrit = loadCriteria(criteriaPath, !vectorized);
+
+        // Setup the connector (this tells it how to connect hits together into segments)
+        std::string connPath = "TrackFinder.Iteration[" + std::to_string(iIteration) + "].Connector";
+
+        if (false == cfg.exists(connPath))
+            connPath = "TrackFinder.Connector";
+
+        unsigned int distance = cfg.get<unsigned int>(connPath + ":distance", 1);
+        LOG_F(INFO, "Connector( distance = %u )", distance);
+        FwdConnector connector(distance);
 
-        /*************************************************************/
-        // Step 4
-        // Get the tracks from the possible tracks that are the best subset
-        /*************************************************************/
         std::string subsetPath = "TrackFinder.Iteration[" + std::to_string(iIteration) + "].SubsetNN";
 
         if (false == cfg.exists(subsetPath))
             subsetPath = "TrackFinder.SubsetNN";
 
+        size_t minHitsOnTrack = cfg.get<size_t>(subsetPath + ":min-hits-on-track", 7);
+
+        // The flat automaton follows KiTrack without skipped layers, so it needs distance = 1
+        std::string automatonPath = "TrackFinder.Iteration[" + std::to_string(iIteration) + "].Automaton";
+
+        if (false == cfg.exists(automatonPath))
+            automatonPath = "TrackFinder.Automaton";
+
+        bool flat = cfg.get<bool>(automatonPath + ":flat", false);
+        if (flat && distance != 1) {
+            LOG_F(WARNING, "The flat automaton requires Connector:distance=1, using the KiTrack automaton");
+            flat = false;
+        }
+
+        // bounded candidate extraction, 0 = enumerate all paths
+        size_t maxPathsPerSeed = cfg.get<size_t>(automatonPath + ":maxPathsPerSeed", 0);
+        size_t maxCandidates = cfg.get<size_t>(automatonPath + ":maxCandidates", 0);
+        if (!flat && (maxPathsPerSeed > 0 || maxCandidates > 0))
+            LOG_F(WARNING, "Automaton:maxPathsPerSeed and Automaton:maxCandidates need Automaton:flat, enumerating all paths");
+
+        // over the time budget: the tighter of the configured and the budget caps
+        if (timeBudget->has(TimeBudget::kCapCandidates)) {
+            maxPathsPerSeed = maxPathsPerSeed > 0 ? std::min(maxPathsPerSeed, timeBudget->maxPathsPerSeed()) : timeBudget->maxPathsPerSeed();
+            maxCandidates = maxCandidates > 0 ? std::min(maxCandidates, timeBudget->maxCandidates()) : timeBudget->maxCandidates();
+        }
+
+        std::vector<Seed_t> tracks;
+        if (flat) {
+            tracks = findCandidatesFlat(iIteration, hitmap, criteriaPath, connector, vectorized, minHitsOnTrack, maxPathsPerSeed, maxCandidates, incremental, slice);
+
+            // a bounded extraction is expected to differ from the full enumeration
+            if (cfg.get<bool>(automatonPath + ":validate", false) && maxPathsPerSeed == 0 && maxCandidates == 0) {
+                auto reference = findCandidatesKiTrack(iIteration, hitmap, criteriaPath, connector, vectorized, false, minHitsOnTrack);
+                if (FlatAutomaton::idSets(tracks) != FlatAutomaton::idSets(reference)) {
+                    LOG_F(ERROR, "Flat automaton disagrees with KiTrack: %lu vs. %lu candidates", tracks.size(), reference.size());
+                    hist["FlatAutomatonValidation"]->Fill("Different", 1);
+                } else {
+                    hist["FlatAutomatonValidation"]->Fill("Same", 1);
+                }
+            }
+        } else {
+            tracks = findCandidatesKiTrack(iIteration, hitmap, criteriaPath, connector, vectorized, validate, minHitsOnTrack, incremental, slice);
+        }
+        LOG_F(INFO, "We have %lu Tracks to work with", tracks.size());
+
+        // the KiTrack automaton enumerates all paths, at least keep the subset selection bounded
+        timeBudget->check("Subset");
+        if (timeBudget->has(TimeBudget::kCapCandidates) && tracks.size() > timeBudget->maxCandidates()) {
+            SeedQual quality;
+            std::stable_sort(tracks.begin(), tracks.end(), [&](const Seed_t &a, const Seed_t &b) { return quality(a) > quality(b); });
+            tracks.resize(timeBudget->maxCandidates());
+            LOG_F(WARNING, "TimeBudget: keeping the best %lu candidates", tracks.size());
+        }
+
+        // collapse clones before the quadratic subset step
+        std::string clones = cfg.get<std::string>(subsetPath + ":clones", "none");
+        if (clones == "exact" || clones == "near") {
+            Benchmark::ScopedTimer cloneTimer(benchmark, "Finding/Clones");
+            CloneRemover remover(clones == "near");
+            hist["CloneRemoval"]->Fill("Candidates", tracks.size());
+            tracks = remover.apply(tracks);
+            hist["CloneRemoval"]->Fill("Exact", remover.nExact);
+            hist["CloneRemoval"]->Fill("Near", remover.nNear);
+            LOG_F(INFO, "Removed %lu exact clones and %lu near duplicates, %lu Tracks left", remover.nExact, remover.nNear, tracks.size());
+        }
+
+        /*************************************************************/
+        // Step 4
+        // Get the tracks from the possible tracks that are the best subset
+        /*************************************************************/
         //  only for debug really
         bool findSubsets = cfg.get<bool>(subsetPath + ":active", true);
         std::vector<Seed_t> acceptedTracks;
         std::vector<Seed_t> rejectedTracks;
+        Benchmark::ScopedTimer subsetTimer(benchmark, "Finding/Subset");
 
         if (findSubsets) {
             LOG_SCOPE_F(INFO, "SubsetNN");
             LOG_F(INFO, "Trying to get best set of tracks given all the possibilities");
 
-            size_t minHitsOnTrack = cfg.get<size_t>(subsetPath + ":min-hits-on-track", 7);
-            LOG_F(INFO, "Getting all tracks with at least %lu hits on them", minHitsOnTrack);
-            std::vector<Seed_t> tracks = automaton.getTracks(minHitsOnTrack);
-            LOG_F(INFO, "We have %lu Tracks to work with", tracks.size());
-
             float omega = cfg.get<float>(subsetPath + ".Omega", 0.75);
             float stableThreshold = cfg.get<float>(subsetPath + ".StableThreshold", 0.1);
             float Ti = cfg.get<float>(subsetPath + ".InitialTemp", 2.1);
@@ -709,29 +1094,80 @@ class ForwardTrackMaker {
             LOG_F(INFO, "Omega=%0.3f", omega);
             LOG_F(INFO, "StableThreshold=%0.3f", stableThreshold);
 
-            KiTrack::SubsetHopfieldNN<Seed_t> subset;
-            subset.add(tracks);
-            subset.setOmega(omega);
-            subset.setLimitForStable(stableThreshold);
-            subset.setTStart(Ti);
+            // the Hopfield network over (a subset of) the seed indices, compatibility comes from the precomputed matrix
+            auto hopfield = [&](const SeedSignatures &signatures, const std::vector<size_t> &indices) {
+                KiTrack::SubsetHopfieldNN<size_t> subset;
+                subset.add(indices);
+                subset.setOmega(omega);
+                subset.setLimitForStable(stableThreshold);
+                subset.setTStart(Ti);
+
+                SeedIndexCompare comparer(signatures);
+                SeedIndexQual quality(tracks);
+
+                subset.calculateBestSet(comparer, quality);
+                return subset.getAccepted();
+            };
+
+            size_t nThreads = cfg.get<size_t>("TrackFinder:nThreads", 1);
+            std::string solver = cfg.get<std::string>(subsetPath + ":solver", "hopfield");
+            if (solver == "components") {
+                // independent conflict components, small ones solved exactly; found from the
+                // seeds of every hit, the large ones compare seeds by merging their hits
+                SeedSignatures signatures(tracks);
+                SubsetSolver components(tracks, signatures);
+                components.setExactMax(cfg.get<size_t>(subsetPath + ":exactMax", 20));
+                components.setNumThreads(nThreads);
+                if (cfg.get<std::string>(subsetPath + ":largeSolver", "greedy") == "hopfield") {
+                    components.setLargeSolver([&](const std::vector<size_t> &comp) { return hopfield(signatures, comp); });
+                }
 
-            SeedCompare comparer;
-            SeedQual quality;
+                std::vector<unsigned char> accepted = components.solve();
+                for (size_t i = 0; i < tracks.size(); i++) {
+                    if (accepted[i])
+                        acceptedTracks.push_back(tracks[i]);
+                    else
+                        rejectedTracks.push_back(tracks[i]);
+                }
+                LOG_F(INFO, "%lu conflict components (largest = %lu): %lu solved exactly, %lu large", components.nComponents(), components.largestComponent(), components.nExactComponents(), components.nLargeComponents());
+            } else if (cfg.get<bool>(subsetPath + ":signatures", true)) {
+                SeedSignatures signatures(tracks);
+                signatures.buildMatrix(nThreads);
+                std::vector<size_t> indices(tracks.size());
+                for (size_t i = 0; i < tracks.size(); i++)
+                    indices[i] = i;
+
+                std::vector<size_t> accepted = hopfield(signatures, indices);
+                std::vector<unsigned char> isAccepted(tracks.size(), 0);
+                for (size_t i : accepted) {
+                    acceptedTracks.push_back(tracks[i]);
+                    isAccepted[i] = 1;
+                }
+                for (size_t i = 0; i < tracks.size(); i++) {
+                    if (!isAccepted[i])
+                        rejectedTracks.push_back(tracks[i]);
+                }
+            } else {
+                KiTrack::SubsetHopfieldNN<Seed_t> subset;
+                subset.add(tracks);
+                subset.setOmega(omega);
+                subset.setLimitForStable(stableThreshold);
+                subset.setTStart(Ti);
 
-            subset.calculateBestSet(comparer, quality);
+                SeedCompare comparer;
+                SeedQual quality;
 
-            acceptedTracks = subset.getAccepted();
-            rejectedTracks = subset.getRejected();
+                subset.calculateBestSet(comparer, quality);
+
+                acceptedTracks = subset.getAccepted();
+                rejectedTracks = subset.getRejected();
+            }
 
             LOG_F(INFO, "We had %lu tracks. Accepted = %lu, Rejected = %lu", tracks.size(), acceptedTracks.size(), rejectedTracks.size());
 
         } else { // the subset and hit removal
             LOG_F(INFO, "The SubsetNN Step is turned OFF. This also means the Hit Remover is turned OFF (requires SubsetNN step)");
-
-            size_t minHitsOnTrack = cfg.get<size_t>(subsetPath + ":min-hits-on-track", 7);
-            LOG_F(INFO, "Getting all tracks with at least %lu hits on them", minHitsOnTrack);
-            acceptedTracks = automaton.getTracks(minHitsOnTrack);
-            LOG_F(INFO, "We have %lu Tracks to work with", acceptedTracks.size());
+            acceptedTracks = tracks;
 
             // qPlotter->afterIteration(iIteration, tracks);
         }// subset off
@@ -739,6 +1175,66 @@ class ForwardTrackMaker {
         return acceptedTracks;
     } // doTrackingOnHitmapSubset
 
+    /**
+     * The phi slices of an iteration: nEqual equal slices, or with phiSlicing="adaptive"
+     * as many as needed to keep the estimated 2-hit pairs per slice below maxPairsPerSlice
+     */
+    std::vector<PhiSlicer::Range> phiSlicesFor(size_t iIteration, std::map<int, std::vector<KiTrack::IHit *>> &hitmap, size_t nEqual) {
+        std::string path = "TrackFinder.Iteration[" + std::to_string(iIteration) + "]";
+        if (false == cfg.exists(path + ":phiSlicing"))
+            path = "TrackFinder";
+
+        std::vector<PhiSlicer::Range> slices;
+        if (cfg.get<std::string>(path + ":phiSlicing", "fixed") == "adaptive") {
+            std::string connPath = "TrackFinder.Iteration[" + std::to_string(iIteration) + "].Connector";
+            if (false == cfg.exists(connPath))
+                connPath = "TrackFinder.Connector";
+
+            PhiSlicer slicer(cfg.get<unsigned int>(connPath + ":distance", 1));
+            slices = slicer.slices(hitmap, cfg.get<double>(path + ":maxPairsPerSlice", 1e6), cfg.get<size_t>(path + ":maxPhiSlices", 100));
+            LOG_F(INFO, "Adaptive phi slicing: %lu slices", slices.size());
+            return slices;
+        }
+
+        float width = 2 * TMath::Pi() / (float)nEqual;
+        for (size_t i = 0; i < nEqual; i++)
+            slices.push_back(PhiSlicer::Range(i * width - TMath::Pi(), (i + 1) * width - TMath::Pi()));
+        return slices;
+    }
+
+    // drop the seeds failing the helix pre-fit gate of the fitter, counted as PreFitReject
+    void applyPreFit(std::vector<Seed_t> &tracks) {
+        Benchmark::ScopedTimer timer(benchmark, "Fitting/PreFit");
+        float maxChi2Ndf = cfg.get<float>("TrackFitter.PreFit:maxChi2Ndf", 10);
+        float ptMin = cfg.get<float>("TrackFitter.PreFit:ptMin", 0);
+        float ptMax = cfg.get<float>("TrackFitter.PreFit:ptMax", 0);
+
+        std::vector<Seed_t> kept;
+        for (Seed_t &t : tracks) {
+            if (trackFitter->passesPreFit(t, maxChi2Ndf, ptMin, ptMax))
+                kept.push_back(t);
+            else
+                hist["FitStatus"]->Fill("PreFitReject", 1);
+        }
+        LOG_F(INFO, "Helix pre-fit rejected %lu of %lu seeds", tracks.size() - kept.size(), tracks.size());
+        tracks.swap(kept);
+    }
+
+    // Tracks found twice in overlapping slices share hits, keep the best compatible set
+    void resolveSliceOverlaps(std::vector<Seed_t> &tracks) {
+        SeedSignatures signatures(tracks); // the solver only needs the seeds of each hit
+        SubsetSolver solver(tracks, signatures);
+        std::vector<unsigned char> accepted = solver.solve();
+
+        std::vector<Seed_t> kept;
+        for (size_t i = 0; i < tracks.size(); i++) {
+            if (accepted[i])
+                kept.push_back(tracks[i]);
+        }
+        LOG_F(INFO, "Removed %lu duplicate tracks from overlapping phi slices", tracks.size() - kept.size());
+        tracks.swap(kept);
+    }
+
     void doTrackIteration(size_t iIteration, std::map<int, std::vector<KiTrack::IHit *>> &hitmap) {
         LOG_SCOPE_FUNCTION(INFO);
         LOG_F(INFO, "Tracking Iteration %lu", iIteration);
@@ -757,7 +1253,10 @@ class ForwardTrackMaker {
         }
 
         // this starts the timer for the iteration
-        qPlotter->startIteration();
+        if (fillOutputs)
+            qPlotter->startIteration();
+        Benchmark::ScopedTimer findingTimer(benchmark, "Finding");
+        timeBudget->startStage("Finding");
 
 
         if ( false ) { // no phi slicing!
@@ -778,12 +1277,20 @@ class ForwardTrackMaker {
                 phi_slice_count= 1;
             }
 
-            LOG_F( INFO, "Using %lu phi_slices", phi_slice_count );
-            float phi_slice = 2 * TMath::Pi() / (float) phi_slice_count;
+            std::vector<PhiSlicer::Range> phiSlices = phiSlicesFor( iIteration, hitmap, phi_slice_count );
+            phi_slice_count = phiSlices.size();
+
+            // slices are widened by the overlap so tracks crossing a boundary stay whole in one of them
+            std::string overlapPath = "TrackFinder.Iteration["+ std::to_string(iIteration) + "]:phiOverlap";
+            if ( false == cfg.exists( overlapPath ) ) overlapPath = "TrackFinder:phiOverlap";
+            float phi_overlap = phi_slice_count > 1 ? cfg.get<float>( overlapPath, 0 ) : 0;
+
+            LOG_F( INFO, "Using %lu phi_slices (overlap = %0.3f)", phi_slice_count, phi_overlap );
             for ( size_t phi_slice_index = 0; phi_slice_index < phi_slice_count; phi_slice_index++ ){
+                timeBudget->check( "PhiSlice" );
 
-                float phi_min = phi_slice_index * phi_slice - TMath::Pi();
-                float phi_max = (phi_slice_index + 1) * phi_slice - TMath::Pi();
+                float phi_min = phiSlices[phi_slice_index].first - phi_overlap;
+                float phi_max = phiSlices[phi_slice_index].second + phi_overlap;
                 LOG_F( INFO, "Working with hits in %0.2f < phi < %0.2f", phi_min, phi_max );
 
                 /*************************************************************/
@@ -808,14 +1315,56 @@ class ForwardTrackMaker {
                 /*************************************************************/
                 // Steps 2 - 4 here
                 /*************************************************************/
-                auto acceptedTracks = doTrackingOnHitmapSubset( iIteration, slicedHitMap );
+                auto acceptedTracks = doTrackingOnHitmapSubset( iIteration, slicedHitMap, SegmentGraphCache::SliceKey( phi_min, phi_max ) );
                 recoTracksThisItertion.insert( recoTracksThisItertion.end(), acceptedTracks.begin(), acceptedTracks.end() );
             } //loop on phi slices
+
+            if ( phi_overlap > 0 )
+                resolveSliceOverlaps( recoTracksThisItertion );
         }// if loop on phi slices
 
+        findingTimer.stop();
+
+        // seeds failing the helix pre-fit are dropped before their hits are removed, so later iterations can use them
+        if (doTrackFitting && cfg.get<bool>("TrackFitter.PreFit:active", false))
+            applyPreFit( recoTracksThisItertion );
+
+        // doTrackFitting( recoTracksThisItertion );
+
+        // best seeds first, so a time budget drops the least valuable ones
+        if (doTrackFitting && cfg.get<std::string>("TrackFitter:schedule", "none") == "quality") {
+            // the curvatures are computed once per seed, and reused by the seed state of the fit
+            const auto &curvatures = trackFitter->cacheSeedCurvatures(recoTracksThisItertion);
+            FitScheduler scheduler;
+            recoTracksThisItertion = scheduler.schedule(recoTracksThisItertion, [&](const Seed_t &seed) -> const std::vector<float> & { return curvatures.at(seed); });
+        }
+
+        // the batched fits count against the fitting budget as well
+        timeBudget->startStage("Fitting");
+        timeBudget->check("Fitting");
+        if (doTrackFitting && !timeBudget->has(TimeBudget::kSkipFits)) {
+            Benchmark::ScopedTimer timer(benchmark, "Fitting/Batch");
+            trackFitter->fitBatch(recoTracksThisItertion);
+        }
+
+        {
+            Benchmark::ScopedTimer timer(benchmark, "Fitting");
+            for (size_t iTrack = 0; iTrack < recoTracksThisItertion.size(); iTrack++) {
+                timeBudget->check("Fitting");
+                if (timeBudget->has(TimeBudget::kSkipFits)) {
+                    LOG_F(WARNING, "TimeBudget: dropping %lu seeds that were not fitted", recoTracksThisItertion.size() - iTrack);
+                    recoTracksThisItertion.resize(iTrack);
+                    break;
+                }
+                trackFitting(recoTracksThisItertion[iTrack]);
+            }
+        }
+        trackFitter->clearSeedCache();
+
         /*************************************************************/
         // Step 5
-        // Remove the hits from any track that was found
+        // Remove the hits from any track that was found (and fitted,
+        // the seeds dropped by the time budget keep their hits)
         /*************************************************************/
         std::string hrmPath = "TrackFinder.Iteration["+ std::to_string(iIteration) + "].HitRemover";
         if ( false == cfg.exists( hrmPath ) ) hrmPath = "TrackFinder.HitRemover";
@@ -828,14 +1377,8 @@ class ForwardTrackMaker {
             LOG_F( INFO, "Hit Remover is turned OFF" );
         }
 
-
-        // doTrackFitting( recoTracksThisItertion );
-
-        for (auto t : recoTracksThisItertion) {
-            trackFitting(t);
-        }
-
-        qPlotter->afterIteration( iIteration, recoTracksThisItertion );
+        if (fillOutputs)
+            qPlotter->afterIteration( iIteration, recoTracksThisItertion );
 
         // Add the set of all accepted tracks (this iteration) to our collection of found tracks from all iterations
         recoTracks.insert( recoTracks.end(), recoTracksThisItertion.begin(), recoTracksThisItertion.end() );
@@ -846,12 +1389,14 @@ class ForwardTrackMaker {
         LOG_SCOPE_FUNCTION(INFO);
         std::map<int, std::vector<KiTrack::IHit *>> hitmap = hitLoader->loadSi(0);
         LOG_F(INFO, "hitmap size = %lu (should be 3)", hitmap.size());
+        std::vector<SiHitIndex> siIndex = buildSiHitIndex(hitmap);
 
         LOG_F(INFO, "We have %d global tracks to work with", _globalTracks.size());
         for (size_t i = 0; i < _globalTracks.size(); i++) {
+            size_t iFit = _globalTrackFits[i];
             LOG_F(INFO, "_globalTracks mcTrackId = %d", _globalTracks[i]->getMcTrackId());
 
-            if (_globalTracks[i]->getFitStatus(_globalTracks[i]->getCardinalRep())->isFitConverged() == false || fitMoms[i].Perp() < 1e-3) {
+            if (_globalTracks[i]->getFitStatus(_globalTracks[i]->getCardinalRep())->isFitConverged() == false || fitMoms[iFit].Perp() < 1e-3) {
                 LOG_F(WARNING, "Original Track fit did not converge, skipping");
                 return;
             }
@@ -861,16 +1406,10 @@ class ForwardTrackMaker {
             std::vector<KiTrack::IHit *> si_hits_for_this_track(3, nullptr);
 
             for (size_t j = 0; j < 3; j++) {
-                LOG_F(INFO, "Checking hitmap[%lu]", j);
-                for (auto h0 : hitmap[j]) {
-                    LOG_F(INFO, "Checking hit with _tid=%lu", dynamic_cast<FwdHit *>(h0)->_tid);
-                    if (dynamic_cast<FwdHit *>(h0)->_tid == _globalTracks[i]->getMcTrackId()) {
-                        si_hits_for_this_track[j] = h0;
-                        LOG_F(INFO, "Found Si hit on layer %lu", j);
-                        break;
-                    }
-                } // loop on hits in this layer of hitmap
-            }     // loop on hitmap layers
+                si_hits_for_this_track[j] = siIndex[j].findTrack(_globalTracks[i]->getMcTrackId());
+                if (si_hits_for_this_track[j] != nullptr)
+                    LOG_F(INFO, "Found Si hit on layer %lu", j);
+            } // loop on hitmap layers
 
             LOG_F(INFO, "Si hit0 = %p", si_hits_for_this_track[0]);
             LOG_F(INFO, "Si hit1 = %p", si_hits_for_this_track[1]);
@@ -890,16 +1429,17 @@ class ForwardTrackMaker {
                 hist["FitStatus"]->Fill("AttemptReFit", 1);
                 TVector3 p = trackFitter->refitTrackWithSiHits(_globalTracks[i], si_hits_for_this_track);
 
-                if (p.Perp() == fitMoms[i].Perp()) {
+                if (p.Perp() == fitMoms[iFit].Perp()) {
                     hist["FitStatus"]->Fill("BadReFit", 1);
-
+                    siRefitStatus[iFit] = kBadSiRefit;
                 } else {
                     hist["FitStatus"]->Fill("GoodReFit", 1);
+                    siRefitStatus[iFit] = kGoodSiRefit;
                 }
 
                 LOG_F(INFO, "Global track now has: %lu points", _globalTracks[i]->getNumPoints());
-                LOG_F(INFO, "pt was: %0.2f and now is: %0.2f", fitMoms[i].Perp(), p.Perp());
-                fitMoms[i] = p;
+                LOG_F(INFO, "pt was: %0.2f and now is: %0.2f", fitMoms[iFit].Perp(), p.Perp());
+                fitMoms[iFit] = p;
             } // we have 3 Si hits to refit with
 
             hist["FitStatus"]->Fill( TString::Format( "w%uSi", nSiHitsFound ).Data(), 1 );
@@ -912,9 +1452,12 @@ class ForwardTrackMaker {
         std::map<int, std::vector<KiTrack::IHit *>> hitmap = hitLoader->loadSi(0);
 
         LOG_F(INFO, "hitmap size = %lu (should be 3)", hitmap.size());
+        std::vector<SiHitIndex> siIndex = buildSiHitIndex(hitmap);
+        trackFitter->clearProjections();
 
         // loop on global tracks
         for (size_t i = 0; i < _globalTracks.size(); i++) {
+            size_t iFit = _globalTrackFits[i];
 
             if (_globalTracks[i]->getFitStatus(_globalTracks[i]->getCardinalRep())->isFitConverged() == false) {
                 LOG_F(WARNING, "Original Track fit did not converge, skipping");
@@ -926,17 +1469,15 @@ class ForwardTrackMaker {
             std::vector<KiTrack::IHit *> hits_near_disk0;
             std::vector<KiTrack::IHit *> hits_near_disk1;
             std::vector<KiTrack::IHit *> hits_near_disk2;
-            try {
-                auto msp2 = trackFitter->projectTo(2, _globalTracks[i]);
-                auto msp1 = trackFitter->projectTo(1, _globalTracks[i]);
-                auto msp0 = trackFitter->projectTo(0, _globalTracks[i]);
-
+            // one pass through the three disks
+            const auto &projection = trackFitter->projectToSi(_globalTracks[i]);
+            if (projection.valid(0) && projection.valid(1) && projection.valid(2)) {
                 // now look for Si hits near these
-                hits_near_disk2 = findSiHitsNearMe(hitmap[2], msp2);
-                hits_near_disk1 = findSiHitsNearMe(hitmap[1], msp1);
-                hits_near_disk0 = findSiHitsNearMe(hitmap[0], msp0);
-            } catch (genfit::Exception &e) {
-                LOG_F(ERROR, "Failed to project to Si disk: %s", e.what());
+                hits_near_disk2 = findSiHitsNearMe(siIndex[2], projection.state(2));
+                hits_near_disk1 = findSiHitsNearMe(siIndex[1], projection.state(1));
+                hits_near_disk0 = findSiHitsNearMe(siIndex[0], projection.state(0));
+            } else {
+                LOG_F(ERROR, "Failed to project to Si disk");
             }
 
             LOG_F(INFO, "There are (%lu, %lu, %lu) hits near the track on Si disks 0, 1, 2", hits_near_disk0.size(), hits_near_disk1.size(), hits_near_disk2.size());
@@ -975,17 +1516,18 @@ class ForwardTrackMaker {
                 hist["FitStatus"]->Fill("AttemptReFit", 1);
                 TVector3 p = trackFitter->refitTrackWithSiHits(_globalTracks[i], hits_to_add);
 
-                if (p.Perp() == fitMoms[i].Perp()) {
+                if (p.Perp() == fitMoms[iFit].Perp()) {
                     hist["FitStatus"]->Fill("BadReFit", 1);
-
+                    siRefitStatus[iFit] = kBadSiRefit;
                 } else {
                     hist["FitStatus"]->Fill("GoodReFit", 1);
+                    siRefitStatus[iFit] = kGoodSiRefit;
 
-                    fitMoms[i] = p;
+                    fitMoms[iFit] = p;
                 }
 
                 // LOG_F(INFO, "Global track now has: %lu point", _globalTracks[i]->getNumPoints());
-                // LOG_F(INFO, "pt was: %0.2f and now is: %0.2f", fitMoms[i].Perp(), p.Perp());
+                // LOG_F(INFO, "pt was: %0.2f and now is: %0.2f", fitMoms[iFit].Perp(), p.Perp());
 
             } else {
                 // fitMoms[ i ] = TVector3( 1000, 1000, 1000 );
@@ -996,27 +1538,33 @@ class ForwardTrackMaker {
         } // loop on globals
     }     // addSiHits
 
-    std::vector<KiTrack::IHit *> findSiHitsNearMe(std::vector<KiTrack::IHit *> &available_hits, genfit::MeasuredStateOnPlane &msp, double dphi = 0.004 * 15.5, double dr = 0.75) {
-        LOG_SCOPE_FUNCTION(INFO);
-        double probe_phi = TMath::ATan2(msp.getPos().Y(), msp.getPos().X());
-        double probe_r = sqrt(pow(msp.getPos().X(), 2) + pow(msp.getPos().Y(), 2));
-
-        std::vector<KiTrack::IHit *> found_hits;
+    // (r, phi) index of the Si hits on each of the 3 disks, cells of the strip pitch
+    std::vector<SiHitIndex> buildSiHitIndex(std::map<int, std::vector<KiTrack::IHit *>> &hitmap) {
+        std::vector<SiHitIndex> index(3, SiHitIndex(cfg.get<double>("SiRasterizer:r", 3.0), cfg.get<double>("SiRasterizer:phi", 0.004)));
+        for (size_t j = 0; j < index.size(); j++)
+            index[j].build(hitmap[j]);
+        return index;
+    }
 
-        for (auto h : available_hits) {
-            double h_phi = TMath::ATan2(h->getY(), h->getX());
-            double h_r = sqrt(pow(h->getX(), 2) + pow(h->getY(), 2));
-            double mdphi = fabs(h_phi - probe_phi);
-            if ( mdphi > 2 * TMath::Pi() ) {
-                LOG_F( WARNING, "BAD WRAP" );
-            }
-            LOG_F(1, "hit_phi=%0.2f - mphi=%0.2f = %0.2f", h_phi, probe_phi, fabs(h_phi - probe_phi));
-            if ( mdphi < dphi || fabs( h_r - probe_r ) < dr) { // handle 2pi edge
-                found_hits.push_back(h);
-            }
+    /** Si hits inside the (r, phi) window around the projected state. The window is
+     * widened to TrackFinder.SiSearch:nSigma times the projected errors if that is larger
+     */
+    std::vector<KiTrack::IHit *> findSiHitsNearMe(const SiHitIndex &index, const genfit::MeasuredStateOnPlane &msp, double dphi = 0.004 * 15.5, double dr = 0.75) {
+        LOG_SCOPE_FUNCTION(INFO);
+        double x = msp.getPos().X(), y = msp.getPos().Y();
+        double probe_phi = TMath::ATan2(y, x);
+        double probe_r = sqrt(x * x + y * y);
+
+        double nSigma = cfg.get<double>("TrackFinder.SiSearch:nSigma", 0);
+        if (nSigma > 0 && probe_r > 0) {
+            TMatrixDSym cov = msp.get6DCov();
+            double r2 = probe_r * probe_r;
+            double sigmaR = sqrt(fabs(x * x * cov(0, 0) + 2 * x * y * cov(0, 1) + y * y * cov(1, 1)) / r2);
+            double sigmaPhi = sqrt(fabs(y * y * cov(0, 0) - 2 * x * y * cov(0, 1) + x * x * cov(1, 1))) / r2;
+            dr = std::max(dr, nSigma * sigmaR);
+            dphi = std::max(dphi, nSigma * sigmaPhi);
         }
-
-        return found_hits;
+        return index.find(probe_r, probe_phi, dr, dphi);
     }
 
     bool getSaveCriteriaValues() { return saveCriteriaValues; }
@@ -1024,6 +1572,8 @@ class ForwardTrackMaker {
     std::vector<KiTrack::ICriterion *> getThreeHitCriteria() { return threeHitCrit; }
 
     TrackFitter *getTrackFitter() { return trackFitter; }
+    Benchmark *getBenchmark() { return benchmark; }
+    TimeBudget *getTimeBudget() { return timeBudget; }
 
   protected:
     TTree *tree;
@@ -1032,6 +1582,7 @@ class ForwardTrackMaker {
 
     bool doTrackFitting = true;
     bool saveCriteriaValues = false;
+    bool fillOutputs = true; // false while repeating events for the benchmark
 
     /* TTree data members */
     int tree_n;
@@ -1059,27 +1610,38 @@ class ForwardTrackMaker {
     std::vector<TVector3> fitMoms;
     // vector<int> fitQs;
     std::vector<genfit::FitStatus> fitStatus;
+    std::vector<int> siRefitStatus;
+    std::vector<Seed_t> fitSeeds; // seed of each fit, the McFilter skips some of recoTracks
     std::vector<genfit::AbsTrackRep *> _globalTrackReps;
     std::vector<genfit::Track *> _globalTracks;
+    std::vector<size_t> _globalTrackFits;  // index in fitMoms of each global track (fast fits make none)
+    std::vector<Seed_t> _globalTrackSeeds; // seed of each global track
 
     QualityPlotter *qPlotter;
     IHitLoader *hitLoader;
 
     TrackFitter *trackFitter = nullptr;
+    Benchmark *benchmark = nullptr;
+    TimeBudget *timeBudget = nullptr;
 
     std::vector<KiTrack::ICriterion *> twoHitCrit;
     std::vector<KiTrack::ICriterion *> threeHitCrit;
+    SegmentGraphCache segmentCache; // 2-hit segments of the previous iteration, per phi slice
 
     // histograms of the raw input data
     std::map<std::string, TH1 *> hist;
+    std::map<std::string, TH1 *> scratchHist; // filled instead of hist while fillOutputs is false
     std::map<std::string, std::vector<float>> criteriaValues;
 
   public:
     const std::vector<Seed_t> &getRecoTracks() const { return recoTracks; }
     const std::vector<TVector3> &getFitMomenta() const { return fitMoms; }
     const std::vector<genfit::FitStatus> &getFitStatus() const { return fitStatus; }
+    const std::vector<int> &getSiRefitStatus() const { return siRefitStatus; }
+    const std::vector<Seed_t> &getFitSeeds() const { return fitSeeds; }
     const std::vector<genfit::AbsTrackRep *> &globalTrackReps() const { return _globalTrackReps; }
     const std::vector<genfit::Track *> &globalTracks() const { return _globalTracks; }
+    const std::vector<Seed_t> &globalTrackSeeds() const { return _globalTrackSeeds; }
 };
 
 #endif
@@ -0,0 +1,168 @@
+#ifndef HELIX_PRE_FIT_H
+#define HELIX_PRE_FIT_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+/**
+ * Analytic helix pre-fit of a seed, used to reject hopeless seeds before GenFit and
+ * to give it a better starting state.
+ *
+ * The transverse projection is fitted with the algebraic (Kasa) circle fit, a weighted
+ * linear least-squares fit of x^2 + y^2 + D x + E y + F = 0 (done around the centroid
+ * for conditioning). The arc length s along the circle is then fitted linearly in z.
+ * The chi2 sums the radial residuals and the arc length residuals, each over the hit
+ * resolution, with ndf = (n - 3) + (n - 2).
+ *
+ * Units are cm and kGauss (as in GenFit), momenta in GeV/c.
+ */
+class HelixPreFit {
+  public:
+    struct Point {
+        double x, y, z;
+        double sigma2; // transverse position variance
+    };
+
+    struct Result {
+        bool valid = false;
+        double xc = 0, yc = 0, radius = 0;
+        double chi2 = 0;
+        int ndf = 0;
+        double pt = 0;
+        int charge = 0;
+        double x = 0, y = 0, z = 0;    // the first point in z
+        double px = 0, py = 0, pz = 0; // momentum at that point
+
+        double chi2Ndf() const { return ndf > 0 ? chi2 / ndf : 0; }
+    };
+
+    /** Fits at least 4 points, bz is the field along z
+     * @returns an invalid result if there are too few points or they are collinear
+     */
+    static Result fit(std::vector<Point> points, double bz) {
+        Result r;
+        const size_t n = points.size();
+        if (n < 4)
+            return r;
+        std::sort(points.begin(), points.end(), [](const Point &a, const Point &b) { return a.z < b.z; });
+
+        double mx = 0, my = 0;
+        for (const Point &p : points) {
+            mx += p.x / n;
+            my += p.y / n;
+        }
+
+        // normal equations of sum w (u^2 + v^2 + D u + E v + F)^2 in centred coordinates
+        double A[3][4] = {{0}};
+        for (const Point &p : points) {
+            double w = 1.0 / std::max(p.sigma2, 1e-8);
+            double u = p.x - mx, v = p.y - my;
+            double row[3] = {u, v, 1};
+            double rhs = -(u * u + v * v);
+            for (int i = 0; i < 3; i++) {
+                for (int j = 0; j < 3; j++)
+                    A[i][j] += w * row[i] * row[j];
+                A[i][3] += w * row[i] * rhs;
+            }
+        }
+        double sol[3];
+        if (!solve3(A, sol))
+            return r;
+
+        r.xc = mx - 0.5 * sol[0];
+        r.yc = my - 0.5 * sol[1];
+        double r2 = 0.25 * (sol[0] * sol[0] + sol[1] * sol[1]) - sol[2];
+        if (!(r2 > 0) || std::isinf(r2))
+            return r;
+        r.radius = std::sqrt(r2);
+
+        // arc length from the first point, with the phi differences unwrapped
+        std::vector<double> s(n, 0);
+        double phiPrev = std::atan2(points[0].y - r.yc, points[0].x - r.xc);
+        for (size_t i = 1; i < n; i++) {
+            double phi = std::atan2(points[i].y - r.yc, points[i].x - r.xc);
+            double d = phi - phiPrev;
+            while (d > M_PI)
+                d -= 2 * M_PI;
+            while (d < -M_PI)
+                d += 2 * M_PI;
+            s[i] = s[i - 1] + r.radius * d;
+            phiPrev = phi;
+        }
+
+        // s = a + b z, weighted like the transverse residuals
+        double sw = 0, swz = 0, swzz = 0, sws = 0, swzs = 0;
+        for (size_t i = 0; i < n; i++) {
+            double w = 1.0 / std::max(points[i].sigma2, 1e-8);
+            sw += w;
+            swz += w * points[i].z;
+            swzz += w * points[i].z * points[i].z;
+            sws += w * s[i];
+            swzs += w * points[i].z * s[i];
+        }
+        double det = sw * swzz - swz * swz;
+        if (std::fabs(det) < 1e-12 * sw * swzz)
+            return r;
+        double b = (sw * swzs - swz * sws) / det;
+        double a = (sws - b * swz) / sw;
+
+        r.chi2 = 0;
+        for (size_t i = 0; i < n; i++) {
+            double w = 1.0 / std::max(points[i].sigma2, 1e-8);
+            double dr = std::sqrt((points[i].x - r.xc) * (points[i].x - r.xc) + (points[i].y - r.yc) * (points[i].y - r.yc)) - r.radius;
+            double ds = s[i] - a - b * points[i].z;
+            r.chi2 += w * (dr * dr + ds * ds);
+        }
+        r.ndf = 2 * (int)n - 5;
+
+        // counter-clockwise (seen from +z) with increasing z is a negative charge in a field along +z
+        bool ccw = b > 0;
+        r.pt = 0.00029979 * std::fabs(bz) * r.radius;
+        r.charge = (bz == 0 || b == 0) ? 0 : ((ccw == (bz > 0)) ? -1 : 1);
+
+        r.x = points[0].x;
+        r.y = points[0].y;
+        r.z = points[0].z;
+        double tx = -(r.y - r.yc) / r.radius, ty = (r.x - r.xc) / r.radius;
+        if (!ccw) {
+            tx = -tx;
+            ty = -ty;
+        }
+        r.px = r.pt * tx;
+        r.py = r.pt * ty;
+        r.pz = std::fabs(b) > 0 ? r.pt / std::fabs(b) : 0;
+        r.valid = bz != 0 && b != 0;
+        return r;
+    }
+
+  protected:
+    // Gaussian elimination with partial pivoting of a 3x3 system in augmented form
+    static bool solve3(double A[3][4], double x[3]) {
+        for (int c = 0; c < 3; c++) {
+            int pivot = c;
+            for (int i = c + 1; i < 3; i++) {
+                if (std::fabs(A[i][c]) > std::fabs(A[pivot][c]))
+                    pivot = i;
+            }
+            if (std::fabs(A[pivot][c]) < 1e-12)
+                return false;
+            for (int j = 0; j < 4; j++)
+                std::swap(A[c][j], A[pivot][j]);
+            for (int i = c + 1; i < 3; i++) {
+                double f = A[i][c] / A[c][c];
+                for (int j = c; j < 4; j++)
+                    A[i][j] -= f * A[c][j];
+            }
+        }
+        for (int i = 2; i >= 0; i--) {
+            x[i] = A[i][3];
+            for (int j = i + 1; j < 3; j++)
+                x[i] -= A[i][j] * x[j];
+            x[i] /= A[i][i];
+        }
+        return true;
+    }
+};
+
+#endif
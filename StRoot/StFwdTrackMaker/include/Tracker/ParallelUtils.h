@@ -0,0 +1,52 @@
+#ifndef PARALLEL_UTILS_H
+#define PARALLEL_UTILS_H
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+namespace ParallelUtils {
+
+// number of threads to use for a requested count, 0 means all hardware threads
+inline size_t nThreads(size_t requested) {
+    if (requested > 0)
+        return requested;
+    size_t n = std::thread::hardware_concurrency();
+    return n > 0 ? n : 1;
+}
+
+/**
+ * Splits [0, n) into at most nChunks contiguous ranges and calls f(begin, end, iChunk)
+ * for each, on its own thread. Chunk boundaries depend only on n and nChunks, so
+ * results merged in chunk order are deterministic. Runs inline when a single chunk
+ * is enough (fewer than minPerChunk items per chunk).
+ */
+template <typename F>
+void parallelFor(size_t n, size_t nChunks, F f, size_t minPerChunk = 1024) {
+    nChunks = std::max<size_t>(1, std::min(nChunks, n / std::max<size_t>(1, minPerChunk)));
+    if (nChunks == 1) {
+        f(size_t(0), n, size_t(0));
+        return;
+    }
+
+    std::vector<std::thread> threads;
+    size_t chunk = (n + nChunks - 1) / nChunks;
+    for (size_t i = 0; i < nChunks; i++) {
+        size_t begin = i * chunk;
+        size_t end = std::min(n, begin + chunk);
+        if (begin >= end)
+            break;
+        threads.push_back(std::thread(f, begin, end, i));
+    }
+    for (auto &t : threads)
+        t.join();
+}
+
+// number of chunks parallelFor will use for n items
+inline size_t nChunks(size_t n, size_t nChunks, size_t minPerChunk = 1024) {
+    return std::max<size_t>(1, std::min(nChunks, n / std::max<size_t>(1, minPerChunk)));
+}
+
+} // namespace ParallelUtils
+
+#endif
@@ -0,0 +1,116 @@
+#ifndef PHI_SLICER_H
+#define PHI_SLICER_H
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "KiTrack/IHit.h"
+
+/**
+ * Phi slices for the track finding, chosen from the hit occupancy.
+ *
+ * The number of 2-hit pairs a slice can form is estimated as the sum of n_i * n_j over
+ * the layer pairs (i, j) the connector links (|i - j| <= distance). Hits are swept in
+ * phi and a slice is closed as soon as adding the next hit would exceed maxPairs, with
+ * the boundary half way between the two hits. Slices never split hits of equal phi.
+ */
+class PhiSlicer {
+  public:
+    typedef std::pair<float, float> Range; // (phi min, phi max)
+
+    PhiSlicer(unsigned int _distance = 1) : distance(_distance) {}
+
+    /** Slices covering [-pi, pi] with at most maxPairs estimated pairs each (a single
+     * slice if everything fits). If more than maxSlices would be needed, the pair budget
+     * is raised so that maxSlices slices of about equal occupancy are returned.
+     */
+    std::vector<Range> slices(std::map<int, std::vector<KiTrack::IHit *>> &hitmap, double maxPairs, size_t maxSlices) {
+        std::vector<std::pair<float, int>> hits; // (phi, layer)
+        for (auto &kv : hitmap) {
+            for (KiTrack::IHit *h : kv.second)
+                hits.push_back(std::make_pair((float)atan2(h->getY(), h->getX()), kv.first));
+        }
+        std::sort(hits.begin(), hits.end());
+
+        double total = pairsOf(hits, 0, hits.size());
+        maxSlices = std::max<size_t>(1, maxSlices);
+        if (maxPairs <= 0 || total <= maxPairs || maxSlices == 1 || hits.empty())
+            return std::vector<Range>(1, Range(-M_PI, M_PI));
+
+        // pair counts grow roughly with the square of the hits, so equal slices need total / n^2 each
+        if (total / ((double)maxSlices * maxSlices) > maxPairs)
+            maxPairs = total / ((double)maxSlices * maxSlices);
+
+        std::vector<Range> candidate;
+        for (int attempt = 0; attempt < 64; attempt++) {
+            candidate = sweep(hits, maxPairs);
+            if (candidate.size() <= maxSlices)
+                return candidate;
+            maxPairs *= 1.25;
+        }
+        return candidate;
+    }
+
+    // estimated number of pairs formed by the hits [begin, end) of a phi sorted list
+    double pairsOf(const std::vector<std::pair<float, int>> &hits, size_t begin, size_t end) const {
+        std::map<int, double> perLayer;
+        for (size_t i = begin; i < end; i++)
+            perLayer[hits[i].second]++;
+        double pairs = 0;
+        for (auto &a : perLayer) {
+            for (auto &b : perLayer) {
+                if (b.first > a.first && (unsigned int)(b.first - a.first) <= distance)
+                    pairs += a.second * b.second;
+            }
+        }
+        return pairs;
+    }
+
+    // true if phi lies in the range, which may extend past +-pi after adding overlaps
+    static bool contains(const Range &r, float phi) {
+        if (phi >= r.first && phi <= r.second)
+            return true;
+        if (r.first < -M_PI && phi >= r.first + 2 * M_PI)
+            return true;
+        if (r.second > M_PI && phi <= r.second - 2 * M_PI)
+            return true;
+        return false;
+    }
+
+  protected:
+    std::vector<Range> sweep(const std::vector<std::pair<float, int>> &hits, double maxPairs) const {
+        std::vector<Range> result;
+        std::map<int, double> perLayer;
+        double pairs = 0;
+        float low = -M_PI;
+        for (size_t i = 0; i < hits.size(); i++) {
+            int layer = hits[i].second;
+            double added = 0;
+            for (auto &kv : perLayer) {
+                if (kv.first != layer && (unsigned int)std::abs(kv.first - layer) <= distance)
+                    added += kv.second;
+            }
+
+            // close the slice before this hit, unless it has the same phi as the previous one
+            if (pairs + added > maxPairs && !perLayer.empty() && hits[i].first > hits[i - 1].first) {
+                float boundary = 0.5f * (hits[i - 1].first + hits[i].first);
+                result.push_back(Range(low, boundary));
+                low = boundary;
+                perLayer.clear();
+                pairs = 0;
+                added = 0;
+            }
+            perLayer[layer]++;
+            pairs += added;
+        }
+        result.push_back(Range(low, M_PI));
+        return result;
+    }
+
+    unsigned int distance;
+};
+
+#endif
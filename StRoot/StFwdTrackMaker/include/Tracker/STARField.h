@@ -5,8 +5,25 @@
 #include "TFile.h"
 #include "TH3.h"
 
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "StarMagField/StarMagField.h"
 
+#include "StFwdTrackMaker/include/Tracker/FwdCacheFile.h"
 #include "StFwdTrackMaker/include/Tracker/loguru.h"
 #include "GenFit/AbsBField.h"
 
@@ -47,20 +64,14 @@ namespace genfit
 {
 
 //_______________________________________________________________________________________
-// Adaptor for STAR magnetic field loaded from a ROOT file with the field in cartesian coords
+// Adaptor for STAR magnetic field loaded from a ROOT file with the field in cartesian coords.
+// The histograms are read at the first lookup, so a field grid mapped from its cache never
+// opens the file unless a point falls outside the grid.
 class STARFieldXYZ : public genfit::AbsBField
 {
 public:
 
-  STARFieldXYZ()
-  {
-    LOG_F( INFO, "Loading STAR Magnetic Field map" );
-    fField = new TFile( "FieldOnXYZ.root" );
-
-    hFieldX   = (TH3 *)fField->Get( "fieldX" );
-    hFieldY = (TH3 *)fField->Get( "fieldY" );
-    hFieldZ   = (TH3 *)fField->Get( "fieldZ" );
-  }
+  STARFieldXYZ() {}
   virtual ~STARFieldXYZ() {;}
 
   virtual void get(const double &x, const double &y, const double &z, double &Bx, double &By, double &Bz) const
@@ -74,6 +85,7 @@ public:
 
   virtual TVector3 get(const TVector3 &position) const
   {
+    std::call_once( loaded, [this]() { load(); } );
     assert( hFieldX != nullptr );
     assert( hFieldY != nullptr );
     assert( hFieldZ != nullptr );
@@ -84,8 +96,240 @@ public:
     return B;
   }
 
-  TFile *fField = nullptr;
-  TH3 *hFieldZ, *hFieldX, *hFieldY;
+  // identifies the map file by its size and modification time
+  static std::string fileKey( const std::string &file = "FieldOnXYZ.root" )
+  {
+    struct stat st;
+    if ( stat( file.c_str(), &st ) != 0 )
+      return file + " missing";
+    return file + " " + std::to_string( (long long)st.st_size ) + " " + std::to_string( (long long)st.st_mtime );
+  }
+
+  mutable TFile *fField = nullptr;
+  mutable TH3 *hFieldZ = nullptr, *hFieldX = nullptr, *hFieldY = nullptr;
+
+protected:
+  void load() const
+  {
+    LOG_F( INFO, "Loading STAR Magnetic Field map" );
+    fField = new TFile( "FieldOnXYZ.root" );
+
+    hFieldX   = (TH3 *)fField->Get( "fieldX" );
+    hFieldY = (TH3 *)fField->Get( "fieldY" );
+    hFieldZ   = (TH3 *)fField->Get( "fieldZ" );
+  }
+
+  mutable std::once_flag loaded;
+};
+
+//_______________________________________________________________________________________
+// Field of another provider sampled on a regular (x, y, z) grid at construction and served
+// by trilinear interpolation, points outside the grid are passed to the source. Each thread
+// keeps the corners of the last cell it used, so the steps of a track within one cell do
+// not read the grid again.
+//
+// With a cache file the grid is mapped read-only from it (shared by all processes on the
+// node through the page cache) instead of being sampled. The file holds a versioned header
+// with the grid geometry, a key describing the field (source, scale, map file) and a
+// checksum of the values. It is rewritten if any of these do not match.
+class STARFieldGrid : public genfit::AbsBField
+{
+public:
+
+  STARFieldGrid( genfit::AbsBField *_source, double rMax, double zMin, double zMax, double _step, const std::string &cacheFile = "", const std::string &key = "" ) : source( _source ), step( _step )
+  {
+    static std::atomic<uint64_t> nGrids( 0 );
+    id = ++nGrids;
+    inv = 1.0 / step;
+    x0 = -rMax;
+    y0 = -rMax;
+    z0 = zMin;
+    nx = ny = (size_t)std::ceil( 2 * rMax / step ) + 1;
+    nz = (size_t)std::ceil( (zMax - zMin) / step ) + 1;
+
+    if ( !cacheFile.empty() && mapCache( cacheFile, key ) ) {
+      LOG_F( INFO, "Field grid %lu x %lu x %lu mapped from %s", nx, ny, nz, cacheFile.c_str() );
+      return;
+    }
+
+    storage.resize( 3 * nx * ny * nz );
+    double bx, by, bz;
+    for ( size_t iz = 0; iz < nz; iz++ ) {
+      for ( size_t iy = 0; iy < ny; iy++ ) {
+        for ( size_t ix = 0; ix < nx; ix++ ) {
+          source->get( x0 + ix * step, y0 + iy * step, z0 + iz * step, bx, by, bz );
+          float *c = &storage[ 3 * ( (iz * ny + iy) * nx + ix ) ];
+          c[0] = bx;
+          c[1] = by;
+          c[2] = bz;
+        }
+      }
+    }
+    b = storage.data();
+    LOG_F( INFO, "Field grid %lu x %lu x %lu (step %0.1f cm, %0.1f MB)", nx, ny, nz, step, storage.size() * sizeof(float) / 1e6 );
+
+    // share the new cache with the next jobs, and map it in this one as well
+    if ( !cacheFile.empty() && writeCache( cacheFile, key ) && mapCache( cacheFile, key ) ) {
+      std::vector<float>().swap( storage );
+      LOG_F( INFO, "Field grid written to %s", cacheFile.c_str() );
+    }
+  }
+  virtual ~STARFieldGrid()
+  {
+    if ( mapped != nullptr )
+      munmap( mapped, mappedSize );
+  }
+
+  virtual TVector3 get(const TVector3 &position) const
+  {
+    double bx, by, bz;
+    get( position.X(), position.Y(), position.Z(), bx, by, bz );
+    return TVector3( bx, by, bz );
+  }
+
+  virtual void get(const double &x, const double &y, const double &z, double &Bx, double &By, double &Bz) const
+  {
+    double fx = (x - x0) * inv, fy = (y - y0) * inv, fz = (z - z0) * inv;
+    // the cell needs its upper corners, NaN positions fail the test as well
+    if ( !(fx >= 0 && fy >= 0 && fz >= 0 && fx < nx - 1 && fy < ny - 1 && fz < nz - 1) ) {
+      source->get( x, y, z, Bx, By, Bz );
+      return;
+    }
+    size_t ix = (size_t)fx, iy = (size_t)fy, iz = (size_t)fz;
+    double tx = fx - ix, ty = fy - iy, tz = fz - iz;
+
+    static thread_local Cell cell;
+    size_t index = (iz * ny + iy) * nx + ix;
+    if ( cell.owner != id || cell.index != index ) {
+      for ( int c = 0; c < 8; c++ ) {
+        const float *v = &b[ 3 * ( index + (c & 1) + ((c >> 1) & 1) * nx + (c >> 2) * nx * ny ) ];
+        cell.b[c][0] = v[0];
+        cell.b[c][1] = v[1];
+        cell.b[c][2] = v[2];
+      }
+      cell.owner = id;
+      cell.index = index;
+    }
+
+    double w[8];
+    for ( int c = 0; c < 8; c++ )
+      w[c] = ( (c & 1) ? tx : 1 - tx ) * ( ((c >> 1) & 1) ? ty : 1 - ty ) * ( (c >> 2) ? tz : 1 - tz );
+    Bx = By = Bz = 0;
+    for ( int c = 0; c < 8; c++ ) {
+      Bx += w[c] * cell.b[c][0];
+      By += w[c] * cell.b[c][1];
+      Bz += w[c] * cell.b[c][2];
+    }
+  }
+
+  // largest |B_grid - B_source| at nPoints random points inside the grid
+  double maxDeviation( size_t nPoints ) const
+  {
+    std::mt19937 rng( 1 );
+    std::uniform_real_distribution<double> u( 0, 1 );
+    double maxDev = 0;
+    for ( size_t i = 0; i < nPoints; i++ ) {
+      double x = x0 + u( rng ) * (nx - 1) * step, y = y0 + u( rng ) * (ny - 1) * step, z = z0 + u( rng ) * (nz - 1) * step;
+      double bx, by, bz, sx, sy, sz;
+      get( x, y, z, bx, by, bz );
+      source->get( x, y, z, sx, sy, sz );
+      maxDev = std::max( maxDev, std::sqrt( (bx - sx) * (bx - sx) + (by - sy) * (by - sy) + (bz - sz) * (bz - sz) ) );
+    }
+    return maxDev;
+  }
+
+  static const uint32_t kCacheVersion = 1;
+
+protected:
+  struct Cell {
+    uint64_t owner = 0; // id of the grid, a new grid may reuse the address of a deleted one
+    size_t index = 0;
+    float b[8][3];
+  };
+
+  struct CacheHeader {
+    char magic[8];        // "FWDBGRID"
+    uint32_t version;     // kCacheVersion
+    uint32_t headerSize;
+    double x0, y0, z0, step;
+    uint64_t nx, ny, nz;
+    char key[256];        // field source, scale and map file
+    uint64_t checksum;    // of the grid values
+  };
+
+  CacheHeader headerFor( const std::string &key ) const
+  {
+    CacheHeader h;
+    memset( &h, 0, sizeof(h) );
+    memcpy( h.magic, "FWDBGRID", 8 );
+    h.version = kCacheVersion;
+    h.headerSize = sizeof(CacheHeader);
+    h.x0 = x0;
+    h.y0 = y0;
+    h.z0 = z0;
+    h.step = step;
+    h.nx = nx;
+    h.ny = ny;
+    h.nz = nz;
+    strncpy( h.key, key.c_str(), sizeof(h.key) - 1 );
+    return h;
+  }
+
+  // maps the cache file if it matches this grid and key, false otherwise
+  bool mapCache( const std::string &file, const std::string &key )
+  {
+    int fd = open( file.c_str(), O_RDONLY );
+    if ( fd < 0 )
+      return false;
+    struct stat st;
+    size_t nValues = 3 * nx * ny * nz;
+    size_t size = sizeof(CacheHeader) + nValues * sizeof(float);
+    if ( fstat( fd, &st ) != 0 || (size_t)st.st_size != size ) {
+      LOG_F( WARNING, "Field grid cache %s does not match the grid, regenerating", file.c_str() );
+      close( fd );
+      return false;
+    }
+    void *m = mmap( nullptr, size, PROT_READ, MAP_SHARED, fd, 0 );
+    close( fd );
+    if ( m == MAP_FAILED )
+      return false;
+
+    const CacheHeader *h = static_cast<const CacheHeader *>( m );
+    CacheHeader expected = headerFor( key );
+    const float *values = reinterpret_cast<const float *>( static_cast<const char *>( m ) + sizeof(CacheHeader) );
+    bool same = memcmp( h, &expected, offsetof( CacheHeader, checksum ) ) == 0;
+    if ( !same || h->checksum != FwdCacheFile::checksum( values, nValues * sizeof(float) ) ) {
+      LOG_F( WARNING, "Field grid cache %s is %s, regenerating", file.c_str(), same ? "corrupt" : "for another field or version" );
+      munmap( m, size );
+      return false;
+    }
+
+    if ( mapped != nullptr )
+      munmap( mapped, mappedSize );
+    mapped = m;
+    mappedSize = size;
+    b = values;
+    return true;
+  }
+
+  // writes the grid to the cache file, replacing it at once
+  bool writeCache( const std::string &file, const std::string &key ) const
+  {
+    size_t size = 3 * nx * ny * nz * sizeof(float);
+    CacheHeader h = headerFor( key );
+    h.checksum = FwdCacheFile::checksum( b, size );
+    return FwdCacheFile::write( file, &h, sizeof(h), b, size, "field grid cache" );
+  }
+
+  genfit::AbsBField *source;
+  uint64_t id;
+  double step, inv;
+  double x0, y0, z0;
+  size_t nx, ny, nz;
+  const float *b = nullptr;   // (bx, by, bz) per grid point, x fastest
+  std::vector<float> storage; // the values when they are not mapped
+  void *mapped = nullptr;
+  size_t mappedSize = 0;
 };
 
 }
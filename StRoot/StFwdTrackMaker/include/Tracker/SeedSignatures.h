@@ -0,0 +1,116 @@
+#ifndef SEED_SIGNATURES_H
+#define SEED_SIGNATURES_H
+
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "StFwdTrackMaker/include/Tracker/FwdHit.h"
+#include "StFwdTrackMaker/include/Tracker/ParallelUtils.h"
+
+/**
+ * Hit signatures of the candidate seeds, for the compatibility test of the subset NN.
+ *
+ * Each seed's hits are encoded once as a sorted array of dense hit indices, and each
+ * hit keeps the list of seeds using it; the subset solvers work from these lists.
+ *
+ * For the Hopfield network over all seeds, which asks for the compatibility (no shared
+ * hit) of every pair, buildMatrix() also stores it as bit rows: a row starts with all
+ * bits set and only the seeds met through the hits of that seed are cleared. Rows are
+ * filled in contiguous blocks, one per thread. The matrix takes n^2 bits, so it is
+ * only built on request; without it compatible() merges the two hit lists.
+ */
+class SeedSignatures {
+  public:
+    SeedSignatures(const std::vector<Seed_t> &seeds) : n(seeds.size()) {
+        // dense hit indices and the seeds using each hit
+        std::unordered_map<unsigned int, unsigned int> denseOf;
+        offset.reserve(n + 1);
+        offset.push_back(0);
+        for (size_t i = 0; i < n; i++) {
+            for (KiTrack::IHit *h : seeds[i]) {
+                auto it = denseOf.insert(std::make_pair(static_cast<FwdHit *>(h)->_id, (unsigned int)seedsOfHit.size())).first;
+                if (it->second == seedsOfHit.size())
+                    seedsOfHit.push_back(std::vector<unsigned int>());
+                seedsOfHit[it->second].push_back(i);
+                hits.push_back(it->second);
+            }
+            std::sort(hits.begin() + offset.back(), hits.end());
+            offset.push_back(hits.size());
+        }
+    }
+
+    // stores the compatibility of all seed pairs
+    void buildMatrix(size_t nThreads = 1) {
+        words = (n + 63) / 64;
+        matrix.assign(n * words, ~uint64_t(0));
+        // each chunk owns whole rows, so no two threads write the same word
+        ParallelUtils::parallelFor(n, ParallelUtils::nThreads(nThreads), [&](size_t begin, size_t end, size_t) {
+            for (size_t i = begin; i < end; i++) {
+                uint64_t *row = &matrix[i * words];
+                if (n % 64)
+                    row[words - 1] = (uint64_t(1) << (n % 64)) - 1;
+                for (size_t k = offset[i]; k < offset[i + 1]; k++) {
+                    for (unsigned int j : seedsOfHit[hits[k]])
+                        row[j / 64] &= ~(uint64_t(1) << (j % 64));
+                }
+            }
+        }, 256);
+    }
+
+    size_t size() const { return n; }
+
+    // true if seeds a and b share no hit
+    inline bool compatible(size_t a, size_t b) const {
+        if (!matrix.empty())
+            return (matrix[a * words + b / 64] >> (b % 64)) & 1;
+        const unsigned int *i = hitsBegin(a), *j = hitsBegin(b);
+        while (i != hitsEnd(a) && j != hitsEnd(b)) {
+            if (*i == *j)
+                return false;
+            if (*i < *j)
+                i++;
+            else
+                j++;
+        }
+        return true;
+    }
+
+    // the seeds using each dense hit index
+    const std::vector<std::vector<unsigned int>> &seedsOfHits() const { return seedsOfHit; }
+
+    // sorted dense hit indices of seed i
+    const unsigned int *hitsBegin(size_t i) const { return hits.data() + offset[i]; }
+    const unsigned int *hitsEnd(size_t i) const { return hits.data() + offset[i + 1]; }
+
+  protected:
+    size_t n;
+    size_t words = 0;
+    std::vector<unsigned int> hits;   // sorted dense hit indices of all seeds
+    std::vector<size_t> offset;       // seed i owns hits[offset[i] ... offset[i+1])
+    std::vector<std::vector<unsigned int>> seedsOfHit;
+    std::vector<uint64_t> matrix;     // n rows of words, bit j of row i = compatible(i, j), empty until buildMatrix()
+};
+
+// SubsetHopfieldNN functors over seed indices
+class SeedIndexCompare {
+  public:
+    SeedIndexCompare(const SeedSignatures &_signatures) : signatures(_signatures) {}
+    inline bool operator()(size_t a, size_t b) { return signatures.compatible(a, b); }
+
+  protected:
+    const SeedSignatures &signatures;
+};
+
+class SeedIndexQual {
+  public:
+    SeedIndexQual(const std::vector<Seed_t> &_seeds) : seeds(_seeds) {}
+    inline double operator()(size_t i) { return quality(seeds[i]); }
+
+  protected:
+    const std::vector<Seed_t> &seeds;
+    SeedQual quality;
+};
+
+#endif
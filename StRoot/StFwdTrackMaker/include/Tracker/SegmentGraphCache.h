@@ -0,0 +1,171 @@
+#ifndef SEGMENT_GRAPH_CACHE_H
+#define SEGMENT_GRAPH_CACHE_H
+
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "Criteria/ICriterion.h"
+#include "KiTrack/Automaton.h"
+#include "KiTrack/IHit.h"
+#include "KiTrack/Segment.h"
+
+#include "StFwdTrackMaker/XmlConfig/XmlConfig.h"
+#include "StFwdTrackMaker/include/Tracker/CriteriaPipeline.h"
+#include "StFwdTrackMaker/include/Tracker/FwdHit.h"
+#include "StFwdTrackMaker/include/Tracker/FwdSegmentBuilder.h"
+
+/**
+ * Keeps the 2-hit segment graph (1-hit segment connections) of each phi slice from one
+ * tracking iteration to the next within an event.
+ *
+ * Hits are only ever removed between iterations, so with the same connector and
+ * criteria the previous connections minus those touching removed hits are exactly
+ * the new ones. If the criteria are tighter (the same or more criteria, every range
+ * inside the previous one) the cached connections are filtered through the new
+ * criteria instead of scanning all pairs again. If they are looser (the same criteria,
+ * every range containing the previous one) the cached connections are all kept and
+ * FwdSegmentBuilder::getNewConnections adds the pairs admitted by the wider ranges.
+ * Other changes of the criteria, or a different slice, need a full rebuild.
+ */
+class SegmentGraphCache {
+  public:
+    typedef std::pair<unsigned int, unsigned int> Connection; // (parent hit id, child hit id)
+    typedef std::pair<float, float> SliceKey;                 // (phi min, phi max)
+
+    enum Reuse { kRebuild = 0,
+                 kSame,
+                 kTighter,
+                 kLooser };
+
+    // forget all slices, at the start of every event
+    void clear() { slices.clear(); }
+
+    // the (min, max) of the active criteria under path, like ForwardTrackMaker::loadCriteria
+    static CriteriaPipeline::CutValues cutsOf(jdb::XmlConfig &cfg, std::string path, float tighten = 1) {
+        CriteriaPipeline::CutValues cuts;
+        for (std::string p : cfg.childrenOf(path)) {
+            if (false == cfg.get<bool>(p + ":active", true))
+                continue;
+            cuts[cfg.get<std::string>(p + ":name")] = CriteriaPipeline::tightened(cfg.get<float>(p + ":min", 0), cfg.get<float>(p + ":max", 1), tighten);
+        }
+        return cuts;
+    }
+
+    // how the graph cached for this slice can be used with the given criteria and connector
+    Reuse reuseFor(const SliceKey &slice, const CriteriaPipeline::CutValues &cuts, unsigned int distance) const {
+        auto it = slices.find(slice);
+        if (it == slices.end() || it->second.distance != distance)
+            return kRebuild;
+
+        const CriteriaPipeline::CutValues &previous = it->second.cuts;
+        if (previous == cuts)
+            return kSame;
+
+        // every previous criterion must still be there, with a range inside (or around) the previous one
+        bool tighter = true, looser = previous.size() == cuts.size();
+        for (auto &kv : previous) {
+            auto c = cuts.find(kv.first);
+            if (c == cuts.end())
+                return kRebuild;
+            tighter = tighter && c->second.first >= kv.second.first && c->second.second <= kv.second.second;
+            looser = looser && c->second.first <= kv.second.first && c->second.second >= kv.second.second;
+        }
+        return tighter ? kTighter : (looser ? kLooser : kRebuild);
+    }
+
+    /** The cached connections of this slice between hits still in the hitmap, as hitmap
+     * (sector, index) pairs. With kTighter they must also pass crits, with kLooser the
+     * widener (built on the same hitmap with the new criteria) adds the new pairs.
+     */
+    template <typename F>
+    size_t restore(const SliceKey &slice, Reuse reuse, std::map<int, std::vector<KiTrack::IHit *>> &hitmap, std::vector<KiTrack::ICriterion *> crits, F connect, FwdSegmentBuilder *widener = nullptr) {
+        const Entry &entry = slices.at(slice);
+
+        // where every remaining hit sits in the hitmap
+        std::unordered_map<unsigned int, std::pair<int, size_t>> where;
+        for (auto &kv : hitmap) {
+            for (size_t i = 0; i < kv.second.size(); i++)
+                where[static_cast<FwdHit *>(kv.second[i])->_id] = std::make_pair(kv.first, i);
+        }
+
+        std::map<int, std::vector<KiTrack::Segment *>> segments;
+        if (reuse == kTighter) {
+            for (auto &kv : hitmap) {
+                for (KiTrack::IHit *h : kv.second) {
+                    KiTrack::Segment *seg = new KiTrack::Segment(std::vector<KiTrack::IHit *>(1, h));
+                    seg->setLayer(h->getLayer());
+                    segments[kv.first].push_back(seg);
+                }
+            }
+        }
+
+        size_t n = 0;
+        for (const Connection &c : entry.connections) {
+            auto parent = where.find(c.first);
+            auto child = where.find(c.second);
+            if (parent == where.end() || child == where.end())
+                continue;
+
+            bool pass = true;
+            for (size_t k = 0; reuse == kTighter && k < crits.size() && pass; k++)
+                pass = crits[k]->areCompatible(segments[parent->second.first][parent->second.second], segments[child->second.first][child->second.second]);
+            if (!pass)
+                continue;
+
+            connect(parent->second.first, parent->second.second, child->second.first, child->second.second);
+            n++;
+        }
+
+        for (auto &kv : segments) {
+            for (KiTrack::Segment *seg : kv.second)
+                delete seg;
+        }
+
+        if (reuse == kLooser && widener != nullptr)
+            n += widener->getNewConnections(entry.cuts, connect);
+        return n;
+    }
+
+    void store(const SliceKey &slice, const CriteriaPipeline::CutValues &cuts, unsigned int distance, std::vector<Connection> connections) {
+        Entry &entry = slices[slice];
+        entry.cuts = cuts;
+        entry.distance = distance;
+        entry.connections.swap(connections);
+    }
+
+    // restore as a 1-hit segment automaton, like the one built by KiTrack::SegmentBuilder
+    KiTrack::Automaton restoreAutomaton(const SliceKey &slice, Reuse reuse, std::map<int, std::vector<KiTrack::IHit *>> &hitmap, std::vector<KiTrack::ICriterion *> crits, FwdSegmentBuilder *widener = nullptr) {
+        KiTrack::Automaton automaton;
+        std::map<int, std::vector<KiTrack::Segment *>> segments;
+        for (auto &kv : hitmap) {
+            for (KiTrack::IHit *h : kv.second) {
+                KiTrack::Segment *seg = new KiTrack::Segment(std::vector<KiTrack::IHit *>(1, h));
+                seg->setLayer(h->getLayer());
+                segments[kv.first].push_back(seg);
+                automaton.addSegment(seg);
+            }
+        }
+
+        restore(slice, reuse, hitmap, crits, [&](int sector, size_t ia, int target, size_t ib) {
+            KiTrack::Segment *parent = segments[sector][ia];
+            KiTrack::Segment *child = segments[target][ib];
+            parent->addChild(child);
+            child->addParent(parent);
+        }, widener);
+        return automaton;
+    }
+
+  protected:
+    struct Entry {
+        CriteriaPipeline::CutValues cuts;
+        unsigned int distance;
+        std::vector<Connection> connections;
+    };
+
+    std::map<SliceKey, Entry> slices;
+};
+
+#endif
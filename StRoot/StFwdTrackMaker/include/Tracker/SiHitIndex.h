@@ -0,0 +1,116 @@
+#ifndef SI_HIT_INDEX_H
+#define SI_HIT_INDEX_H
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+#include <vector>
+
+#include "KiTrack/IHit.h"
+#include "StFwdTrackMaker/include/Tracker/FwdHit.h"
+
+/**
+ * (r, phi) grid of the hits on one Si disk, with cells of the strip pitch.
+ *
+ * Each hit gets its r and phi once at build time, the hits are then sorted by cell
+ * (counting sort) so a search window only visits the cells it overlaps, wrapping
+ * around in phi. The hits are also indexed by MC track id.
+ */
+class SiHitIndex {
+  public:
+    SiHitIndex(double _rPitch = 3.0, double _phiPitch = 0.004) : rPitch(_rPitch) {
+        nPhi = std::max<size_t>(1, (size_t)std::ceil(2 * M_PI / _phiPitch));
+        phiPitch = 2 * M_PI / nPhi;
+    }
+
+    void build(const std::vector<KiTrack::IHit *> &hits) {
+        size_t n = hits.size();
+        r.resize(n);
+        phi.resize(n);
+        double rMax = 0;
+        for (size_t i = 0; i < n; i++) {
+            r[i] = std::sqrt(hits[i]->getX() * hits[i]->getX() + hits[i]->getY() * hits[i]->getY());
+            phi[i] = std::atan2(hits[i]->getY(), hits[i]->getX());
+            rMax = std::max(rMax, r[i]);
+        }
+        nR = (size_t)(rMax / rPitch) + 1;
+
+        // counting sort by cell, hits keep their order within a cell
+        std::vector<size_t> cellOf(n);
+        first.assign(nR * nPhi + 1, 0);
+        for (size_t i = 0; i < n; i++) {
+            cellOf[i] = cell(rBin(r[i]), phiBin(phi[i]));
+            first[cellOf[i] + 1]++;
+        }
+        for (size_t c = 0; c < nR * nPhi; c++)
+            first[c + 1] += first[c];
+        order.resize(n);
+        std::vector<size_t> next(first.begin(), first.end() - 1);
+        for (size_t i = 0; i < n; i++)
+            order[next[cellOf[i]]++] = i;
+
+        this->hits = hits;
+        byTrack.clear();
+        for (size_t i = 0; i < n; i++) {
+            FwdHit *fh = dynamic_cast<FwdHit *>(hits[i]);
+            if (fh != nullptr)
+                byTrack.insert(std::make_pair(fh->_tid, hits[i])); // keeps the first hit of a track
+        }
+    }
+
+    /** Hits with |r - r0| < dr and |phi - phi0| < dphi (wrapped), in their input order
+     */
+    std::vector<KiTrack::IHit *> find(double r0, double phi0, double dr, double dphi) const {
+        std::vector<size_t> found;
+        if (hits.empty())
+            return {};
+        long r1 = std::max(0L, (long)std::floor((r0 - dr) / rPitch));
+        long r2 = std::min((long)nR - 1, (long)std::floor((r0 + dr) / rPitch));
+        long p1 = (long)std::floor((phi0 - dphi + M_PI) / phiPitch);
+        long p2 = (long)std::floor((phi0 + dphi + M_PI) / phiPitch);
+        if (p2 - p1 + 1 >= (long)nPhi) { // the window covers all of phi
+            p1 = 0;
+            p2 = nPhi - 1;
+        }
+
+        for (long ir = r1; ir <= r2; ir++) {
+            for (long ip = p1; ip <= p2; ip++) {
+                size_t c = cell(ir, ((ip % (long)nPhi) + nPhi) % nPhi);
+                for (size_t k = first[c]; k < first[c + 1]; k++) {
+                    size_t i = order[k];
+                    double d = std::fabs(phi[i] - phi0);
+                    if (d > M_PI)
+                        d = 2 * M_PI - d;
+                    if (std::fabs(r[i] - r0) < dr && d < dphi)
+                        found.push_back(i);
+                }
+            }
+        }
+
+        std::sort(found.begin(), found.end());
+        std::vector<KiTrack::IHit *> result;
+        for (size_t i : found)
+            result.push_back(hits[i]);
+        return result;
+    }
+
+    // first hit of an MC track, null if none
+    KiTrack::IHit *findTrack(int tid) const {
+        auto it = byTrack.find(tid);
+        return it == byTrack.end() ? nullptr : it->second;
+    }
+
+  protected:
+    size_t rBin(double rv) const { return std::min(nR - 1, (size_t)(rv / rPitch)); }
+    size_t phiBin(double p) const { return std::min(nPhi - 1, (size_t)((p + M_PI) / phiPitch)); }
+    size_t cell(size_t ir, size_t ip) const { return ir * nPhi + ip; }
+
+    double rPitch, phiPitch;
+    size_t nR = 1, nPhi = 1;
+    std::vector<KiTrack::IHit *> hits;
+    std::vector<double> r, phi;        // per hit
+    std::vector<size_t> first, order; // hits of cell c are order[first[c] .. first[c+1])
+    std::unordered_map<int, KiTrack::IHit *> byTrack;
+};
+
+#endif
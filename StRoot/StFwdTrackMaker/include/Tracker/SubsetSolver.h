@@ -0,0 +1,256 @@
+#ifndef SUBSET_SOLVER_H
+#define SUBSET_SOLVER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <numeric>
+#include <unordered_set>
+#include <vector>
+
+#include "StFwdTrackMaker/include/Tracker/FwdHit.h"
+#include "StFwdTrackMaker/include/Tracker/ParallelUtils.h"
+#include "StFwdTrackMaker/include/Tracker/SeedSignatures.h"
+
+/**
+ * Subset selection by conflict-graph components.
+ *
+ * Seeds sharing a hit are in conflict; the conflict graph is split into connected
+ * components (union-find over the seeds of every hit), which are independent problems.
+ * Components up to exactMax seeds (at most kExactLimit) are solved exactly as a
+ * maximum-weight independent set with SeedQual weights: branch and bound over bit masks,
+ * starting from the greedy solution and bounded by a clique cover of the remaining
+ * candidates (at most one seed of a clique can be taken). Larger ones go to the
+ * large-component solver if one is set (e.g. the Hopfield network), or are solved
+ * greedily by decreasing quality otherwise. Only the seeds of every hit are used, the
+ * compatibility matrix of SeedSignatures is not needed.
+ *
+ * The exact and greedy solutions are deterministic and components are solved in
+ * parallel; the large-component solver is called from a single thread.
+ */
+class SubsetSolver {
+  public:
+    // returns the accepted seeds (global indices) of one component
+    typedef std::function<std::vector<size_t>(const std::vector<size_t> &)> LargeSolver;
+
+    SubsetSolver(const std::vector<Seed_t> &_seeds, const SeedSignatures &_signatures) : seeds(_seeds), signatures(_signatures) {}
+
+    // the exact search is exponential in the worst case, so components are capped at kExactLimit
+    static const size_t kExactLimit = 24;
+    void setExactMax(size_t n) { exactMax = n < kExactLimit ? n : kExactLimit; }
+    void setNumThreads(size_t n) { nThreads = ParallelUtils::nThreads(n); }
+    void setLargeSolver(LargeSolver solver) { largeSolver = solver; }
+
+    // returns the accepted flag of every seed
+    std::vector<unsigned char> solve() {
+        const size_t n = seeds.size();
+        SeedQual quality;
+        weight.resize(n);
+        for (size_t i = 0; i < n; i++)
+            weight[i] = quality(seeds[i]);
+
+        findComponents();
+
+        std::vector<unsigned char> accepted(n, 0);
+        std::vector<size_t> large;
+        for (size_t c = 0; c < components.size(); c++) {
+            if (components[c].size() > exactMax)
+                large.push_back(c);
+        }
+        nExact = components.size() - large.size();
+        nLarge = large.size();
+
+        // every component writes only the flags of its own seeds
+        ParallelUtils::parallelFor(components.size(), nThreads, [&](size_t begin, size_t end, size_t) {
+            for (size_t c = begin; c < end; c++) {
+                const std::vector<size_t> &comp = components[c];
+                if (comp.size() == 1)
+                    accepted[comp[0]] = 1;
+                else if (comp.size() <= exactMax)
+                    solveExact(comp, accepted);
+                else if (!largeSolver)
+                    solveGreedy(comp, accepted);
+            }
+        }, 64);
+
+        if (largeSolver) {
+            for (size_t c : large) {
+                for (size_t i : largeSolver(components[c]))
+                    accepted[i] = 1;
+            }
+        }
+        return accepted;
+    }
+
+    size_t nComponents() const { return components.size(); }
+    size_t nExactComponents() const { return nExact; }
+    size_t nLargeComponents() const { return nLarge; }
+    size_t largestComponent() const {
+        size_t m = 0;
+        for (auto &comp : components)
+            m = std::max(m, comp.size());
+        return m;
+    }
+
+  protected:
+    // connected components, each sorted by seed index, ordered by their first seed
+    void findComponents() {
+        const size_t n = seeds.size();
+        std::vector<size_t> parent(n);
+        std::iota(parent.begin(), parent.end(), 0);
+        auto find = [&](size_t i) {
+            while (parent[i] != i) {
+                parent[i] = parent[parent[i]];
+                i = parent[i];
+            }
+            return i;
+        };
+
+        for (auto &users : signatures.seedsOfHits()) {
+            for (size_t k = 1; k < users.size(); k++) {
+                size_t a = find(users[0]), b = find(users[k]);
+                if (a != b)
+                    parent[std::max(a, b)] = std::min(a, b);
+            }
+        }
+
+        components.clear();
+        std::vector<size_t> componentOf(n, n);
+        for (size_t i = 0; i < n; i++) {
+            size_t root = find(i);
+            if (componentOf[root] == n) {
+                componentOf[root] = components.size();
+                components.push_back(std::vector<size_t>());
+            }
+            components[componentOf[root]].push_back(i);
+        }
+    }
+
+    // maximum-weight independent set of a component with at most kExactLimit seeds
+    void solveExact(const std::vector<size_t> &comp, std::vector<unsigned char> &accepted) const {
+        const size_t m = comp.size();
+
+        // best seeds first, so good solutions are found early and the bound prunes more
+        std::vector<size_t> order(comp);
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return weight[a] > weight[b]; });
+
+        // position in the search of each seed of the component (comp is sorted)
+        std::vector<size_t> position(m);
+        for (size_t a = 0; a < m; a++)
+            position[std::lower_bound(comp.begin(), comp.end(), order[a]) - comp.begin()] = a;
+
+        // conflicts from the seeds sharing each hit of a seed, all in the same component
+        ExactSearch search;
+        search.w.resize(m);
+        search.conflict.assign(m, 0);
+        const std::vector<std::vector<unsigned int>> &seedsOfHits = signatures.seedsOfHits();
+        for (size_t a = 0; a < m; a++) {
+            search.w[a] = weight[order[a]];
+            for (const unsigned int *h = signatures.hitsBegin(order[a]); h != signatures.hitsEnd(order[a]); h++) {
+                for (unsigned int j : seedsOfHits[*h]) {
+                    size_t b = position[std::lower_bound(comp.begin(), comp.end(), j) - comp.begin()];
+                    if (b != a)
+                        search.conflict[a] |= uint64_t(1) << b;
+                }
+            }
+        }
+        uint64_t all = (uint64_t(1) << m) - 1;
+        search.greedy(all);
+        search.run(all, 0., 0);
+
+        for (size_t a = 0; a < m; a++) {
+            if ((search.bestSet >> a) & 1)
+                accepted[order[a]] = 1;
+        }
+    }
+
+    struct ExactSearch {
+        std::vector<double> w;
+        std::vector<uint64_t> conflict;
+        double best = -1.;
+        uint64_t bestSet = 0;
+
+        // first solution: candidates by decreasing weight (their order) when not in conflict
+        void greedy(uint64_t candidates) {
+            best = 0;
+            bestSet = 0;
+            while (candidates) {
+                size_t v = lowestBit(candidates);
+                best += w[v];
+                bestSet |= uint64_t(1) << v;
+                candidates &= ~(uint64_t(1) << v) & ~conflict[v];
+            }
+        }
+
+        // upper bound on the weight of the candidates: cover them greedily with cliques of
+        // mutually conflicting seeds, each adds its heaviest (first) seed
+        double bound(uint64_t candidates) const {
+            double b = 0;
+            while (candidates) {
+                size_t v = lowestBit(candidates);
+                b += w[v];
+                uint64_t clique = uint64_t(1) << v;
+                for (uint64_t c = candidates & conflict[v]; c; c &= c - 1) {
+                    size_t u = lowestBit(c);
+                    if ((conflict[u] & clique) == clique)
+                        clique |= uint64_t(1) << u;
+                }
+                candidates &= ~clique;
+            }
+            return b;
+        }
+
+        void run(uint64_t candidates, double value, uint64_t chosen) {
+            if (candidates == 0) {
+                if (value > best + 1e-9) {
+                    best = value;
+                    bestSet = chosen;
+                }
+                return;
+            }
+
+            if (value + bound(candidates) <= best + 1e-9)
+                return;
+
+            size_t v = lowestBit(candidates);
+            uint64_t bit = uint64_t(1) << v;
+            run(candidates & ~bit & ~conflict[v], value + w[v], chosen | bit);
+            run(candidates & ~bit, value, chosen);
+        }
+
+        static size_t lowestBit(uint64_t x) {
+            size_t i = 0;
+            while (!((x >> i) & 1))
+                i++;
+            return i;
+        }
+    };
+
+    // accept by decreasing quality (then index) when none of its hits is used by a seed accepted so far
+    void solveGreedy(const std::vector<size_t> &comp, std::vector<unsigned char> &accepted) const {
+        std::vector<size_t> order(comp);
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return weight[a] > weight[b]; });
+
+        std::unordered_set<unsigned int> used;
+        for (size_t i : order) {
+            bool ok = true;
+            for (const unsigned int *h = signatures.hitsBegin(i); h != signatures.hitsEnd(i) && ok; h++)
+                ok = used.count(*h) == 0;
+            if (ok) {
+                used.insert(signatures.hitsBegin(i), signatures.hitsEnd(i));
+                accepted[i] = 1;
+            }
+        }
+    }
+
+    const std::vector<Seed_t> &seeds;
+    const SeedSignatures &signatures;
+    std::vector<double> weight;
+    std::vector<std::vector<size_t>> components;
+    size_t exactMax = 20;
+    size_t nThreads = 1;
+    size_t nExact = 0, nLarge = 0;
+    LargeSolver largeSolver;
+};
+
+#endif
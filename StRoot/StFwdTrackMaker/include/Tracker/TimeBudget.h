@@ -0,0 +1,168 @@
+#ifndef FWD_TIME_BUDGET_H
+#define FWD_TIME_BUDGET_H
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "StFwdTrackMaker/XmlConfig/XmlConfig.h"
+#include "StFwdTrackMaker/include/Tracker/loguru.h"
+
+/**
+ * Per-event time budget with graceful degradation of the tracking.
+ *
+ * The tracker calls check() at fixed points (before every iteration, phi slice, subset
+ * selection, track fit and the Si refit). When the event or the current stage is over
+ * its deadline, the next degradation action in the configured order is switched on for
+ * the rest of the event. An exceeded stage deadline restarts the stage clock, and after
+ * the event deadline every further action needs another escalateFraction * eventMs, so
+ * the actions are applied one at a time rather than all at once.
+ *
+ * Configured from the <TimeBudget> node:
+ *   active          : enable the budget (default false)
+ *   eventMs         : deadline for the whole event in ms (0 = none)
+ *   findingMs       : deadline for the finding of one iteration in ms (0 = none)
+ *   fittingMs       : deadline for the fitting of one iteration in ms (0 = none)
+ *   escalateFraction: event overrun between two actions, in units of eventMs (default 0.25)
+ *   order           : comma separated actions, applied in this order
+ *                     (default "capCandidates, tightenCriteria, skipIterations, skipSiRefit",
+ *                     skipFits drops the seeds of the iteration not fitted yet)
+ *   tighten         : criteria windows are scaled by this factor (default 0.5)
+ *   maxPathsPerSeed : candidate caps used by capCandidates (defaults 2 and 5000)
+ *   maxCandidates
+ */
+class TimeBudget {
+  public:
+    enum Action { kNone = 0,
+                  kCapCandidates = 1,
+                  kTightenCriteria = 2,
+                  kSkipIterations = 4,
+                  kSkipSiRefit = 8,
+                  kSkipFits = 16 };
+
+    TimeBudget(jdb::XmlConfig &_cfg) : cfg(_cfg) {}
+
+    void setup() {
+        _active = cfg.get<bool>("TimeBudget:active", false);
+        if (!_active)
+            return;
+
+        _eventMs = cfg.get<double>("TimeBudget:eventMs", 0);
+        _stageMs["Finding"] = cfg.get<double>("TimeBudget:findingMs", 0);
+        _stageMs["Fitting"] = cfg.get<double>("TimeBudget:fittingMs", 0);
+        _escalate = std::max(0.0, cfg.get<double>("TimeBudget:escalateFraction", 0.25));
+        _tighten = cfg.get<float>("TimeBudget:tighten", 0.5);
+        _maxPathsPerSeed = cfg.get<size_t>("TimeBudget:maxPathsPerSeed", 2);
+        _maxCandidates = cfg.get<size_t>("TimeBudget:maxCandidates", 5000);
+
+        _order.clear();
+        std::string order = cfg.get<std::string>("TimeBudget:order", "capCandidates, tightenCriteria, skipIterations, skipSiRefit");
+        for (std::string name : cfg.split(order, ',')) {
+            name.erase(std::remove(name.begin(), name.end(), ' '), name.end());
+            Action a = actionOf(name);
+            if (a == kNone) {
+                LOG_F(ERROR, "TimeBudget: unknown action '%s'", name.c_str());
+                continue;
+            }
+            _order.push_back(a);
+        }
+
+        LOG_F(INFO, "TimeBudget (event=%0.0f ms, finding=%0.0f ms, fitting=%0.0f ms, %lu actions)", _eventMs, _stageMs["Finding"], _stageMs["Fitting"], _order.size());
+    }
+
+    bool active() const { return _active; }
+
+    void startEvent() {
+        _eventStart = loguru::now_ns();
+        _degradation = kNone;
+        _nApplied = 0;
+        _stage.clear();
+    }
+
+    // the clock of a stage (Finding or Fitting) restarts with every iteration
+    void startStage(const std::string &stage) {
+        _stage = stage;
+        _stageStart = loguru::now_ns();
+    }
+
+    double elapsedMs() const { return (loguru::now_ns() - _eventStart) * 1e-6; }
+
+    /** Applies the next action if the event or the current stage is over its deadline.
+     * @return true if a new action was switched on
+     */
+    bool check(const char *where) {
+        if (!_active || _nApplied >= _order.size())
+            return false;
+
+        double eventMs = elapsedMs();
+        bool late = _eventMs > 0 && eventMs > _eventMs * (1 + _escalate * _nApplied);
+
+        double stageLimit = _stage.empty() ? 0 : _stageMs[_stage];
+        double stageMs = (loguru::now_ns() - _stageStart) * 1e-6;
+        if (stageLimit > 0 && stageMs > stageLimit) {
+            late = true;
+            _stageStart = loguru::now_ns();
+        }
+        if (!late)
+            return false;
+
+        Action a = _order[_nApplied++];
+        _degradation |= a;
+        LOG_F(WARNING, "TimeBudget: over budget at %s after %0.1f ms (%s %0.1f ms), switching to %s", where, eventMs, _stage.c_str(), stageMs, nameOf(a));
+        return true;
+    }
+
+    bool has(Action a) const { return (_degradation & a) != 0; }
+    // bit mask of the actions applied to this event, 0 if it was tracked in full
+    unsigned int degradation() const { return _degradation; }
+
+    float tighten() const { return has(kTightenCriteria) ? _tighten : 1.0f; }
+    size_t maxPathsPerSeed() const { return _maxPathsPerSeed; }
+    size_t maxCandidates() const { return _maxCandidates; }
+
+    static Action actionOf(const std::string &name) {
+        for (Action a : {kCapCandidates, kTightenCriteria, kSkipIterations, kSkipSiRefit, kSkipFits}) {
+            if (name == nameOf(a))
+                return a;
+        }
+        return kNone;
+    }
+
+    static const char *nameOf(Action a) {
+        switch (a) {
+        case kCapCandidates:
+            return "capCandidates";
+        case kTightenCriteria:
+            return "tightenCriteria";
+        case kSkipIterations:
+            return "skipIterations";
+        case kSkipSiRefit:
+            return "skipSiRefit";
+        case kSkipFits:
+            return "skipFits";
+        default:
+            return "none";
+        }
+    }
+
+  protected:
+    jdb::XmlConfig &cfg;
+    bool _active = false;
+    double _eventMs = 0;
+    double _escalate = 0.25;
+    std::map<std::string, double> _stageMs;
+    float _tighten = 0.5;
+    size_t _maxPathsPerSeed = 2;
+    size_t _maxCandidates = 5000;
+    std::vector<Action> _order;
+
+    long long _eventStart = 0;
+    long long _stageStart = 0;
+    std::string _stage;
+    unsigned int _degradation = kNone;
+    size_t _nApplied = 0;
+};
+
+#endif
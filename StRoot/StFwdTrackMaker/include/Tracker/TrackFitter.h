@@ -31,7 +31,14 @@
 
 #include "StFwdTrackMaker/XmlConfig/HistoBins.h"
 #include "StFwdTrackMaker/XmlConfig/XmlConfig.h"
+#include "StFwdTrackMaker/include/Tracker/Benchmark.h"
 #include "StFwdTrackMaker/include/Tracker/FwdHit.h"
+#include "StFwdTrackMaker/include/Tracker/FwdKalmanBatch.h"
+#include "StFwdTrackMaker/include/Tracker/FwdGeomSnapshot.h"
+#include "StFwdTrackMaker/include/Tracker/FwdKalmanFitter.h"
+#include "StFwdTrackMaker/include/Tracker/FwdMaterialInterface.h"
+#include "StFwdTrackMaker/include/Tracker/FwdTrackProjector.h"
+#include "StFwdTrackMaker/include/Tracker/HelixPreFit.h"
 #include "StFwdTrackMaker/include/Tracker/STARField.h"
 #include "StFwdTrackMaker/include/Tracker/loguru.h"
 #include "StFwdTrackMaker/include/Tracker/FwdGeomUtils.h"
@@ -50,35 +57,90 @@ class TrackFitter {
 
         TGeoManager * gMan = nullptr;
 
+        // compact geometry snapshot, used instead of TGeo when it is up to date
+        std::string geometryFile = cfg.get<string>("Geometry", "fGeom.root");
+        std::string snapshotFile = cfg.get<string>("Geometry:snapshot", "");
+        std::string geometryKey = FwdGeomSnapshot::keyFor(geometryFile);
+        // plane positions from the config move the planes and the material map, so they are part of the key
+        vector<float> siOverride = cfg.getFloatVector("TrackFitter.Geometry:si");
+        vector<float> stgcOverride = cfg.getFloatVector("TrackFitter.Geometry:stgc");
+        if (!geometryKey.empty()) {
+            if (siOverride.size() >= 3)
+                geometryKey += " si=" + cfg.get<string>("TrackFitter.Geometry:si", "");
+            if (stgcOverride.size() >= 4)
+                geometryKey += " stgc=" + cfg.get<string>("TrackFitter.Geometry:stgc", "");
+        }
+        FwdGeomSnapshot snapshot;
+        FwdGeomSnapshot::MaterialParams materialParams;
+        materialParams.planeThickness = cfg.get<double>("TrackFitter.Material:planeThickness", 4);
+        materialParams.zMin = cfg.get<double>("TrackFitter.Material:zMin", 0);
+        materialParams.zMax = cfg.get<double>("TrackFitter.Material:zMax", 720);
+        materialParams.rMax = cfg.get<double>("TrackFitter.Material:rMax", 150);
+        materialParams.nR = cfg.get<size_t>("TrackFitter.Material:nR", 30);
+        materialParams.nPhi = cfg.get<size_t>("TrackFitter.Material:nPhi", 12);
+        // the forward material model needs the detector planes, it is set up with them below
+        materialModel = cfg.get<std::string>("TrackFitter.Material:model", "tgeo");
+        bool useSnapshot = !snapshotFile.empty() && snapshot.load(snapshotFile, geometryKey);
+        if (useSnapshot && materialModel == "forward" && !(snapshot.material == materialParams)) {
+            LOG_F(WARNING, "Geometry snapshot %s has another material binning, regenerating", snapshotFile.c_str());
+            useSnapshot = false;
+        }
+
         {
             LOG_SCOPE_F( INFO, "Setup Geometry in GENFIT" );
-            // gMan = new TGeoManager("Geometry", "Geane geometry");
-            TGeoManager::Import(cfg.get<string>("Geometry", "fGeom.root").c_str());
-            gMan = gGeoManager;
-            genfit::MaterialEffects::getInstance()->init(new genfit::TGeoMaterialInterface());
-            genfit::MaterialEffects::getInstance()->setNoEffects(cfg.get<bool>("TrackFitter::noMaterialEffects", false));
-            if ( cfg.get<bool>("TrackFitter::noMaterialEffects", false) ){
+            // with the forward material model an up to date snapshot replaces the full geometry
+            if (useSnapshot && materialModel == "forward") {
+                LOG_F(INFO, "Geometry from the snapshot %s, TGeo is not loaded", snapshotFile.c_str());
+            } else {
+                // gMan = new TGeoManager("Geometry", "Geane geometry");
+                TGeoManager::Import(geometryFile.c_str());
+                gMan = gGeoManager;
+            }
+            geoManager = gMan;
+            if (materialModel != "forward") {
+                if (materialModel != "tgeo")
+                    LOG_F(ERROR, "Unknown TrackFitter.Material:model '%s', using tgeo", materialModel.c_str());
+                materialInterface = new genfit::TGeoMaterialInterface();
+            }
+            noMaterialEffects = cfg.get<bool>("TrackFitter::noMaterialEffects", false);
+            if ( noMaterialEffects ){
                 LOG_F( WARNING, "MaterialEffects are turned OFF" );
             }
         }
 
         // TODO : Load the STAR MagField
-        genfit::AbsBField *bField = nullptr;
+        bField = nullptr;
+        std::string fieldKey; // identifies the field in the grid cache
 
         if (0 == _gField) {
             if (cfg.get<bool>("TrackFitter:constB", false)) {
                 bField = new genfit::ConstField(0., 0., 5.);
                 LOG_F(INFO, "Using a CONST B FIELD");
+                fieldKey = "const 5";
             } else {
                 bField = new genfit::STARFieldXYZ();
                 LOG_F(INFO, "Using STAR B FIELD");
+                fieldKey = genfit::STARFieldXYZ::fileKey();
             }
         } else {
             LOG_F(INFO, "Using StarMagField interface");
             bField = _gField;
+            fieldKey = "StarMagField " + std::to_string(StarMagField::Instance() ? StarMagField::Instance()->GetFactor() : 0.0);
         }
 
-        genfit::FieldManager::getInstance()->init(bField); // 0.5 T Bz
+        // sample the field once on a grid of the forward region (up to the ECal)
+        if (cfg.get<bool>("TrackFitter.Field:grid", false)) {
+            genfit::STARFieldGrid *grid = new genfit::STARFieldGrid(bField,
+                                                                    cfg.get<double>("TrackFitter.Field:rMax", 150),
+                                                                    cfg.get<double>("TrackFitter.Field:zMin", -50),
+                                                                    cfg.get<double>("TrackFitter.Field:zMax", 720),
+                                                                    cfg.get<double>("TrackFitter.Field:step", 5),
+                                                                    cfg.get<std::string>("TrackFitter.Field:cache", ""),
+                                                                    fieldKey);
+            if (cfg.get<bool>("TrackFitter.Field:validate", false))
+                LOG_F(INFO, "Field grid: max deviation from the source field %0.3g kGauss", grid->maxDeviation(100000));
+            bField = grid;
+        }
 
         makeDisplay = make_display;
 
@@ -110,11 +172,14 @@ class TrackFitter {
         FwdGeomUtils fwdGeoUtils( gMan );
 
         LOG_F( INFO, "Setting up Si planes" );
-        vector<float> SI_DET_Z = cfg.getFloatVector("TrackFitter.Geometry:si");
+        vector<float> SI_DET_Z = siOverride;
         if (SI_DET_Z.size() < 3) {
         
-            // try to read from GEOMETRY
-            if ( fwdGeoUtils.siZ( 0 ) > 1.0 ) { // returns 0.0 on failure
+            // try to read from the snapshot or GEOMETRY
+            if ( useSnapshot && snapshot.planeZ( FwdGeomSnapshot::kSi ).size() >= 3 ) {
+                SI_DET_Z = snapshot.planeZ( FwdGeomSnapshot::kSi );
+                LOG_F( INFO, "From SNAPSHOT : Si Z = %0.2f, %0.2f, %0.2f", SI_DET_Z[0], SI_DET_Z[1], SI_DET_Z[2] );
+            } else if ( fwdGeoUtils.siZ( 0 ) > 1.0 ) { // returns 0.0 on failure
                 SI_DET_Z.clear();
                 SI_DET_Z.push_back( fwdGeoUtils.siZ( 0 ) );
                 SI_DET_Z.push_back( fwdGeoUtils.siZ( 1 ) );
@@ -136,11 +201,21 @@ class TrackFitter {
         }
         useSi = false;
 
+        // fitted tracks are projected onto the Si planes in one pass, from the 2nd fitted point
+        siProjector = FwdTrackProjector(1);
+        for (auto plane : SiDetPlanes)
+            siProjector.addPlane(plane);
+        siStudyPlane = genfit::SharedPlanePtr(new genfit::DetPlane(TVector3(0, 0, 140), TVector3(1, 0, 0), TVector3(0, 1, 0)));
+        ecalPlane = genfit::SharedPlanePtr(new genfit::DetPlane(TVector3(0, 0, 711), TVector3(1, 0, 0), TVector3(0, 1, 0)));
+
         // Now load STGC
-        vector<float> DET_Z = cfg.getFloatVector("TrackFitter.Geometry:stgc");
+        vector<float> DET_Z = stgcOverride;
         if (DET_Z.size() < 4) {
-            // try to read from GEOMETRY
-            if ( fwdGeoUtils.stgcZ( 0 ) > 1.0 ) { // returns 0.0 on failure
+            // try to read from the snapshot or GEOMETRY
+            if ( useSnapshot && snapshot.planeZ( FwdGeomSnapshot::kStgc ).size() >= 4 ) {
+                DET_Z = snapshot.planeZ( FwdGeomSnapshot::kStgc );
+                LOG_F( INFO, "From SNAPSHOT : sTGC Z = %0.2f, %0.2f, %0.2f, %0.2f", DET_Z[0], DET_Z[1], DET_Z[2], DET_Z[3] );
+            } else if ( fwdGeoUtils.stgcZ( 0 ) > 1.0 ) { // returns 0.0 on failure
                 DET_Z.clear();
                 float z_delta = 0.435028;   // not sure why but when loaded from the geom 
                                             // z location is shifted
@@ -166,11 +241,100 @@ class TrackFitter {
             DetPlanes.push_back(genfit::SharedPlanePtr(new genfit::DetPlane(TVector3(0, 0, z), TVector3(1, 0, 0), TVector3(0, 1, 0))));
         }
 
+        FwdMaterialInterface *material = nullptr;
+        if (materialModel == "forward") {
+            LOG_SCOPE_F(INFO, "Forward material model");
+            material = new FwdMaterialInterface();
+            if (useSnapshot) {
+                material->load(snapshot);
+            } else {
+                vector<float> planeZ = SI_DET_Z;
+                planeZ.insert(planeZ.end(), DET_Z.begin(), DET_Z.end());
+                material->build(planeZ, materialParams.planeThickness, materialParams.zMin, materialParams.zMax, materialParams.rMax, materialParams.nR, materialParams.nPhi);
+            }
+        }
+
+        // save a new snapshot for the next jobs
+        if (!snapshotFile.empty() && !useSnapshot && gMan != nullptr) {
+            snapshot = FwdGeomSnapshot();
+            for (size_t i = 0; i < SI_DET_Z.size() + DET_Z.size(); i++) {
+                FwdGeomSnapshot::Plane plane;
+                bool si = i < SI_DET_Z.size();
+                plane.detector = si ? FwdGeomSnapshot::kSi : FwdGeomSnapshot::kStgc;
+                plane.index = si ? i : i - SI_DET_Z.size();
+                plane.o[2] = si ? SI_DET_Z[i] : DET_Z[plane.index];
+                if ((si ? fwdGeoUtils.siZ(plane.index) : fwdGeoUtils.stgcZ(plane.index)) > 1.0)
+                    fwdGeoUtils.axes(plane.u, plane.v);
+                if (si) {
+                    plane.rPitch = cfg.get<double>("SiRasterizer:r", 3.0);
+                    plane.phiPitch = cfg.get<double>("SiRasterizer:phi", 0.004);
+                }
+                snapshot.planes.push_back(plane);
+            }
+            // the material map is only built for the forward model, a snapshot without it is
+            // regenerated by the first job using that model
+            if (material != nullptr) {
+                snapshot.material = materialParams;
+                material->fill(snapshot);
+            }
+            if (snapshot.write(snapshotFile, geometryKey))
+                LOG_F(INFO, "Geometry snapshot written to %s", snapshotFile.c_str());
+        }
+
+        if (materialModel == "forward")
+            materialInterface = material;
+        activate();
+
         // get cfg values
         vertexSigmaXY = cfg.get<float>("TrackFitter.Vertex:sigmaXY", 1);
         vertexSigmaZ = cfg.get<float>("TrackFitter.Vertex:sigmaZ", 30);
         vertexPos = cfg.getFloatVector("TrackFitter.Vertex:pos", 0, 3);
         includeVertexInFit = cfg.get<bool>("TrackFitter.Vertex:includeInFit", false);
+        singleCharge = cfg.get<bool>("TrackFitter:singleCharge", false);
+        chargeAmbiguitySigma = cfg.get<float>("TrackFitter:chargeAmbiguitySigma", 3);
+        preFitSeedState = cfg.get<bool>("TrackFitter.PreFit:active", false) && cfg.get<bool>("TrackFitter.PreFit:seedState", true);
+        siRefitIncremental = cfg.get<bool>("TrackFitter.SiRefit:incremental", false);
+        siRefitSmooth = cfg.get<bool>("TrackFitter.SiRefit:smooth", false);
+
+        // the fixed-size Kalman fitter, used instead of GenFit ("fast") or next to it ("validate")
+        std::string fitterName = cfg.get<std::string>("TrackFitter:fitter", "genfit");
+        fitterMode = kGenFit;
+        if (fitterName == "fast") {
+            // only momenta and fit status, the tracks of StEvent need GenFit
+            if (cfg.get<bool>("TrackFitter.FastKalman:qaOnly", false))
+                fitterMode = kFastKalman;
+            else
+                LOG_F(ERROR, "TrackFitter:fitter = fast makes no tracks for StEvent, it needs TrackFitter.FastKalman:qaOnly = true, using genfit");
+        } else if (fitterName == "validate")
+            fitterMode = kValidateFastKalman;
+        else if (fitterName != "genfit")
+            LOG_F(ERROR, "Unknown TrackFitter:fitter '%s', using genfit", fitterName.c_str());
+        if (fitterMode != kGenFit) {
+            fastFitter = new FwdKalmanFitter([](double x, double y, double z, double &bx, double &by, double &bz) {
+                genfit::FieldManager::getInstance()->getFieldVal(x, y, z, bx, by, bz);
+            });
+            fastFitter->setIterations(cfg.get<size_t>("TrackFitter.FastKalman:maxIterations", 3));
+            fastFitter->setMaxStep(cfg.get<double>("TrackFitter.FastKalman:maxStep", 10));
+            fastFitter->setXOverX0(cfg.get<double>("TrackFitter.FastKalman:xOverX0", 0.01));
+            fastFitter->setConvergence(cfg.get<double>("TrackFitter.FastKalman:convergence", 0.2));
+            LOG_F(INFO, "Fixed-size Kalman fitter: %s", fitterName.c_str());
+        }
+        if (fitterMode == kFastKalman)
+            LOG_F(WARNING, "TrackFitter:fitter = fast is for QA: no GenFit tracks (except for the outliers of batched fits), no Si refit and no StEvent output");
+
+        // batched fast fits of the seeds of an iteration: with the fast fitter they are the
+        // result and the outliers are fitted with GenFit, otherwise they seed the GenFit fits
+        if (cfg.get<bool>("TrackFitter.FastKalman:batch", false)) {
+            batchFitter = new FwdKalmanBatch([](double x, double y, double z, double &bx, double &by, double &bz) {
+                genfit::FieldManager::getInstance()->getFieldVal(x, y, z, bx, by, bz);
+            });
+            batchFitter->setIterations(cfg.get<size_t>("TrackFitter.FastKalman:maxIterations", 3));
+            batchFitter->setMaxStep(cfg.get<double>("TrackFitter.FastKalman:maxStep", 10));
+            batchFitter->setXOverX0(cfg.get<double>("TrackFitter.FastKalman:xOverX0", 0.01));
+            batchFitter->setConvergence(cfg.get<double>("TrackFitter.FastKalman:convergence", 0.2));
+            batchFitter->setBlockSize(cfg.get<size_t>("TrackFitter.FastKalman:blockSize", 256));
+            batchMaxChi2Ndf = cfg.get<float>("TrackFitter.FastKalman:maxChi2Ndf", 10);
+        }
 
         LOG_F(INFO, "vertex pos = (%f, %f, %f)", vertexPos[0], vertexPos[1], vertexPos[2]);
         LOG_F(INFO, "vertex sigma = (%f, %f, %f)", vertexSigmaXY, vertexSigmaXY, vertexSigmaZ);
@@ -242,8 +406,37 @@ class TrackFitter {
         n = "FitDuration";
         hist[n] = new TH1F(n.c_str(), "; Duraton (ms)", 5000, 0, 50000);
 
+        n = "PreFitChi2Ndf";
+        hist[n] = new TH1F(n.c_str(), ";#chi^{2}/ndf (helix pre-fit)", 500, 0, 100);
+        n = "PreFitPt";
+        hist[n] = new TH1F(n.c_str(), ";pT (GeV/c, helix pre-fit)", 500, 0, 10);
+
+        n = "ChargeHypotheses";
+        hist[n] = new TH1F(n.c_str(), ";;# fits", 4, 0, 4);
+        jdb::HistoBins::labelAxis(hist[n]->GetXaxis(), {"Single", "SecondNeeded", "Ambiguous", "Both"});
+
         n = "FailedFitDuration";
         hist[n] = new TH1F(n.c_str(), "; Duraton (ms)", 500, 0, 50000);
+
+        n = "FastKalmanValidation";
+        hist[n] = new TH1F(n.c_str(), ";;# fits", 5, 0, 5);
+        jdb::HistoBins::labelAxis(hist[n]->GetXaxis(), {"SameCharge", "OppositeCharge", "FastFailed", "GenFitFailed", "BothFailed"});
+        n = "FastKalmanDeltaPt";
+        hist[n] = new TH1F(n.c_str(), ";(pT_{fast} - pT_{GenFit}) / pT_{GenFit}", 500, -1, 1);
+        n = "FastKalmanDeltaEta";
+        hist[n] = new TH1F(n.c_str(), ";#eta_{fast} - #eta_{GenFit}", 500, -0.1, 0.1);
+        n = "FastKalmanChi2Ndf";
+        hist[n] = new TH1F(n.c_str(), ";#chi^{2}/ndf (fast Kalman)", 500, 0, 100);
+        n = "FastKalmanDuration";
+        hist[n] = new TH1F(n.c_str(), "; Duraton (ms)", 5000, 0, 50);
+        n = "FastKalmanBatch";
+        hist[n] = new TH1F(n.c_str(), ";;# seeds", 3, 0, 3);
+        jdb::HistoBins::labelAxis(hist[n]->GetXaxis(), {"Batched", "Outlier", "NotBatched"});
+
+        n = "SiUpdateChi2";
+        hist[n] = new TH1F(n.c_str(), ";#Delta#chi^{2} of the Si hits;# tracks", 500, 0, 100);
+        n = "SiUpdateDuration";
+        hist[n] = new TH1F(n.c_str(), "; Duraton (ms)", 5000, 0, 50);
     }
 
     void writeHistograms() {
@@ -284,6 +477,241 @@ class TrackFitter {
         return curv;
     }
 
+    // circle radii through the hit triplets of the last sTGC planes, 0 for missing planes
+    vector<float> seedCurvatures(const vector<KiTrack::IHit *> &trackCand) {
+        std::map<size_t, size_t> vol_map; // maps from <key=vol_id> to <value=index in trackCand>
+        for (size_t i = 0; i < 13; i++)
+            vol_map[i] = -1;
+        for (size_t i = 0; i < trackCand.size(); i++)
+            vol_map[abs(static_cast<FwdHit *>(trackCand[i])->_vid)] = i;
+
+        // enumerate the partitions
+        // 12 11 10
+        // 12 11 9
+        // 12 10 9
+        // 11 10 9
+        vector<float> curvs;
+        curvs.push_back(fitSimpleCircle(trackCand, vol_map[12], vol_map[11], vol_map[10]));
+        curvs.push_back(fitSimpleCircle(trackCand, vol_map[12], vol_map[11], vol_map[9]));
+        curvs.push_back(fitSimpleCircle(trackCand, vol_map[12], vol_map[10], vol_map[9]));
+        curvs.push_back(fitSimpleCircle(trackCand, vol_map[11], vol_map[10], vol_map[9]));
+        return curvs;
+    }
+
+    /** seedCurvatures() of every seed, used by seedState() until clearSeedCache(), so
+     * seeds ranked by their curvature before fitting get it computed once
+     */
+    const std::map<vector<KiTrack::IHit *>, vector<float>> &cacheSeedCurvatures(const std::vector<Seed_t> &seeds) {
+        curvatureCache.clear();
+        for (const Seed_t &seed : seeds)
+            curvatureCache[seed] = seedCurvatures(seed);
+        return curvatureCache;
+    }
+    // forgets the curvatures and pre-fits of the seeds, once they are fitted
+    void clearSeedCache() {
+        curvatureCache.clear();
+        preFitCache.clear();
+    }
+
+    // analytic helix fit of the seed hits, see HelixPreFit.h
+    HelixPreFit::Result preFit(const vector<KiTrack::IHit *> &trackCand) {
+        std::vector<HelixPreFit::Point> points;
+        for (KiTrack::IHit *h : trackCand) {
+            const TMatrixDSym &cov = static_cast<FwdHit *>(h)->_covmat;
+            points.push_back(HelixPreFit::Point{h->getX(), h->getY(), h->getZ(), 0.5 * (cov(0, 0) + cov(1, 1))});
+        }
+        if (points.empty())
+            return HelixPreFit::Result();
+        const HelixPreFit::Point &mid = points[points.size() / 2];
+        double bz = genfit::FieldManager::getInstance()->getFieldVal(TVector3(mid.x, mid.y, mid.z)).Z();
+        return HelixPreFit::fit(points, bz);
+    }
+
+    // preFit() computed once per seed until clearSeedCache(), for the gate, the batch and the seed state
+    const HelixPreFit::Result &cachedPreFit(const vector<KiTrack::IHit *> &trackCand) {
+        auto it = preFitCache.find(trackCand);
+        if (it == preFitCache.end())
+            it = preFitCache.insert(std::make_pair(trackCand, preFit(trackCand))).first;
+        return it->second;
+    }
+
+    /** The helix pre-fit gate: false if the seed should not be fitted.
+     * Seeds the pre-fit cannot handle (collinear, no field) always pass
+     */
+    bool passesPreFit(const vector<KiTrack::IHit *> &trackCand, float maxChi2Ndf, float ptMin, float ptMax) {
+        const HelixPreFit::Result &r = cachedPreFit(trackCand);
+        if (!r.valid)
+            return true;
+        hist["PreFitChi2Ndf"]->Fill(r.chi2Ndf());
+        hist["PreFitPt"]->Fill(r.pt);
+        if (maxChi2Ndf > 0 && r.chi2Ndf() > maxChi2Ndf)
+            return false;
+        if (r.pt < ptMin || (ptMax > 0 && r.pt > ptMax))
+            return false;
+        return true;
+    }
+
+    /** Fit with the fixed-size Kalman fitter (FwdKalmanFitter.h), starting from the seed
+     * momentum with the seed charge. The optional vertex is added as a measurement.
+     * Sets fStatus like a GenFit fit.
+     * @returns the momentum at the first hit, (0, 0, 0) if the fit failed
+     */
+    TVector3 fitTrackFast(const vector<KiTrack::IHit *> &trackCand, const TVector3 &seedMom, const TVectorD *pv, FwdKalmanFitter::Result &r) {
+        std::vector<FwdKalmanFitter::Measurement> hits;
+        if (pv)
+            hits.push_back(FwdKalmanFitter::Measurement{(*pv)[0], (*pv)[1], (*pv)[2], vertexSigmaXY * vertexSigmaXY, 0, vertexSigmaXY * vertexSigmaXY});
+        for (KiTrack::IHit *h : trackCand) {
+            const TMatrixDSym &cov = static_cast<FwdHit *>(h)->_covmat;
+            hits.push_back(FwdKalmanFitter::Measurement{h->getX(), h->getY(), h->getZ(), cov(0, 0), cov(0, 1), cov(1, 1)});
+        }
+
+        // seed on the plane of the first hit, the fit is free to flip the charge
+        auto first = std::min_element(hits.begin(), hits.end(), [](const FwdKalmanFitter::Measurement &a, const FwdKalmanFitter::Measurement &b) { return a.z < b.z; });
+        int q = seedCharge(trackCand);
+        double pz = fabs(seedMom.Z()) > 1e-3 ? seedMom.Z() : 1e-3;
+        double seed[5] = {first->x, first->y, seedMom.X() / pz, seedMom.Y() / pz, (q < 0 ? -1.0 : 1.0) / std::max(seedMom.Mag(), 0.1)};
+
+        r = fastFitter->fit(hits, seed);
+        return fastResult(r);
+    }
+
+    // sets fStatus from a fast Kalman fit, returns its momentum or (0, 0, 0) if it failed
+    TVector3 fastResult(const FwdKalmanFitter::Result &r) {
+        fStatus = genfit::FitStatus();
+        fStatus.setIsFitted(true);
+        fStatus.setIsFitConvergedFully(r.converged);
+        fStatus.setIsFitConvergedPartially(r.converged);
+        fStatus.setCharge(r.charge());
+        fStatus.setChi2(r.chi2);
+        fStatus.setNdf(r.ndf);
+        if (!r.converged)
+            return TVector3(0, 0, 0);
+
+        double px, py, pz;
+        r.momentum(px, py, pz);
+        return TVector3(px, py, pz);
+    }
+
+    // the configured vertex smeared by its resolution
+    TVectorD smearedVertex() {
+        TVectorD pv(3);
+        pv[0] = vertexPos[0] + rand->Gaus(0, vertexSigmaXY);
+        pv[1] = vertexPos[1] + rand->Gaus(0, vertexSigmaXY);
+        pv[2] = vertexPos[2] + rand->Gaus(0, vertexSigmaZ);
+        return pv;
+    }
+
+    /** Fits the seeds with the batched fast Kalman fitter (FwdKalmanBatch.h), grouped by
+     * their planes and started from the helix pre-fit. fitTrack then uses these results;
+     * seeds that did not converge or have chi2/ndf > FastKalman:maxChi2Ndf are fitted with
+     * GenFit instead. With the vertex in the fit its smeared position is drawn here, added
+     * as the first measurement and kept for the fitTrack of the seed.
+     * Does nothing unless TrackFitter.FastKalman:batch is set.
+     */
+    void fitBatch(const std::vector<Seed_t> &seeds) {
+        batchResults.clear();
+        batchVertices.clear();
+        if (batchFitter == nullptr)
+            return;
+
+        std::map<std::vector<int>, std::vector<size_t>> groups; // sectors in z -> seeds
+        std::vector<std::vector<FwdKalmanFitter::Measurement>> hits(seeds.size());
+        std::vector<FwdKalmanBatch::Seed> states(seeds.size());
+        for (size_t i = 0; i < seeds.size(); i++) {
+            const HelixPreFit::Result &r = cachedPreFit(seeds[i]);
+            if (!r.valid)
+                continue;
+            Seed_t sorted = seeds[i];
+            std::sort(sorted.begin(), sorted.end(), [](KiTrack::IHit *a, KiTrack::IHit *b) { return a->getZ() < b->getZ(); });
+            std::vector<int> sectors;
+            double x0 = r.x, y0 = r.y;
+            if (includeVertexInFit) {
+                TVectorD pv = smearedVertex();
+                batchVertices[seeds[i]] = pv;
+                hits[i].push_back(FwdKalmanFitter::Measurement{pv[0], pv[1], pv[2], vertexSigmaXY * vertexSigmaXY, 0, vertexSigmaXY * vertexSigmaXY});
+                sectors.push_back(-1);
+                x0 = pv[0];
+                y0 = pv[1];
+            }
+            for (KiTrack::IHit *h : sorted) {
+                const TMatrixDSym &cov = static_cast<FwdHit *>(h)->_covmat;
+                hits[i].push_back(FwdKalmanFitter::Measurement{h->getX(), h->getY(), h->getZ(), cov(0, 0), cov(0, 1), cov(1, 1)});
+                sectors.push_back(h->getSector());
+            }
+            double p = sqrt(r.pt * r.pt + r.pz * r.pz);
+            states[i] = FwdKalmanBatch::Seed{{x0, y0, r.px / r.pz, r.py / r.pz, (r.charge < 0 ? -1.0 : 1.0) / std::max(p, 0.1)}};
+            groups[sectors].push_back(i);
+        }
+
+        for (auto &g : groups) {
+            std::vector<std::vector<FwdKalmanFitter::Measurement>> groupHits;
+            std::vector<FwdKalmanBatch::Seed> groupStates;
+            for (size_t i : g.second) {
+                groupHits.push_back(hits[i]);
+                groupStates.push_back(states[i]);
+            }
+            std::vector<FwdKalmanFitter::Result> results = batchFitter->fit(groupHits, groupStates);
+            for (size_t j = 0; j < g.second.size(); j++)
+                batchResults[seeds[g.second[j]]] = results[j];
+        }
+        LOG_F(INFO, "Batched fast Kalman fits: %lu of %lu seeds in %lu groups", batchResults.size(), seeds.size(), groups.size());
+    }
+
+    // fits the seed with the fast Kalman fitter as well and compares to the GenFit result (p = 0 if it failed)
+    void validateFastFit(const vector<KiTrack::IHit *> &trackCand, const TVector3 &seedMom, const TVectorD *pv, const TVector3 &p, int q) {
+        genfit::FitStatus status = fStatus;
+        FwdKalmanFitter::Result r;
+        long long start = loguru::now_ns();
+        TVector3 pFast = fitTrackFast(trackCand, seedMom, pv, r);
+        hist["FastKalmanDuration"]->Fill((loguru::now_ns() - start) * 1e-6);
+        fStatus = status;
+
+        bool fastOk = pFast.Perp() > 1e-3, genfitOk = p.Perp() > 1e-3;
+        if (!fastOk || !genfitOk) {
+            hist["FastKalmanValidation"]->Fill(fastOk ? "GenFitFailed" : (genfitOk ? "FastFailed" : "BothFailed"), 1);
+            return;
+        }
+        hist["FastKalmanValidation"]->Fill(r.charge() == q ? "SameCharge" : "OppositeCharge", 1);
+        hist["FastKalmanDeltaPt"]->Fill((pFast.Perp() - p.Perp()) / p.Perp());
+        hist["FastKalmanDeltaEta"]->Fill(pFast.Eta() - p.Eta());
+        hist["FastKalmanChi2Ndf"]->Fill(r.ndf > 0 ? r.chi2 / r.ndf : 0);
+    }
+
+    /** Charge sign from the sense of rotation of the seed in the transverse plane.
+     *
+     * Uses the first, middle and last hit in z. The charge is ambiguous when the sagitta
+     * of the middle hit is below chargeAmbiguitySigma hit resolutions (nearly straight
+     * tracks) or when there is no field.
+     *
+     * @returns +1 or -1, 0 if ambiguous
+     */
+    int seedCharge(vector<KiTrack::IHit *> trackCand) {
+        if (trackCand.size() < 3)
+            return 0;
+        std::sort(trackCand.begin(), trackCand.end(), [](KiTrack::IHit *a, KiTrack::IHit *b) { return a->getZ() < b->getZ(); });
+        KiTrack::IHit *h0 = trackCand.front(), *h1 = trackCand[trackCand.size() / 2], *h2 = trackCand.back();
+
+        double ax = h1->getX() - h0->getX(), ay = h1->getY() - h0->getY();
+        double bx = h2->getX() - h0->getX(), by = h2->getY() - h0->getY();
+        double cross = bx * ay - by * ax; // > 0 when turning clockwise with increasing z
+        double chord = sqrt(bx * bx + by * by);
+        if (chord < 1e-6)
+            return 0;
+        double sagitta = fabs(cross) / chord;
+
+        double sigma = 0;
+        for (KiTrack::IHit *h : {h0, h1, h2})
+            sigma += sqrt(std::max(static_cast<FwdHit *>(h)->_covmat(0, 0), static_cast<FwdHit *>(h)->_covmat(1, 1)));
+        sigma /= 3;
+
+        double bz = genfit::FieldManager::getInstance()->getFieldVal(TVector3(h1->getX(), h1->getY(), h1->getZ())).Z();
+        if (sagitta < chargeAmbiguitySigma * sigma || fabs(bz) < 1e-6)
+            return 0;
+
+        // a positive charge turns clockwise (seen from +z) in a field along +z
+        return (cross > 0) == (bz > 0) ? 1 : -1;
+    }
+
     float seedState(vector<KiTrack::IHit *> trackCand, TVector3 &seedPos, TVector3 &seedMom) {
         LOG_SCOPE_FUNCTION(INFO);
 
@@ -312,16 +740,8 @@ class TrackFitter {
                 hit_closest_to_IP = fwdHit;
         }
 
-        // enumerate the partitions
-        // 12 11 10
-        // 12 11 9
-        // 12 10 9
-        // 11 10 9
-        vector<float> curvs;
-        curvs.push_back(fitSimpleCircle(trackCand, vol_map[12], vol_map[11], vol_map[10]));
-        curvs.push_back(fitSimpleCircle(trackCand, vol_map[12], vol_map[11], vol_map[9]));
-        curvs.push_back(fitSimpleCircle(trackCand, vol_map[12], vol_map[10], vol_map[9]));
-        curvs.push_back(fitSimpleCircle(trackCand, vol_map[11], vol_map[10], vol_map[9]));
+        auto cached = curvatureCache.find(trackCand);
+        vector<float> curvs = cached != curvatureCache.end() ? cached->second : seedCurvatures(trackCand);
 
         // average them and exclude failed fits
         float mcurv = 0;
@@ -379,29 +799,193 @@ class TrackFitter {
         return mcurv;
     }
 
-    genfit::MeasuredStateOnPlane projectTo(size_t si_plane, genfit::Track *fitTrack) {
+    /** Projects the track onto all Si planes at once (from the 2nd fitted point, the
+     * last Si plane first); the states are indexed by Si plane and cached until
+     * clearProjections()
+     */
+    const FwdTrackProjector::Projection &projectToSi(genfit::Track *fitTrack) {
+        LOG_SCOPE_FUNCTION(INFO);
+        const FwdTrackProjector::Projection &p = siProjector.project(fitTrack);
+        for (size_t i = 0; i < p.states.size(); i++) {
+            if (!p.valid(i))
+                continue;
+            const genfit::MeasuredStateOnPlane &tst = p.state(i);
+            auto TCM = fitTrack->getCardinalRep()->get6DCov(tst);
+            LOG_F(INFO, "Position at Si (Disk %lu) (%0.2f, %0.2f, %0.2f) +/- (%0.2f, %0.2f, %0.2f)", i, tst.getPos().X(), tst.getPos().Y(), tst.getPos().Z(), sqrt(TCM(0, 0)), sqrt(TCM(1, 1)), sqrt(TCM(2, 2)));
+        }
+        return p;
+    }
+    void clearProjections() { siProjector.clear(); }
+
+    /** Adds the Si hits to a fitted track by filtering them into its fitted state on the
+     * first sTGC plane (which carries the information of all sTGC hits), one Kalman
+     * update per Si plane going inwards, instead of refitting the whole track. The charge
+     * is the one of the original fit. With TrackFitter.SiRefit:smooth the states on the
+     * outer planes are smoothed back (Rauch-Tung-Striebel) and the momentum is taken on
+     * the same point as the full refit does.
+     * Only the momentum is the result: the track keeps its points, fitted states and fit
+     * status, so StEvent and the fit status of the tracker comparison see the sTGC fit.
+     * @param p the momentum at the innermost Si hit, the original momentum without Si hits
+     * @returns false if the update failed, the track is then left to the full refit
+     */
+    bool updateTrackWithSiHits(genfit::Track *originalTrack, std::vector<KiTrack::IHit *> si_hits, TVector3 &p) {
         LOG_SCOPE_FUNCTION(INFO);
-        if (si_plane > 2) {
-            LOG_F(ERROR, "si_plane out of bounds = %lu", si_plane);
-            genfit::MeasuredStateOnPlane nil;
-            return nil;
+        long long start = loguru::now_ns();
+        genfit::AbsTrackRep *rep = originalTrack->getCardinalRep();
+        if (originalTrack->getFitStatus(rep)->isFitConverged() == false)
+            return false;
+        TVector3 pOrig = rep->getMom(originalTrack->getFittedState(1, rep));
+        size_t first_tp = includeVertexInFit ? 1 : 0; // the 1st sTGC point
+        if (originalTrack->getNumPointsWithMeasurement() <= first_tp)
+            return false;
+
+        // Si hits from the sTGC inwards
+        std::vector<KiTrack::IHit *> hits;
+        for (auto h : si_hits) {
+            if (nullptr == h)
+                continue;
+            if (SiDetPlanes.size() <= (size_t)h->getSector())
+                return false;
+            hits.push_back(h);
+        }
+        if (hits.empty()) {
+            p = pOrig;
+            return true;
+        }
+        std::sort(hits.begin(), hits.end(), [&](KiTrack::IHit *a, KiTrack::IHit *b) {
+            return SiDetPlanes[a->getSector()]->getO().Z() > SiDetPlanes[b->getSector()]->getO().Z();
+        });
+
+        // filtered[0] is the sTGC state, predicted[k] and jacobian[k] take filtered[k] to the plane of filtered[k + 1]
+        std::vector<genfit::MeasuredStateOnPlane> filtered, predicted;
+        std::vector<TMatrixD> jacobian;
+        double chi2 = 0;
+        try {
+            genfit::MeasuredStateOnPlane state = originalTrack->getFittedState(first_tp, rep);
+            filtered.push_back(state);
+            for (auto h : hits) {
+                rep->extrapolateToPlane(state, SiDetPlanes[h->getSector()]);
+                TMatrixD F(5, 5);
+                TMatrixDSym noise(5);
+                TVectorD delta(5);
+                rep->getForwardJacobianAndNoise(F, noise, delta);
+                predicted.push_back(state);
+                jacobian.push_back(F);
+                if (!kalmanUpdate(state, h->getX(), h->getY(), CovMatPlane(h), chi2)) {
+                    LOG_F(WARNING, "Singular residual covariance on the Si update, refitting");
+                    return false;
+                }
+                filtered.push_back(state);
+            }
+        } catch (genfit::Exception &e) {
+            LOG_F(INFO, "Exception on the Si update : %s", e.what());
+            return false;
         }
 
-        // start with last Si plane closest to STGC
-        LOG_F(INFO, "Projecting to Si Plane %lu", si_plane);
-        auto detSi = SiDetPlanes[si_plane];
-        genfit::MeasuredStateOnPlane tst = fitTrack->getFittedState(1);
-        auto TCM = fitTrack->getCardinalRep()->get6DCov(tst);
-        double len = fitTrack->getCardinalRep()->extrapolateToPlane(tst, detSi, false, true);
+        // innermost first: the Si states in increasing z, then the sTGC one
+        size_t point = 0;
+        if (siRefitSmooth) {
+            for (size_t k = hits.size(); k-- > 0;)
+                smooth(filtered[k], predicted[k], jacobian[k], filtered[k + 1]);
+            point = includeVertexInFit ? 0 : 1; // the fitted point 1 of the full refit
+        }
+        p = rep->getMom(filtered[filtered.size() - 1 - point]);
 
-        LOG_F(INFO, "len to Si (Disk %lu) =%f", si_plane, len);
-        LOG_F(INFO, "Position at Si (%0.2f, %0.2f, %0.2f) +/- (%0.2f, %0.2f, %0.2f)", tst.getPos().X(), tst.getPos().Y(), tst.getPos().Z(), sqrt(TCM(0, 0)), sqrt(TCM(1, 1)), sqrt(TCM(2, 2)));
-        TCM = fitTrack->getCardinalRep()->get6DCov(tst);
-        return tst;
+        if (MAKE_HIST) {
+            hist["SiUpdateChi2"]->Fill(chi2);
+            hist["SiUpdateDuration"]->Fill((loguru::now_ns() - start) * 1e-6);
+        }
+        LOG_F(INFO, "FitMom( pT=%0.2f, eta=%0.2f, phi=%0.2f ) with %lu Si hits, chi2 += %0.2f", p.Pt(), p.Eta(), p.Phi(), hits.size(), chi2);
+        LOG_F(INFO, "Original FitMom( pT=%0.2f, eta=%0.2f, phi=%0.2f )", pOrig.Pt(), pOrig.Eta(), pOrig.Phi());
+        return true;
+    }
+
+    /** Kalman update of a state on a Si plane (u = x, v = y) with the hit at (x, y)
+     * @param chi2 incremented by the chi2 of the hit
+     * @returns false, leaving the state unchanged, if the residual covariance is not positive definite
+     */
+    bool kalmanUpdate(genfit::MeasuredStateOnPlane &s, double x, double y, const TMatrixDSym &V, double &chi2) {
+        TVectorD &v = s.getState(); // q/p, u', v', u, v
+        TMatrixDSym &C = s.getCov();
+        double r0 = x - v(3), r1 = y - v(4);
+        double S00 = V(0, 0) + C(3, 3), S01 = V(0, 1) + C(3, 4), S11 = V(1, 1) + C(4, 4);
+        double det = S00 * S11 - S01 * S01;
+        if (!(det > 0))
+            return false;
+        double I00 = S11 / det, I01 = -S01 / det, I11 = S00 / det;
+
+        double K[5][2], row3[5], row4[5];
+        for (int i = 0; i < 5; i++) {
+            K[i][0] = C(i, 3) * I00 + C(i, 4) * I01;
+            K[i][1] = C(i, 3) * I01 + C(i, 4) * I11;
+            row3[i] = C(3, i);
+            row4[i] = C(4, i);
+        }
+        for (int i = 0; i < 5; i++) {
+            v(i) += K[i][0] * r0 + K[i][1] * r1;
+            for (int j = 0; j <= i; j++)
+                C(i, j) = C(j, i) = C(i, j) - 0.5 * (K[i][0] * row3[j] + K[i][1] * row4[j] + K[j][0] * row3[i] + K[j][1] * row4[i]);
+        }
+        chi2 += r0 * r0 * I00 + 2 * r0 * r1 * I01 + r1 * r1 * I11;
+        return true;
+    }
+
+    // Rauch-Tung-Striebel step: smooths f with the smoothed state s on the next plane, pred being f propagated there with jacobian F
+    void smooth(genfit::MeasuredStateOnPlane &f, const genfit::MeasuredStateOnPlane &pred, const TMatrixD &F, const genfit::MeasuredStateOnPlane &s) {
+        TMatrixDSym predInv(pred.getCov());
+        predInv.Invert();
+        const TMatrixDSym &Cf = f.getCov();
+        // A = Cf F^T pred^-1
+        double CFt[5][5], A[5][5];
+        for (int i = 0; i < 5; i++) {
+            for (int j = 0; j < 5; j++) {
+                CFt[i][j] = 0;
+                for (int k = 0; k < 5; k++)
+                    CFt[i][j] += Cf(i, k) * F(j, k);
+            }
+        }
+        for (int i = 0; i < 5; i++) {
+            for (int j = 0; j < 5; j++) {
+                A[i][j] = 0;
+                for (int k = 0; k < 5; k++)
+                    A[i][j] += CFt[i][k] * predInv(k, j);
+            }
+        }
+
+        TVectorD &v = f.getState();
+        TMatrixDSym &C = f.getCov();
+        double dC[5][5], AdC[5][5];
+        for (int i = 0; i < 5; i++) {
+            for (int k = 0; k < 5; k++) {
+                v(i) += A[i][k] * (s.getState()(k) - pred.getState()(k));
+                dC[i][k] = s.getCov()(i, k) - pred.getCov()(i, k);
+            }
+        }
+        for (int i = 0; i < 5; i++) {
+            for (int j = 0; j < 5; j++) {
+                AdC[i][j] = 0;
+                for (int k = 0; k < 5; k++)
+                    AdC[i][j] += A[i][k] * dC[k][j];
+            }
+        }
+        for (int i = 0; i < 5; i++) {
+            for (int j = 0; j <= i; j++) {
+                double c = 0;
+                for (int k = 0; k < 5; k++)
+                    c += AdC[i][k] * A[j][k];
+                C(i, j) = C(j, i) = C(i, j) + c;
+            }
+        }
     }
 
+    /** Refit of a track with its Si hits (or the incremental update, see updateTrackWithSiHits)
+     * @returns the new momentum, the original track is not changed
+     */
     TVector3 refitTrackWithSiHits(genfit::Track *originalTrack, std::vector<KiTrack::IHit *> si_hits) {
         LOG_SCOPE_FUNCTION(INFO);
+        TVector3 pUpdated;
+        if (siRefitIncremental && updateTrackWithSiHits(originalTrack, si_hits, pUpdated))
+            return pUpdated;
 
         TVector3 pOrig = originalTrack->getCardinalRep()->getMom(originalTrack->getFittedState(1, originalTrack->getCardinalRep()));
         auto cardinalStatus = originalTrack->getFitStatus(originalTrack->getCardinalRep());
@@ -411,8 +995,14 @@ class TrackFitter {
             return pOrig;
         }
 
-        auto trackRepPos = new genfit::RKTrackRep(pdg_mu_plus);
-        auto trackRepNeg = new genfit::RKTrackRep(pdg_mu_minus);
+        // in single charge mode only the charge of the original fit is refitted
+        genfit::AbsTrackRep *trackRepPos = nullptr, *trackRepNeg = nullptr;
+        if (singleCharge) {
+            trackRepPos = new genfit::RKTrackRep(originalTrack->getCardinalRep()->getPDG());
+        } else {
+            trackRepPos = new genfit::RKTrackRep(pdg_mu_plus);
+            trackRepNeg = new genfit::RKTrackRep(pdg_mu_minus);
+        }
 
         auto trackPoints = originalTrack->getPointsWithMeasurement();
         LOG_F(INFO, "trackPoints.size() = %lu", trackPoints.size());
@@ -431,7 +1021,8 @@ class TrackFitter {
         LOG_F(INFO, "SeedPos( X=%0.2f, Y=%0.2f, Z=%0.2f )", seedPos.X(), seedPos.Y(), seedPos.Z());
 
         auto refTrack = new genfit::Track(trackRepPos, seedPos, seedMom);
-        refTrack->addTrackRep(trackRepNeg);
+        if (trackRepNeg)
+            refTrack->addTrackRep(trackRepNeg);
 
         genfit::Track &fitTrack = *refTrack;
 
@@ -496,6 +1087,19 @@ class TrackFitter {
             LOG_F(INFO, "Exception on track RE-fit : %s", e.what());
         }
 
+        // the charge of the original fit failed with the Si hits, try the other one
+        if (trackRepNeg == nullptr && fitTrack.getFitStatus(trackRepPos)->isFitConverged() == false) {
+            LOG_F(INFO, "Refit with the original charge did not converge, fitting the other one");
+            trackRepNeg = new genfit::RKTrackRep(-trackRepPos->getPDG());
+            fitTrack.addTrackRep(trackRepNeg);
+            try {
+                fitter->processTrackWithRep(&fitTrack, trackRepNeg);
+                fitTrack.determineCardinalRep();
+            } catch (genfit::Exception &e) {
+                LOG_F(INFO, "Exception on track RE-fit : %s", e.what());
+            }
+        }
+
         if (fitTrack.getFitStatus(fitTrack.getCardinalRep())->isFitConverged() == false) {
             LOG_F(ERROR, "Fit with Si hits did not converge");
         } else {
@@ -513,8 +1117,7 @@ class TrackFitter {
     void studyProjectionToSi(genfit::AbsTrackRep *cardinalRep, genfit::AbsTrackRep *wrongRep, genfit::Track &fitTrack) {
 
         // try projecting onto the Si plane
-        const float DET_Z = 140;
-        auto detSi = genfit::SharedPlanePtr(new genfit::DetPlane(TVector3(0, 0, DET_Z), TVector3(1, 0, 0), TVector3(0, 1, 0)));
+        auto detSi = siStudyPlane;
         genfit::MeasuredStateOnPlane tst = fitTrack.getFittedState(1);
         genfit::MeasuredStateOnPlane tst2 = fitTrack.getFittedState(1, wrongRep);
 
@@ -586,7 +1189,7 @@ class TrackFitter {
     void studyProjectionToECal(genfit::AbsTrackRep *cardinalRep, genfit::Track &fitTrack) {
 
         // try projecting onto the Si plane
-        auto detSi = genfit::SharedPlanePtr(new genfit::DetPlane(TVector3(0, 0, 711), TVector3(1, 0, 0), TVector3(0, 1, 0)));
+        auto detSi = ecalPlane;
         genfit::MeasuredStateOnPlane tst = fitTrack.getFittedState(1);
 
         auto TCM = cardinalRep->get6DCov(tst);
@@ -673,13 +1276,14 @@ class TrackFitter {
         LOG_F(INFO, "Track candidate size: %lu", trackCand.size());
         this->hist["FitStatus"]->Fill("Total", 1);
 
-        // The PV information, if we want to use it
+        // The PV information, if we want to use it (the batched fit of the seed drew it already)
         TVectorD pv(3);
 
-        if (0 == Vertex) {
-            pv[0] = vertexPos[0] + rand->Gaus(0, vertexSigmaXY);
-            pv[1] = vertexPos[1] + rand->Gaus(0, vertexSigmaXY);
-            pv[2] = vertexPos[2] + rand->Gaus(0, vertexSigmaZ);
+        auto batchVertex = batchVertices.find(trackCand);
+        if (0 == Vertex && batchVertex != batchVertices.end()) {
+            pv = batchVertex->second;
+        } else if (0 == Vertex) {
+            pv = smearedVertex();
         } else {
             pv[0] = Vertex[0];
             pv[1] = Vertex[1];
@@ -693,9 +1297,67 @@ class TrackFitter {
             TVector3(0, 0, 0);
         }
 
-        // create the track representations
-        auto trackRepPos = new genfit::RKTrackRep(pdg_mu_plus);
-        auto trackRepNeg = new genfit::RKTrackRep(pdg_mu_minus);
+        // the helix pre-fit uses all hits, so it is a better start than the triplet circles
+        if (preFitSeedState) {
+            const HelixPreFit::Result &r = cachedPreFit(trackCand);
+            if (r.valid) {
+                seedPos.SetXYZ(r.x, r.y, r.z);
+                seedMom.SetXYZ(r.px, r.py, r.pz);
+                LOG_F(INFO, "Helix pre-fit seed: pT=%0.2f, chi2/ndf=%0.2f", r.pt, r.chi2Ndf());
+            }
+        }
+
+        // the fast Kalman fitter replaces GenFit, no genfit::Track is made
+        // (the outliers of the batched fits are fitted with GenFit below)
+        fastFit = false;
+        auto batched = batchResults.find(trackCand);
+        bool outlier = false;
+        if (batched != batchResults.end()) {
+            const FwdKalmanFitter::Result &r = batched->second;
+            outlier = !r.converged || (batchMaxChi2Ndf > 0 && r.chi2 > batchMaxChi2Ndf * r.ndf);
+            hist["FastKalmanBatch"]->Fill(outlier ? "Outlier" : "Batched", 1);
+        } else if (batchFitter != nullptr) {
+            hist["FastKalmanBatch"]->Fill("NotBatched", 1);
+        }
+        if (fitterMode == kFastKalman && !outlier) {
+            FwdKalmanFitter::Result r;
+            TVector3 p;
+            if (batched != batchResults.end()) {
+                r = batched->second;
+                p = fastResult(r);
+            } else {
+                p = fitTrackFast(trackCand, McSeedMom ? *McSeedMom : seedMom, includeVertexInFit ? &pv : nullptr, r);
+            }
+            long long duration = (loguru::now_ns() - itStart) * 1e-6; // milliseconds
+            hist["FitStatus"]->Fill(p.Perp() > 1e-3 ? "Pass" : "Fail", 1);
+            hist[p.Perp() > 1e-3 ? "FitDuration" : "FailedFitDuration"]->Fill(duration);
+            LOG_F(INFO, "Fast Kalman fit: converged=%d, pT=%0.2f, chi2/ndf=%0.2f", (int)r.converged, p.Perp(), r.ndf > 0 ? r.chi2 / r.ndf : 0);
+            fastFit = true;
+            _p = p;
+            return p;
+        }
+
+        // a good batched fit is a better start for GenFit than the seed
+        if (batched != batchResults.end() && !outlier) {
+            const FwdKalmanFitter::State &first = batched->second.first;
+            double px, py, pz;
+            batched->second.momentum(px, py, pz);
+            seedPos.SetXYZ(first.v[0], first.v[1], first.z);
+            seedMom.SetXYZ(px, py, pz);
+        }
+
+        // create the track representations, in single charge mode only the one of the seed charge
+        // (PDG 13 is the mu-, so trackRepPos holds the negative hypothesis)
+        int q = singleCharge ? seedCharge(trackCand) : 0;
+        genfit::AbsTrackRep *trackRepPos = nullptr, *trackRepNeg = nullptr;
+        if (q <= 0)
+            trackRepPos = new genfit::RKTrackRep(pdg_mu_plus);
+        if (q >= 0)
+            trackRepNeg = new genfit::RKTrackRep(pdg_mu_minus);
+        if (singleCharge)
+            hist["ChargeHypotheses"]->Fill(q == 0 ? "Ambiguous" : "Single", 1);
+        else
+            hist["ChargeHypotheses"]->Fill("Both", 1);
 
         // If we use the PV, use that as the start pos for the track
         if (includeVertexInFit) {
@@ -710,8 +1372,9 @@ class TrackFitter {
             LOG_F(INFO, "Using MC Seed Momentum (%f, %f, %f)", seedMom.Pt(), seedMom.Eta(), seedMom.Phi());
         }
 
-        fTrack = new genfit::Track(trackRepPos, seedPos, seedMom);
-        fTrack->addTrackRep(trackRepNeg);
+        fTrack = new genfit::Track(trackRepPos ? trackRepPos : trackRepNeg, seedPos, seedMom);
+        if (trackRepPos && trackRepNeg)
+            fTrack->addTrackRep(trackRepNeg);
 
         LOG_INFO
             << "seedPos : (" << seedPos.X() << ", " << seedPos.Y() << ", " << seedPos.Z() << " )"
@@ -776,8 +1439,10 @@ class TrackFitter {
 
             // do the fit
             LOG_F(INFO, "Processing Track");
-            fitter->processTrackWithRep(&fitTrack, trackRepPos);
-            fitter->processTrackWithRep(&fitTrack, trackRepNeg);
+            if (trackRepPos)
+                fitter->processTrackWithRep(&fitTrack, trackRepPos);
+            if (trackRepNeg)
+                fitter->processTrackWithRep(&fitTrack, trackRepNeg);
             // fitter->processTrack( &fitTrack );
 
             // print fit result
@@ -790,6 +1455,25 @@ class TrackFitter {
             hist["FitStatus"]->Fill("Exception", 1);
         }
 
+        // the seed charge hypothesis failed, fit the other one as well
+        if (trackRepPos == nullptr || trackRepNeg == nullptr) {
+            genfit::AbsTrackRep *first = trackRepPos ? trackRepPos : trackRepNeg;
+            if (fitTrack.getFitStatus(first)->isFitConverged() == false) {
+                LOG_F(INFO, "Seed charge hypothesis did not converge, fitting the other one");
+                hist["ChargeHypotheses"]->Fill("SecondNeeded", 1);
+                genfit::AbsTrackRep *second = new genfit::RKTrackRep(trackRepPos ? pdg_mu_minus : pdg_mu_plus);
+                (trackRepPos ? trackRepNeg : trackRepPos) = second;
+                fitTrack.addTrackRep(second);
+                try {
+                    fitter->processTrackWithRep(&fitTrack, second);
+                } catch (genfit::Exception &e) {
+                    LOG_F(INFO, "%s", e.what());
+                    LOG_F(INFO, "Exception on track fit");
+                    hist["FitStatus"]->Fill("Exception", 1);
+                }
+            }
+        }
+
         LOG_F(INFO, "Get fit status and momentum");
         TVector3 p(0, 0, 0);
 
@@ -813,8 +1497,8 @@ class TrackFitter {
                 this->hist["FitStatus"]->Fill("GoodCardinal", 1);
             }
 
-            if (fitTrack.getFitStatus(trackRepPos)->isFitConverged() == false &&
-                fitTrack.getFitStatus(trackRepNeg)->isFitConverged() == false) {
+            auto converged = [&](genfit::AbsTrackRep *rep) { return rep != nullptr && fitTrack.getFitStatus(rep)->isFitConverged(); };
+            if (converged(trackRepPos) == false && converged(trackRepNeg) == false) {
                 LOG_F(INFO, "*********************FIT SUMMARY*********************");
                 LOG_F(ERROR, "Track Fit failed to converge");
                 LOG_F(INFO, "SeedMom( pT=%0.2f, eta=%0.2f, phi=%0.2f )", seedMom.Pt(), seedMom.Eta(), seedMom.Phi());
@@ -825,6 +1509,8 @@ class TrackFitter {
 
                 long long duration = (loguru::now_ns() - itStart) * 1e-6; // milliseconds
                 this->hist["FailedFitDuration"]->Fill(duration);
+                if (fitterMode == kValidateFastKalman)
+                    validateFastFit(trackCand, seedMom, includeVertexInFit ? &pv : nullptr, p, 0);
                 return p;
             }
 
@@ -849,7 +1535,7 @@ class TrackFitter {
             return p;
         }
 
-        if (makeDisplay) {
+        if (makeDisplay && fillOutputs) {
             displayTracks.push_back(fitTrack);
             display->addEvent(&(displayTracks[displayTracks.size() - 1]));
             display->setOptions("ABDEFHMPT"); // add G to show geometry
@@ -871,6 +1557,11 @@ class TrackFitter {
         long long duration = (loguru::now_ns() - itStart) * 1e-6; // milliseconds
         this->hist["FitDuration"]->Fill(duration);
 
+        if (fitterMode == kValidateFastKalman) {
+            auto cardinalRep = fitTrack.getCardinalRep();
+            validateFastFit(trackCand, seedMom, includeVertexInFit ? &pv : nullptr, p, (int)cardinalRep->getCharge(fitTrack.getFittedState(1, cardinalRep)));
+        }
+
         return p;
     }
 
@@ -885,13 +1576,42 @@ class TrackFitter {
         return (int)_q;
     }
 
+    /** Installs the geometry, field and material of this fitter in the GenFit singletons.
+     * Done by setup(), and again before each event when several fitters share the job
+     * (the compare tracker), so that each one fits with its own configuration
+     */
+    void activate() {
+        if (geoManager != nullptr)
+            gGeoManager = geoManager;
+        genfit::FieldManager::getInstance()->init(bField);
+        genfit::MaterialEffects::getInstance()->init(materialInterface);
+        genfit::MaterialEffects::getInstance()->setNoEffects(noMaterialEffects);
+    }
+
+    // Reseed the vertex smearing, e.g. to fit identically in two trackers
+    void setRandomSeed(UInt_t seed) { rand->SetSeed(seed); }
+
+    // with fill = false the histograms are swapped for scratch copies and the display is not fed
+    void setFillOutputs(bool fill) {
+        if (fill == fillOutputs)
+            return;
+        if (scratchHist.empty())
+            scratchHist = Benchmark::scratchCopies(hist);
+        std::swap(hist, scratchHist);
+        fillOutputs = fill;
+    }
+
     genfit::FitStatus getStatus() { return fStatus; }
+    // true if the last track was fitted by the fast Kalman fitter only, getTrack() and getTrackRep() are then not updated
+    bool lastFitFast() const { return fastFit; }
     genfit::AbsTrackRep *getTrackRep() { return fTrackRep; }
     genfit::Track *getTrack() { return fTrack; }
 
   private:
     jdb::XmlConfig &cfg;
     std::map<std::string, TH1 *> hist;
+    std::map<std::string, TH1 *> scratchHist; // filled instead of hist while fillOutputs is false
+    bool fillOutputs = true;
     bool MAKE_HIST = true;
     genfit::EventDisplay *display;
     std::vector<genfit::Track *> event;
@@ -907,6 +1627,8 @@ class TrackFitter {
     genfit::AbsTrackRep *pion_track_rep = nullptr;
     vector<genfit::SharedPlanePtr> DetPlanes;
     vector<genfit::SharedPlanePtr> SiDetPlanes;
+    genfit::SharedPlanePtr siStudyPlane, ecalPlane; // z = 140 and the ECal front
+    FwdTrackProjector siProjector;
 
     TRandom *rand = nullptr;
 
@@ -915,10 +1637,34 @@ class TrackFitter {
     float vertexSigmaZ = 30;
     vector<float> vertexPos;
     bool includeVertexInFit = false;
+    bool singleCharge = false;          // fit only the seed charge hypothesis when it is clear
+    bool preFitSeedState = false;       // start the fit from the helix pre-fit
+    bool siRefitIncremental = false;    // add the Si hits to the fitted state instead of refitting (momentum only)
+    bool siRefitSmooth = false;         // smooth the incremental Si update back to the outer planes
+    float chargeAmbiguitySigma = 3;     // seed sagitta in hit resolutions below which both are fitted
     bool useSi = true;
     bool skipSi0 = false;
     bool skipSi1 = false;
 
+    enum FitterMode { kGenFit,
+                      kFastKalman,
+                      kValidateFastKalman };
+    FitterMode fitterMode = kGenFit;
+    bool fastFit = false; // see lastFitFast
+    FwdKalmanFitter *fastFitter = nullptr;
+    std::string materialModel; // tgeo or forward
+    // installed in GenFit by activate()
+    TGeoManager *geoManager = nullptr;
+    genfit::AbsBField *bField = nullptr;
+    genfit::AbsMaterialInterface *materialInterface = nullptr;
+    bool noMaterialEffects = false;
+    FwdKalmanBatch *batchFitter = nullptr;
+    float batchMaxChi2Ndf = 10; // batched fits above this are fitted with GenFit
+    std::map<vector<KiTrack::IHit *>, FwdKalmanFitter::Result> batchResults; // by seed, from fitBatch
+    std::map<vector<KiTrack::IHit *>, TVectorD> batchVertices;              // by seed, the vertex of its batched fit
+    std::map<vector<KiTrack::IHit *>, vector<float>> curvatureCache;        // by seed, from cacheSeedCurvatures
+    std::map<vector<KiTrack::IHit *>, HelixPreFit::Result> preFitCache;      // by seed, from cachedPreFit
+
     genfit::FitStatus fStatus;
     genfit::AbsTrackRep *fTrackRep;
     genfit::Track *fTrack;
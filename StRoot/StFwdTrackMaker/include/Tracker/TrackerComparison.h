@@ -0,0 +1,239 @@
+#ifndef TRACKER_COMPARISON_H
+#define TRACKER_COMPARISON_H
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "TH1F.h"
+#include "TMath.h"
+#include "TVector2.h"
+#include "TVector3.h"
+
+#include "GenFit/FitStatus.h"
+
+#include "StFwdTrackMaker/XmlConfig/HistoBins.h"
+#include "StFwdTrackMaker/XmlConfig/XmlConfig.h"
+#include "StFwdTrackMaker/include/Tracker/FwdHit.h"
+#include "StFwdTrackMaker/include/Tracker/FwdTracker.h"
+#include "StFwdTrackMaker/include/Tracker/loguru.h"
+
+// Output of one tracker for one event, keyed by the hit content of each seed
+struct TrackerSnapshot {
+    struct Track {
+        std::vector<unsigned int> hitIds; // sorted
+        bool fitted = false;
+        TVector3 mom;
+        bool converged = false;
+        double chi2 = 0;
+        double ndf = 0;
+        int siRefit = ForwardTrackMaker::kNoSiRefit;
+    };
+
+    std::vector<Track> tracks;
+
+    static std::vector<unsigned int> hitIdsOf(const Seed_t &seed) {
+        std::vector<unsigned int> ids;
+        for (auto h : seed)
+            ids.push_back(static_cast<FwdHit *>(h)->_id);
+        std::sort(ids.begin(), ids.end());
+        return ids;
+    }
+
+    // every seed, with the fit results recorded for it (seeds skipped by the McFilter have none)
+    static TrackerSnapshot of(const ForwardTrackMaker &tracker) {
+        TrackerSnapshot snap;
+        const auto &seeds = tracker.getRecoTracks();
+        const auto &fitSeeds = tracker.getFitSeeds();
+        const auto &moms = tracker.getFitMomenta();
+        const auto &status = tracker.getFitStatus();
+        const auto &refit = tracker.getSiRefitStatus();
+
+        // fits of each seed in order, a seed found twice takes them one at a time
+        std::map<Seed_t, std::vector<size_t>> fitsOf;
+        for (size_t j = fitSeeds.size(); j-- > 0;)
+            fitsOf[fitSeeds[j]].push_back(j);
+
+        for (size_t i = 0; i < seeds.size(); i++) {
+            Track t;
+            t.hitIds = hitIdsOf(seeds[i]);
+            auto fits = fitsOf.find(seeds[i]);
+            if (fits != fitsOf.end() && !fits->second.empty()) {
+                size_t j = fits->second.back();
+                fits->second.pop_back();
+                t.fitted = true;
+                t.mom = moms[j];
+                t.converged = status[j].isFitConverged();
+                t.chi2 = status[j].getChi2();
+                t.ndf = status[j].getNdf();
+                t.siRefit = refit[j];
+            }
+            snap.tracks.push_back(t);
+        }
+        return snap;
+    }
+};
+
+/**
+ * Compares the output of two tracker configurations on the same event.
+ *
+ * Seeds are matched by their hit-id sets. For matched seeds the fitted
+ * momenta, the fit status and the Si refit outcome are compared within the
+ * tolerances given in the <Compare> node:
+ *   ptRelTol   : relative pT tolerance (default 1e-3)
+ *   etaTol     : eta tolerance (default 1e-3)
+ *   phiTol     : phi tolerance (default 1e-3)
+ *   chi2RelTol : relative chi2 tolerance (default 1e-2)
+ *   report     : text file receiving the per-event differences
+ */
+class TrackerComparison {
+  public:
+    struct EventDiff {
+        size_t nA = 0, nB = 0;
+        size_t nOnlyA = 0, nOnlyB = 0, nMatched = 0;
+        size_t nMomDiff = 0, nStatusDiff = 0, nRefitDiff = 0;
+        std::vector<std::string> lines;
+
+        bool same() const { return nOnlyA == 0 && nOnlyB == 0 && nMomDiff == 0 && nStatusDiff == 0 && nRefitDiff == 0; }
+    };
+
+    TrackerComparison(jdb::XmlConfig &_cfg) : cfg(_cfg) {}
+
+    void setup() {
+        ptRelTol = cfg.get<double>("Compare:ptRelTol", 1e-3);
+        etaTol = cfg.get<double>("Compare:etaTol", 1e-3);
+        phiTol = cfg.get<double>("Compare:phiTol", 1e-3);
+        chi2RelTol = cfg.get<double>("Compare:chi2RelTol", 1e-2);
+
+        std::string reportName = cfg.get<std::string>("Compare:report", "");
+        if (reportName.length() > 0)
+            report.open(reportName.c_str());
+
+        hist["CompareSummary"] = new TH1F("CompareSummary", ";;# seeds", 8, 0, 8);
+        jdb::HistoBins::labelAxis(hist["CompareSummary"]->GetXaxis(), {"SeedsA", "SeedsB", "OnlyA", "OnlyB", "Matched", "MomDiff", "StatusDiff", "RefitDiff"});
+        hist["CompareDeltaPtRel"] = new TH1F("CompareDeltaPtRel", ";(p_{T}^{B} - p_{T}^{A}) / p_{T}^{A}", 500, -0.05, 0.05);
+        hist["CompareDiffEvents"] = new TH1F("CompareDiffEvents", ";;# events", 2, 0, 2);
+        jdb::HistoBins::labelAxis(hist["CompareDiffEvents"]->GetXaxis(), {"Same", "Different"});
+    }
+
+    EventDiff compare(const TrackerSnapshot &a, const TrackerSnapshot &b, unsigned long long iEvent = 0) {
+        EventDiff diff;
+        diff.nA = a.tracks.size();
+        diff.nB = b.tracks.size();
+
+        // seeds with the same hits are matched in order
+        std::multimap<std::vector<unsigned int>, size_t> indexB;
+        for (size_t i = 0; i < b.tracks.size(); i++)
+            indexB.insert(std::make_pair(b.tracks[i].hitIds, i));
+
+        std::vector<bool> matchedB(b.tracks.size(), false);
+        for (const auto &ta : a.tracks) {
+            auto it = indexB.lower_bound(ta.hitIds);
+            if (it == indexB.end() || it->first != ta.hitIds) {
+                diff.nOnlyA++;
+                diff.lines.push_back("only in A : seed " + idsToString(ta.hitIds));
+                continue;
+            }
+            matchedB[it->second] = true;
+            diff.nMatched++;
+            compareTracks(ta, b.tracks[it->second], diff);
+            indexB.erase(it);
+        }
+
+        for (size_t i = 0; i < b.tracks.size(); i++) {
+            if (matchedB[i])
+                continue;
+            diff.nOnlyB++;
+            diff.lines.push_back("only in B : seed " + idsToString(b.tracks[i].hitIds));
+        }
+
+        fill(diff);
+        write(diff, iEvent);
+        return diff;
+    }
+
+    void writeHistograms() {
+        for (auto nh : hist) {
+            nh.second->SetDirectory(gDirectory);
+            nh.second->Write();
+        }
+    }
+
+  protected:
+    void compareTracks(const TrackerSnapshot::Track &ta, const TrackerSnapshot::Track &tb, EventDiff &diff) {
+        std::string seed = idsToString(ta.hitIds);
+
+        if (ta.fitted != tb.fitted || ta.converged != tb.converged) {
+            diff.nStatusDiff++;
+            diff.lines.push_back(TString::Format("status    : seed %s fitted (%d, %d) converged (%d, %d)", seed.c_str(), (int)ta.fitted, (int)tb.fitted, (int)ta.converged, (int)tb.converged).Data());
+        } else if (ta.converged && fabs(tb.chi2 - ta.chi2) > chi2RelTol * std::max(fabs(ta.chi2), 1e-6)) {
+            diff.nStatusDiff++;
+            diff.lines.push_back(TString::Format("chi2      : seed %s chi2/ndf (%0.4f/%0.0f, %0.4f/%0.0f)", seed.c_str(), ta.chi2, ta.ndf, tb.chi2, tb.ndf).Data());
+        }
+
+        if (ta.fitted && tb.fitted && ta.mom.Perp() > 1e-3 && tb.mom.Perp() > 1e-3) {
+            double dPtRel = (tb.mom.Perp() - ta.mom.Perp()) / ta.mom.Perp();
+            double dEta = tb.mom.Eta() - ta.mom.Eta();
+            double dPhi = TVector2::Phi_mpi_pi(tb.mom.Phi() - ta.mom.Phi());
+            hist["CompareDeltaPtRel"]->Fill(dPtRel);
+
+            if (fabs(dPtRel) > ptRelTol || fabs(dEta) > etaTol || fabs(dPhi) > phiTol) {
+                diff.nMomDiff++;
+                diff.lines.push_back(TString::Format("momentum  : seed %s (pT, eta, phi) A=(%0.4f, %0.4f, %0.4f) B=(%0.4f, %0.4f, %0.4f)", seed.c_str(), ta.mom.Perp(), ta.mom.Eta(), ta.mom.Phi(), tb.mom.Perp(), tb.mom.Eta(), tb.mom.Phi()).Data());
+            }
+        } else if (ta.mom.Perp() > 1e-3 || tb.mom.Perp() > 1e-3) {
+            diff.nMomDiff++;
+            diff.lines.push_back(TString::Format("momentum  : seed %s pT A=%0.4f B=%0.4f", seed.c_str(), ta.mom.Perp(), tb.mom.Perp()).Data());
+        }
+
+        if (ta.siRefit != tb.siRefit) {
+            diff.nRefitDiff++;
+            diff.lines.push_back(TString::Format("Si refit  : seed %s outcome A=%d B=%d", seed.c_str(), ta.siRefit, tb.siRefit).Data());
+        }
+    }
+
+    void fill(const EventDiff &diff) {
+        hist["CompareSummary"]->Fill("SeedsA", diff.nA);
+        hist["CompareSummary"]->Fill("SeedsB", diff.nB);
+        hist["CompareSummary"]->Fill("OnlyA", diff.nOnlyA);
+        hist["CompareSummary"]->Fill("OnlyB", diff.nOnlyB);
+        hist["CompareSummary"]->Fill("Matched", diff.nMatched);
+        hist["CompareSummary"]->Fill("MomDiff", diff.nMomDiff);
+        hist["CompareSummary"]->Fill("StatusDiff", diff.nStatusDiff);
+        hist["CompareSummary"]->Fill("RefitDiff", diff.nRefitDiff);
+        hist["CompareDiffEvents"]->Fill(diff.same() ? "Same" : "Different", 1);
+    }
+
+    void write(const EventDiff &diff, unsigned long long iEvent) {
+        LOG_F(INFO, "Compare event %llu: seeds (A=%lu, B=%lu), onlyA=%lu, onlyB=%lu, momentum diffs=%lu, status diffs=%lu, refit diffs=%lu",
+              iEvent, diff.nA, diff.nB, diff.nOnlyA, diff.nOnlyB, diff.nMomDiff, diff.nStatusDiff, diff.nRefitDiff);
+
+        if (!report.is_open())
+            return;
+
+        report << "Event " << iEvent << " : seeds A=" << diff.nA << " B=" << diff.nB << " matched=" << diff.nMatched;
+        report << (diff.same() ? " SAME" : " DIFFERENT") << std::endl;
+        for (auto &l : diff.lines)
+            report << "    " << l << std::endl;
+    }
+
+    static std::string idsToString(const std::vector<unsigned int> &ids) {
+        std::string s = "{";
+        for (size_t i = 0; i < ids.size(); i++)
+            s += (i > 0 ? "," : "") + std::to_string(ids[i]);
+        return s + "}";
+    }
+
+    jdb::XmlConfig &cfg;
+    double ptRelTol = 1e-3;
+    double etaTol = 1e-3;
+    double phiTol = 1e-3;
+    double chi2RelTol = 1e-2;
+
+    std::ofstream report;
+    std::map<std::string, TH1 *> hist;
+};
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef FWD_UNIT_TEST_H
+#define FWD_UNIT_TEST_H
+
+#include <cstdio>
+
+// Checks for the standalone unit tests: failures are printed and counted, main returns unitTestResult()
+static int unitTestFailures = 0;
+
+#define CHECK(condition)                                                            \
+    do {                                                                            \
+        if (!(condition)) {                                                         \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition);   \
+            unitTestFailures++;                                                     \
+        }                                                                           \
+    } while (0)
+
+#define CHECK_CLOSE(a, b, tolerance)                                                                        \
+    do {                                                                                                    \
+        double va = (a), vb = (b);                                                                          \
+        if (!(std::fabs(va - vb) <= (tolerance))) {                                                         \
+            printf("%s:%d: check failed: %s = %g, %s = %g (tolerance %g)\n", __FILE__, __LINE__, #a, va, #b, vb, (double)(tolerance)); \
+            unitTestFailures++;                                                                             \
+        }                                                                                                   \
+    } while (0)
+
+inline int unitTestResult(const char *name) {
+    printf("%s: %s\n", name, unitTestFailures == 0 ? "passed" : "FAILED");
+    return unitTestFailures == 0 ? 0 : 1;
+}
+
+#endif
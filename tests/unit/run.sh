@@ -0,0 +1,20 @@
+#!/bin/bash
+# Builds and runs the standalone unit tests (no ROOT, GenFit or KiTrack needed)
+# usage: tests/unit/run.sh [build directory]
+
+here=$(cd "$(dirname "$0")" && pwd)
+root=$(cd "$here/../.." && pwd)
+build=${1:-/tmp/fwd-unit-tests}
+mkdir -p "$build"
+
+failed=0
+for source in "$here"/test*.cxx; do
+    name=$(basename "$source" .cxx)
+    if ! ${CXX:-g++} -std=c++11 -O2 -Wall -Wno-deprecated -pthread -I"$here/stubs" -I"$root/StRoot" "$source" -o "$build/$name"; then
+        echo "$name: does not compile"
+        failed=1
+        continue
+    fi
+    "$build/$name" || failed=1
+done
+exit $failed
@@ -0,0 +1,25 @@
+#ifndef TEST_STUB_KITRACK_IHIT_H
+#define TEST_STUB_KITRACK_IHIT_H
+
+// Minimal stand-in of the KiTrack interface used by the tracker headers, for the unit tests
+
+#include "KiTrack/ISectorSystem.h"
+
+namespace KiTrack {
+class IHit {
+  public:
+    virtual ~IHit() {}
+
+    float getX() const { return _x; }
+    float getY() const { return _y; }
+    float getZ() const { return _z; }
+    int getSector() const { return _sector; }
+    virtual const ISectorSystem *getSectorSystem() const = 0;
+
+  protected:
+    float _x = 0, _y = 0, _z = 0;
+    int _sector = 0;
+};
+} // namespace KiTrack
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef TEST_STUB_KITRACK_ISECTORCONNECTOR_H
+#define TEST_STUB_KITRACK_ISECTORCONNECTOR_H
+
+// Minimal stand-in of the KiTrack interface used by the tracker headers, for the unit tests
+
+#include <set>
+
+namespace KiTrack {
+class ISectorConnector {
+  public:
+    virtual ~ISectorConnector() {}
+    virtual std::set<int> getTargetSectors(int sector) = 0;
+};
+} // namespace KiTrack
+
+#endif
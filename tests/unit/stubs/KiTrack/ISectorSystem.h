@@ -0,0 +1,19 @@
+#ifndef TEST_STUB_KITRACK_ISECTORSYSTEM_H
+#define TEST_STUB_KITRACK_ISECTORSYSTEM_H
+
+// Minimal stand-in of the KiTrack interface used by the tracker headers, for the unit tests
+
+#include <string>
+
+#include "KiTrack/KiTrackExceptions.h"
+
+namespace KiTrack {
+class ISectorSystem {
+  public:
+    virtual ~ISectorSystem() {}
+    virtual unsigned int getLayer(int sector) const throw(OutOfRange) = 0;
+    virtual std::string getInfoOnSector(int sector) const = 0;
+};
+} // namespace KiTrack
+
+#endif
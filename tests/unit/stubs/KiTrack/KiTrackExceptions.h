@@ -0,0 +1,15 @@
+#ifndef TEST_STUB_KITRACK_EXCEPTIONS_H
+#define TEST_STUB_KITRACK_EXCEPTIONS_H
+
+// Minimal stand-in of the KiTrack interface used by the tracker headers, for the unit tests
+
+#include <stdexcept>
+#include <string>
+
+namespace KiTrack {
+struct OutOfRange : public std::runtime_error {
+    OutOfRange(const std::string &what) : std::runtime_error(what) {}
+};
+} // namespace KiTrack
+
+#endif
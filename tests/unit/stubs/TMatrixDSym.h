@@ -0,0 +1,13 @@
+#ifndef TEST_STUB_TMATRIXDSYM_H
+#define TEST_STUB_TMATRIXDSYM_H
+
+// Minimal stand-in of the ROOT class held by FwdHit, for the unit tests
+
+class TMatrixDSym {
+  public:
+    TMatrixDSym() {}
+    TMatrixDSym(int n) { ResizeTo(n, n); }
+    void ResizeTo(int, int) {}
+};
+
+#endif
@@ -0,0 +1,70 @@
+// Edge cases of the CloneRemover
+
+#include <vector>
+
+#include "TMatrixDSym.h"
+
+#include "StFwdTrackMaker/include/Tracker/CloneRemover.h"
+
+#include "UnitTest.h"
+
+namespace {
+
+std::vector<FwdHit *> hits;
+
+Seed_t seedOf(const std::vector<int> &ids) {
+    Seed_t seed;
+    for (int id : ids)
+        seed.push_back(hits[id]);
+    return seed;
+}
+
+} // namespace
+
+int main() {
+    TMatrixDSym covariance(3);
+    for (int i = 0; i < 20; i++)
+        hits.push_back(new FwdHit(i, 0, 0, 0, -(i % 7), 0, covariance));
+
+    // nothing to do
+    CloneRemover remover(true);
+    CHECK(remover.apply(std::vector<Seed_t>()).empty());
+    CHECK(remover.nExact == 0 && remover.nNear == 0);
+
+    // exact clones in any hit order, the first one is kept
+    std::vector<Seed_t> seeds = {seedOf({1, 2, 3, 4}), seedOf({4, 3, 2, 1}), seedOf({5, 6, 7})};
+    std::vector<Seed_t> kept = CloneRemover(false).apply(seeds);
+    CHECK(kept.size() == 2);
+    CHECK(kept.size() == 2 && kept[0] == seeds[0] && kept[1] == seeds[2]);
+
+    // the longer (better) candidate wins whatever the input order
+    seeds = {seedOf({1, 2, 3}), seedOf({1, 2, 3, 4})};
+    remover = CloneRemover(true);
+    kept = remover.apply(seeds);
+    CHECK(kept.size() == 1 && kept[0] == seeds[1]);
+    CHECK(remover.nExact == 0 && remover.nNear == 1);
+
+    // one shorter subset is only dropped with near-duplicate removal
+    CHECK(CloneRemover(false).apply(seeds).size() == 2);
+
+    // same length, one hit different
+    seeds = {seedOf({1, 2, 3, 4}), seedOf({1, 2, 3, 5})};
+    kept = remover.apply(seeds);
+    CHECK(kept.size() == 1 && kept[0] == seeds[0]);
+    CHECK(remover.nNear == 1);
+
+    // two hits different, or two shorter, are distinct candidates
+    seeds = {seedOf({1, 2, 3, 4}), seedOf({1, 2, 5, 6}), seedOf({1, 2})};
+    CHECK(remover.apply(seeds).size() == 3);
+    CHECK(remover.nExact == 0 && remover.nNear == 0);
+
+    // an exact clone of a dropped near duplicate counts as exact
+    seeds = {seedOf({1, 2, 3, 4}), seedOf({1, 2, 3, 5}), seedOf({5, 3, 2, 1})};
+    kept = remover.apply(seeds);
+    CHECK(kept.size() == 1);
+    CHECK(remover.nNear + remover.nExact == 2);
+
+    for (FwdHit *h : hits)
+        delete h;
+    return unitTestResult("testCloneRemover");
+}
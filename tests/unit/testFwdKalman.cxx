@@ -0,0 +1,119 @@
+// FwdKalmanFitter against FwdKalmanBatch on helices in a constant field
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "StFwdTrackMaker/include/Tracker/FwdKalmanBatch.h"
+#include "StFwdTrackMaker/include/Tracker/FwdKalmanFitter.h"
+
+#include "UnitTest.h"
+
+namespace {
+
+const double kBz = 5.0; // kGauss
+const double kSigma = 0.02; // cm
+
+struct Track {
+    std::vector<FwdKalmanFitter::Measurement> hits;
+    FwdKalmanBatch::Seed seed;
+    double qOverP;
+};
+
+// helix through the origin with the given pT, eta, phi and charge, measured on the planes
+Track makeTrack(std::mt19937 &rng, const std::vector<double> &planes, double pt, double eta, double phi0, int q) {
+    std::normal_distribution<double> gaus(0, 1);
+    double pz = pt * sinh(eta);
+    double w = -q * 0.299792458e-3 * kBz / pz; // d(phi)/dz
+    Track t;
+    for (double z : planes) {
+        double phi = phi0 + w * z;
+        double x = (pt / pz) / w * (sin(phi) - sin(phi0));
+        double y = -(pt / pz) / w * (cos(phi) - cos(phi0));
+        t.hits.push_back(FwdKalmanFitter::Measurement{x + kSigma * gaus(rng), y + kSigma * gaus(rng), z, kSigma * kSigma, 0, kSigma * kSigma});
+    }
+    double phi = phi0 + w * planes[0];
+    t.qOverP = q / (pt * cosh(eta));
+    // seed 20% off in momentum
+    t.seed = FwdKalmanBatch::Seed{{t.hits[0].x, t.hits[0].y, pt / pz * cos(phi), pt / pz * sin(phi), t.qOverP / 1.2}};
+    return t;
+}
+
+} // namespace
+
+int main() {
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    auto field = [](double, double, double, double &bx, double &by, double &bz) {
+        bx = 0;
+        by = 0;
+        bz = kBz;
+    };
+
+    // sTGC planes, and the same with a vertex-like measurement first
+    std::vector<std::vector<double>> layouts = {{280.9, 303.7, 326.6, 349.4}, {0.0, 280.9, 303.7, 326.6, 349.4}};
+    for (const std::vector<double> &planes : layouts) {
+        std::vector<Track> tracks;
+        std::vector<std::vector<FwdKalmanFitter::Measurement>> hits;
+        std::vector<FwdKalmanBatch::Seed> seeds;
+        for (int i = 0; i < 300; i++) {
+            tracks.push_back(makeTrack(rng, planes, 0.3 + 2.7 * uniform(rng), 2.5 + 1.5 * uniform(rng), 2 * M_PI * uniform(rng), uniform(rng) < 0.5 ? -1 : 1));
+            hits.push_back(tracks.back().hits);
+            seeds.push_back(tracks.back().seed);
+        }
+
+        for (size_t iterations : {2, 5}) {
+            FwdKalmanFitter fitter(field);
+            FwdKalmanBatch batch(field);
+            fitter.setIterations(iterations);
+            batch.setIterations(iterations);
+            fitter.setXOverX0(0);
+            batch.setXOverX0(0);
+            batch.setBlockSize(64); // several blocks
+
+            std::vector<FwdKalmanFitter::Result> batched = batch.fit(hits, seeds);
+            CHECK(batched.size() == tracks.size());
+
+            size_t nConverged = 0, nSameStatus = 0, nCompared = 0;
+            double pull2 = 0;
+            for (size_t i = 0; i < tracks.size(); i++) {
+                FwdKalmanFitter::Result r = fitter.fit(hits[i], seeds[i].data());
+                const FwdKalmanFitter::Result &b = batched[i];
+                nSameStatus += r.converged == b.converged;
+                if (!r.converged || !b.converged)
+                    continue;
+                nConverged++;
+                double pull = (r.first.v[4] - tracks[i].qOverP) / sqrt(r.first.C[4][4]);
+                pull2 += pull * pull;
+                // a block keeps iterating until all its tracks are stable
+                if (b.nIterations != r.nIterations)
+                    continue;
+                nCompared++;
+
+                // the same model, up to the RK steps shared by the block
+                CHECK_CLOSE(b.first.z, r.first.z, 1e-9);
+                CHECK_CLOSE(b.chi2, r.chi2, 1e-2 * std::max(1.0, r.chi2));
+                CHECK(b.ndf == r.ndf);
+                for (int k = 0; k < 5; k++) {
+                    CHECK_CLOSE(b.first.v[k], r.first.v[k], 1e-2 * sqrt(r.first.C[k][k]));
+                    for (int l = 0; l < 5; l++)
+                        CHECK_CLOSE(b.first.C[k][l], r.first.C[k][l], 1e-2 * sqrt(r.first.C[k][k] * r.first.C[l][l]));
+                }
+            }
+            CHECK(nSameStatus >= tracks.size() - 3); // a fit at the convergence limit may differ
+            CHECK(nConverged > 0.9 * tracks.size());
+            CHECK(iterations > 2 || nCompared == nConverged); // both always do 2
+            // the fitted q/p agrees with the truth within its error
+            double pullRms = sqrt(pull2 / std::max<size_t>(1, nConverged));
+            CHECK(pullRms > 0.7 && pullRms < 1.4);
+            printf("%lu planes, %lu iterations: %lu of %lu converged, %lu compared, q/p pull rms %0.2f\n", planes.size(), iterations, nConverged, tracks.size(), nCompared, pullRms);
+        }
+    }
+
+    // too few hits
+    FwdKalmanBatch batch(field);
+    std::vector<std::vector<FwdKalmanFitter::Measurement>> twoHits(1, std::vector<FwdKalmanFitter::Measurement>(2, FwdKalmanFitter::Measurement{0, 0, 0, 1, 0, 1}));
+    CHECK(!batch.fit(twoHits, std::vector<FwdKalmanBatch::Seed>(1)).at(0).converged);
+
+    return unitTestResult("testFwdKalman");
+}
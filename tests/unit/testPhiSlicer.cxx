@@ -0,0 +1,133 @@
+// Edge cases of the PhiSlicer
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <random>
+#include <vector>
+
+#include "TMatrixDSym.h"
+
+#include "StFwdTrackMaker/include/Tracker/FwdHit.h"
+#include "StFwdTrackMaker/include/Tracker/PhiSlicer.h"
+
+#include "UnitTest.h"
+
+namespace {
+
+TMatrixDSym covariance(3);
+
+void addHit(std::map<int, std::vector<KiTrack::IHit *>> &hitmap, int layer, double phi) {
+    hitmap[layer].push_back(new FwdHit(0, 10 * cos(phi), 10 * sin(phi), 0, -layer, 0, covariance));
+}
+
+// the slices cover [-pi, pi] in order without gaps
+bool covers(const std::vector<PhiSlicer::Range> &slices) {
+    if (slices.empty() || slices.front().first != (float)-M_PI || slices.back().second != (float)M_PI)
+        return false;
+    for (size_t i = 1; i < slices.size(); i++) {
+        if (slices[i].first != slices[i - 1].second || slices[i].first >= slices[i].second)
+            return false;
+    }
+    return true;
+}
+
+// number of slices containing each hit
+void countSlices(std::map<int, std::vector<KiTrack::IHit *>> &hitmap, const std::vector<PhiSlicer::Range> &slices, std::vector<int> &nSlicesOfHit) {
+    nSlicesOfHit.clear();
+    for (auto &kv : hitmap) {
+        for (KiTrack::IHit *h : kv.second) {
+            float phi = atan2(h->getY(), h->getX());
+            nSlicesOfHit.push_back(0);
+            for (size_t s = 0; s < slices.size(); s++) {
+                nSlicesOfHit.back() += PhiSlicer::contains(slices[s], phi);
+            }
+        }
+    }
+}
+
+void clear(std::map<int, std::vector<KiTrack::IHit *>> &hitmap) {
+    for (auto &kv : hitmap) {
+        for (KiTrack::IHit *h : kv.second)
+            delete h;
+    }
+    hitmap.clear();
+}
+
+} // namespace
+
+int main() {
+    PhiSlicer slicer(1);
+    std::map<int, std::vector<KiTrack::IHit *>> hitmap;
+    std::vector<int> nSlicesOfHit;
+
+    // no hits, or a budget that fits everything: a single slice
+    CHECK(slicer.slices(hitmap, 10, 8).size() == 1);
+    CHECK(covers(slicer.slices(hitmap, 10, 8)));
+    std::mt19937 rng(5);
+    std::uniform_real_distribution<double> phi(-M_PI, M_PI);
+    for (int layer = 1; layer <= 4; layer++) {
+        for (int i = 0; i < 50; i++)
+            addHit(hitmap, layer, phi(rng));
+    }
+    CHECK(slicer.slices(hitmap, 1e9, 8).size() == 1);
+    CHECK(slicer.slices(hitmap, 0, 8).size() == 1); // no budget
+    CHECK(slicer.slices(hitmap, 10, 1).size() == 1);
+
+    // 3 * 50 * 50 pairs: every slice within the budget, every hit in exactly one slice
+    std::vector<PhiSlicer::Range> slices = slicer.slices(hitmap, 1000, 64);
+    CHECK(slices.size() > 1);
+    CHECK(covers(slices));
+    countSlices(hitmap, slices, nSlicesOfHit);
+    for (int n : nSlicesOfHit)
+        CHECK(n == 1);
+    std::vector<std::pair<float, int>> sorted;
+    for (auto &kv : hitmap) {
+        for (KiTrack::IHit *h : kv.second)
+            sorted.push_back(std::make_pair((float)atan2(h->getY(), h->getX()), kv.first));
+    }
+    std::sort(sorted.begin(), sorted.end());
+    for (const PhiSlicer::Range &r : slices) {
+        size_t begin = 0, end = 0;
+        while (begin < sorted.size() && sorted[begin].first < r.first)
+            begin++;
+        end = begin;
+        while (end < sorted.size() && sorted[end].first <= r.second)
+            end++;
+        CHECK(slicer.pairsOf(sorted, begin, end) <= 1000);
+    }
+
+    // the slice count is capped, by raising the budget
+    slices = slicer.slices(hitmap, 10, 4);
+    CHECK(slices.size() >= 2 && slices.size() <= 4);
+    CHECK(covers(slices));
+
+    // hits of equal phi are never split, whatever the budget
+    clear(hitmap);
+    for (int layer = 1; layer <= 4; layer++) {
+        for (int i = 0; i < 10; i++)
+            addHit(hitmap, layer, 0.5);
+    }
+    addHit(hitmap, 1, -1);
+    addHit(hitmap, 2, 2);
+    slices = slicer.slices(hitmap, 1, 64);
+    CHECK(covers(slices));
+    countSlices(hitmap, slices, nSlicesOfHit);
+    for (int n : nSlicesOfHit)
+        CHECK(n == 1);
+    size_t nWithPeak = 0;
+    for (const PhiSlicer::Range &r : slices)
+        nWithPeak += PhiSlicer::contains(r, atan2(10 * sin(0.5), 10 * cos(0.5)));
+    CHECK(nWithPeak == 1);
+
+    // ranges widened past +-pi wrap around
+    PhiSlicer::Range low(-M_PI - 0.1, -3), high(3, M_PI + 0.1);
+    CHECK(PhiSlicer::contains(low, M_PI - 0.05));
+    CHECK(!PhiSlicer::contains(low, M_PI - 0.2));
+    CHECK(PhiSlicer::contains(high, -M_PI + 0.05));
+    CHECK(!PhiSlicer::contains(high, -M_PI + 0.2));
+    CHECK(!PhiSlicer::contains(PhiSlicer::Range(-1, 1), 2));
+
+    clear(hitmap);
+    return unitTestResult("testPhiSlicer");
+}
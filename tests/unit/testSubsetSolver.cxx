@@ -0,0 +1,92 @@
+// SubsetSolver against a brute force search of the best set of compatible seeds
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "TMatrixDSym.h"
+
+#include "StFwdTrackMaker/include/Tracker/SubsetSolver.h"
+
+#include "UnitTest.h"
+
+namespace {
+
+// total SeedQual of the best subset without shared hits
+double bruteForce(const std::vector<Seed_t> &seeds, const SeedSignatures &signatures) {
+    const size_t n = seeds.size();
+    double best = 0;
+    for (uint32_t mask = 0; mask < (1u << n); mask++) {
+        bool ok = true;
+        double value = 0;
+        for (size_t a = 0; a < n && ok; a++) {
+            if (!(mask >> a & 1))
+                continue;
+            value += SeedQual()(seeds[a]);
+            for (size_t b = a + 1; b < n && ok; b++)
+                ok = !(mask >> b & 1) || signatures.compatible(a, b);
+        }
+        if (ok)
+            best = std::max(best, value);
+    }
+    return best;
+}
+
+} // namespace
+
+int main() {
+    std::mt19937 rng(3);
+    TMatrixDSym covariance(3);
+
+    size_t nTrials = 0, nLarge = 0;
+    for (int trial = 0; trial < 200; trial++) {
+        const size_t nHits = 20 + trial % 40, nSeeds = 2 + trial % 17;
+        std::vector<FwdHit *> hits;
+        for (size_t i = 0; i < nHits; i++)
+            hits.push_back(new FwdHit(i, 0, 0, 0, -(int)(i % 7), 0, covariance));
+
+        std::vector<Seed_t> seeds;
+        for (size_t s = 0; s < nSeeds; s++) {
+            Seed_t seed;
+            size_t length = 3 + rng() % 5;
+            while (seed.size() < length) {
+                FwdHit *h = hits[rng() % nHits];
+                if (std::find(seed.begin(), seed.end(), h) == seed.end())
+                    seed.push_back(h);
+            }
+            seeds.push_back(seed);
+        }
+
+        SeedSignatures signatures(seeds);
+        SubsetSolver solver(seeds, signatures);
+        solver.setExactMax(SubsetSolver::kExactLimit);
+        solver.setNumThreads(1 + trial % 3);
+        std::vector<unsigned char> accepted = solver.solve();
+        CHECK(accepted.size() == seeds.size());
+
+        double value = 0;
+        for (size_t a = 0; a < seeds.size(); a++) {
+            if (!accepted[a])
+                continue;
+            value += SeedQual()(seeds[a]);
+            for (size_t b = a + 1; b < seeds.size(); b++)
+                CHECK(!accepted[b] || signatures.compatible(a, b));
+        }
+        nTrials++;
+        nLarge += solver.nLargeComponents();
+        CHECK(solver.nLargeComponents() == 0);
+        CHECK_CLOSE(value, bruteForce(seeds, signatures), 1e-9);
+
+        for (FwdHit *h : hits)
+            delete h;
+    }
+    printf("%lu trials, %lu large components\n", nTrials, nLarge);
+
+    // no seeds
+    std::vector<Seed_t> none;
+    SeedSignatures noSignatures(none);
+    CHECK(SubsetSolver(none, noSignatures).solve().empty());
+
+    return unitTestResult("testSubsetSolver");
+}